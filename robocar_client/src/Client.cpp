@@ -7,6 +7,7 @@
 
 #include <iostream>
 #include <string>
+#include <sstream>
 #include "string.h"
 #include <stdlib.h>
 #include <boost/asio.hpp>
@@ -21,12 +22,25 @@
 #include <boost/function.hpp>
 #include <ros/ros.h>
 #include <sensor_msgs/LaserScan.h>
+#include <sensor_msgs/PointCloud.h>
 #include <sensor_msgs/Image.h>
+#include <sensor_msgs/CompressedImage.h>
 #include <sensor_msgs/fill_image.h>
 #include <std_msgs/String.h>
 #include <nav_msgs/Odometry.h>
 #include "IMUMessage.h"
+#include "Subscription.h"
+#include "ControlMessage.h"
+#include "DriverStatus.h"
+#include "Report.h"
+#include "LidarRequest.h"
+#include "ImageRequest.h"
+#include "JpegHandler.h"
+#include "LidarCompact.h"
+#include "LaserProjection.h"
+#include "ColorConvert.h"
 #include "Odometer.h"
+#include <vector>
 
 
 using std::string;
@@ -36,6 +50,7 @@ using std::endl;
 using boost::asio::ip::tcp;
 using boost::asio::io_service;
 using boost::unordered_map;
+using std::vector;
 
 
 #define ROBOCAR_DEFAULT_PORT 1607
@@ -52,13 +67,26 @@ uint32_t imageFrameId = 0;
 class Client
 {
 public:
-	Client (string hostname) :
+	Client (string hostname,
+		const vector<uint8_t> &_subscription=vector<uint8_t>(),
+		const vector<_controlMessageBuffer> &_controls=vector<_controlMessageBuffer>(),
+		const _lidarRequestBuffer &_lidarRequest=LidarRequest::full(),
+		const vector<_imageRequestBuffer> &_imageRequests=vector<_imageRequestBuffer>()) :
 		doStop (false),
-		lidarFrameNumber (0)
+		lidarFrameNumber (0),
+		lidarPointsFrameNumber (0),
+		lidarMergedFrameNumber (0),
+		subscription (_subscription),
+		controls (_controls),
+		lidarRequest (_lidarRequest),
+		imageRequests (_imageRequests)
 	{
 		lidarpub = roshandle.advertise <sensor_msgs::LaserScan> ("robocar_lidarscan", 100);
+		pointspub = roshandle.advertise <sensor_msgs::PointCloud> ("robocar_lidar_points", 100);
+		mergedpub = roshandle.advertise <sensor_msgs::LaserScan> ("robocar_lidar_merged", 100);
 		imagepub1 = roshandle.advertise <sensor_msgs::Image> ("/robocar/camera/left", 10);
 		imagepub2 = roshandle.advertise <sensor_msgs::Image> ("/robocar/camera/right", 10);
+		compressedpub = roshandle.advertise <sensor_msgs::CompressedImage> ("/robocar/camera/left/compressed", 10);
 		textpub = roshandle.advertise <std_msgs::String> ("robocar_debug", 100);
 		imupub = roshandle.advertise <nav_msgs::Odometry> ("robocar_odometry", 1000);
 
@@ -76,6 +104,17 @@ public:
 	void start ()
 	{
 		socket->connect(server);
+		// Without subscription, server sends everything
+		if (subscription.empty()==false)
+			Subscription::create(subscription)->send(*socket);
+		for (int i=0; i<controls.size(); i++)
+			ControlMessage::create(controls[i].target, controls[i].parameter, controls[i].value)->send(*socket);
+		if (lidarRequest.decimation > 1 || LidarRequest::hasWindow(lidarRequest) || lidarRequest.max_rate > 0)
+			LidarRequest::create(lidarRequest.decimation, lidarRequest.min_angle,
+				lidarRequest.max_angle, lidarRequest.max_rate)->send(*socket);
+		for (int i=0; i<imageRequests.size(); i++)
+			ImageRequest::create(imageRequests[i])->send(*socket);
+
 		while (doStop == false) {
 			try {
 				shared_ptr<Message> msg = Message::receive(*socket);
@@ -90,6 +129,15 @@ public:
 					case HokuyoDriverMessageCategory:
 						lidar2dMessageFunc (msg); break;
 
+					case LidarCompactMessageCategory:
+						lidarCompactMessageFunc (msg); break;
+
+					case LidarPointsMessageCategory:
+						lidarPointsMessageFunc (msg); break;
+
+					case LidarMergedMessageCategory:
+						lidarMergedMessageFunc (msg); break;
+
 					case USBCameraDriverMessageCategory:
 						usbImageMessageFunc (msg); break;
 
@@ -98,6 +146,15 @@ public:
 
 					case IMUMessageCategory :
 						imuMessageFunc (msg); break;
+
+					case ControlMessageCategory :
+						controlMessageFunc (msg); break;
+
+					case DriverStatusMessageCategory :
+						driverStatusMessageFunc (msg); break;
+
+					case ReportMessageCategory :
+						reportMessageFunc (msg); break;
 				}
 			} catch (std::exception &e) {
 				cout << "Why? " << e.what() << endl;
@@ -131,9 +188,82 @@ public:
 	}
 
 
+	// Frame of each lidar; the first one keeps the name used before
+	static string lidarFrame (int device)
+	{
+		if (device==0)
+			return "robocar_lidar";
+		std::stringstream ss;
+		ss << "robocar_lidar" << device;
+		return ss.str();
+	}
+
+
 	void lidar2dMessageFunc (shared_ptr<Message> message)
 	{
+		if (message->getSize() < sizeof(_hokuyoMessageBuffer)-1)
+			return;
 		shared_ptr<hokuyo::LaserScan> scanrecv = Robocar::HokuyoMessage::deserialize(*message.get());
+		int device = ((_hokuyoMessageBuffer*)message->getContent())->device;
+		publishScan (scanrecv, lidarFrame (device), lidarpub, lidarFrameNumber);
+	}
+
+
+	void lidarCompactMessageFunc (shared_ptr<Message> message)
+	{
+		int device = LidarCompactDecoder::device (*message);
+		if (device < 0)
+			return;
+		shared_ptr<hokuyo::LaserScan> scanrecv (new hokuyo::LaserScan ());
+		if (compactDecoders[device].decode (*message, *scanrecv)==false)
+			return;
+		publishScan (scanrecv, lidarFrame (device), lidarpub, lidarFrameNumber);
+	}
+
+
+	// Merged scans are around the car
+	void lidarMergedMessageFunc (shared_ptr<Message> message)
+	{
+		if (message->getSize() < sizeof(_hokuyoMessageBuffer)-1)
+			return;
+		shared_ptr<hokuyo::LaserScan> scanrecv = Robocar::HokuyoMessage::deserialize(*message.get());
+		publishScan (scanrecv, "robocar_base", mergedpub, lidarMergedFrameNumber);
+	}
+
+
+	void lidarPointsMessageFunc (shared_ptr<Message> message)
+	{
+		if (message->getSize() < sizeof(_lidarPointsHeader))
+			return;
+		_lidarPointsHeader *header = (_lidarPointsHeader*)message->getContent();
+		bool hasIntensity = (header->flags & POINTS_INTENSITY) != 0;
+		uint32_t n = header->num_points;
+		if (message->getSize() < sizeof(_lidarPointsHeader) + (hasIntensity ? 3 : 2)*n*sizeof(float))
+			return;
+		const float *xy = (const float*)(message->getContent() + sizeof(_lidarPointsHeader));
+
+		sensor_msgs::PointCloud cloud;
+		cloud.points.resize (n);
+		for (uint32_t i=0; i<n; i++) {
+			cloud.points[i].x = xy[2*i];
+			cloud.points[i].y = xy[2*i+1];
+			cloud.points[i].z = 0;
+		}
+		if (hasIntensity) {
+			cloud.channels.resize (1);
+			cloud.channels[0].name = "intensity";
+			cloud.channels[0].values.assign (xy + 2*n, xy + 3*n);
+		}
+		cloud.header.seq = lidarPointsFrameNumber++;
+		cloud.header.frame_id = lidarFrame (header->device);
+
+		pointspub.publish (cloud);
+	}
+
+
+	void publishScan (shared_ptr<hokuyo::LaserScan> scanrecv, const string &frame,
+		ros::Publisher &pub, int &frameNumber)
+	{
 		sensor_msgs::LaserScan scanmsg;
 		scanmsg.angle_min = scanrecv->config.min_angle;
 		scanmsg.angle_max = scanrecv->config.max_angle;
@@ -143,24 +273,92 @@ public:
 		scanmsg.ranges = scanrecv->ranges;
 		scanmsg.angle_increment = scanrecv->config.ang_increment;
 		scanmsg.intensities = scanrecv->intensities;
-		scanmsg.header.seq = lidarFrameNumber++;
-		scanmsg.header.frame_id = string("robocar_lidar");
+		scanmsg.header.seq = frameNumber++;
+		scanmsg.header.frame_id = frame;
 
-		lidarpub.publish(scanmsg);
+		pub.publish(scanmsg);
 	}
 
 
-	// XXX: Implicit assumption of image size
-#define DefaultImageWidth 640
-#define DefaultImageHeight 480
 	void usbImageMessageFunc (shared_ptr<Message> message)
 	{
+		const uint32_t headerSize = sizeof(_imageMessageBuffer) - 1;
+		if (message->getSize() < headerSize)
+			return;
+		_imageMessageBuffer *imgbuf = (_imageMessageBuffer*)message->getContent();
+		int width = imgbuf->width, height = imgbuf->height, pixels = width*height;
+		if (message->getSize() < headerSize + pixels*imagePixelBytes (imgbuf->format))
+			return;
+
+		uint8_t *data = &imgbuf->_data;
+		if (imageCompressed (imgbuf->format)) {
+			// left for the subscriber to decode
+			sensor_msgs::CompressedImage jpeg;
+			jpeg.format = "jpeg";
+			jpeg.data.assign (data, data + message->getSize() - headerSize);
+			jpeg.header.seq = imageFrameId++;
+			jpeg.header.stamp = ros::Time::fromBoost (message->getPtime());
+			cameraPublisher (imgbuf->device, imgbuf->stream, true).publish (jpeg);
+			return;
+		}
+
 		sensor_msgs::Image img;
-		sensor_msgs::fillImage (img, "rgb8",
-			DefaultImageHeight, DefaultImageWidth, 3*DefaultImageWidth,
-			(void*)message->getContent());
+		switch (imgbuf->format) {
+		case IMAGE_RGB24:
+			sensor_msgs::fillImage (img, "rgb8", height, width, 3*width, data);
+			break;
+		case IMAGE_GRAY8:
+			sensor_msgs::fillImage (img, "mono8", height, width, width, data);
+			break;
+		case IMAGE_YUYV:
+		case IMAGE_UYVY:
+			rgbBuffer.resize (3*pixels);
+			if (imgbuf->format==IMAGE_YUYV)
+				yuyvToRgb (data, &rgbBuffer[0], pixels);
+			else
+				uyvyToRgb (data, &rgbBuffer[0], pixels);
+			sensor_msgs::fillImage (img, "rgb8", height, width, 3*width, &rgbBuffer[0]);
+			break;
+		default:
+			cerr << "Unknown image format " << (int)imgbuf->format << endl;
+			return;
+		}
 		img.header.frame_id = imageFrameId++;
-		imagepub1.publish(img);
+		// capture time, as stamped by the camera
+		img.header.stamp = ros::Time::fromBoost (message->getPtime());
+		cameraPublisher (imgbuf->device, imgbuf->stream, false).publish (img);
+	}
+
+
+	/*
+	 * The first USB camera keeps the topics used before; other
+	 * streams of a camera are published below its topic, as preview,
+	 * preview2 and so on
+	 */
+	ros::Publisher &cameraPublisher (int device, int stream, bool compressed)
+	{
+		if (device==0 && stream==0)
+			return (compressed ? compressedpub : imagepub1);
+		unordered_map<int, ros::Publisher> &pubs = (compressed ? usbCompressedPubs : usbImagePubs);
+		int key = device*MaximumImageStreams + stream;
+		if (pubs.find (key)==pubs.end()) {
+			std::stringstream topic;
+			if (device==0)
+				topic << "/robocar/camera/left";
+			else
+				topic << "/robocar/camera/usb" << device;
+			if (stream==1)
+				topic << "/preview";
+			else if (stream > 1)
+				topic << "/preview" << stream;
+			if (compressed) {
+				topic << "/compressed";
+				pubs[key] = roshandle.advertise <sensor_msgs::CompressedImage> (topic.str(), 10);
+			}
+			else
+				pubs[key] = roshandle.advertise <sensor_msgs::Image> (topic.str(), 10);
+		}
+		return pubs[key];
 	}
 
 
@@ -184,6 +382,10 @@ public:
 		imgLeft.header.frame_id = "Robocar";
 		imagepub1.publish (imgLeft);
 
+		// Not all outputs of the stereo camera have two channels
+		if (imageMsg->getSize() < 2*sizeof(uint16_t) + 2*sizes[0]*sizes[1])
+			return;
+
 		sensor_msgs::fillImage (imgRight, "mono8",
 			sizes[1], sizes[0], sizes[0],
 			(void*)right);
@@ -216,6 +418,49 @@ public:
 	}
 
 
+	void controlMessageFunc (shared_ptr<Message> ctrlMsg)
+	{
+		_controlMessageBuffer *ctrl = ControlMessage::parse (*ctrlMsg);
+		if (ctrl==NULL)
+			return;
+		cout << "Control " << (int)ctrl->parameter << "=" << ctrl->value
+			<< " for category " << (int)ctrl->target
+			<< (ctrl->status==CONTROL_ACCEPTED ? " accepted" : " rejected") << endl;
+	}
+
+
+	void driverStatusMessageFunc (shared_ptr<Message> statusMsg)
+	{
+		_driverStatusBuffer *status = DriverStatus::parse (*statusMsg);
+		if (status==NULL)
+			return;
+		const char *health[] = {"stopped", "running", "recovering"};
+		cout << "Driver " << (int)status->category << " device " << (int)status->device << " "
+			<< (status->health <= DRIVER_RECOVERING ? health[status->health] : "unknown")
+			<< ", failures: " << status->failures;
+		if (status->health==DRIVER_RECOVERING)
+			cout << ", retry in " << status->retryDelay << " ms: "
+				<< DriverStatus::lastError (*statusMsg);
+		cout << endl;
+	}
+
+
+	void reportMessageFunc (shared_ptr<Message> reportMsg)
+	{
+		_reportHeader *report = Report::parse (*reportMsg);
+		if (report==NULL)
+			return;
+		const char *kind[] = {"statistics", "degraded", "restored", "safety stop", "safety release"};
+		cout << "Report " << (report->kind <= REPORT_SAFETY_RELEASE ? kind[report->kind] : "unknown")
+			<< " for category " << (int)report->source << ":";
+		_reportEntry *entries = Report::entries (*reportMsg);
+		for (int i=0; i<report->numEntries; i++)
+			cout << " " << string (entries[i].key, strnlen (entries[i].key, ReportKeyLength))
+				<< "=" << entries[i].value;
+		cout << endl;
+	}
+
+
 	void imuMessageFunc (shared_ptr<Message> imuMsg)
 	{
 		// Nasty bug is expected due to wrong time
@@ -264,12 +509,25 @@ private:
 
 	ros::NodeHandle roshandle;
 	ros::Publisher lidarpub;
+	ros::Publisher pointspub;
+	ros::Publisher mergedpub;
 	ros::Publisher imagepub1, imagepub2;
+	ros::Publisher compressedpub;
+	// USB camera streams besides the first one, by device and stream
+	unordered_map<int, ros::Publisher> usbImagePubs, usbCompressedPubs;
 	ros::Publisher textpub;
 	ros::Publisher imupub;
 
-	int lidarFrameNumber;
+	int lidarFrameNumber, lidarPointsFrameNumber, lidarMergedFrameNumber;
+	// by lidar
+	unordered_map<int, LidarCompactDecoder> compactDecoders;
+	// raw images converted here
+	vector<uint8_t> rgbBuffer;
 	Odometer odometer;
+	vector<uint8_t> subscription;
+	vector<Robocar::_controlMessageBuffer> controls;
+	_lidarRequestBuffer lidarRequest;
+	vector<_imageRequestBuffer> imageRequests;
 };
 
 }
@@ -285,11 +543,194 @@ void clientSignalHandler (int signalNumber)
 
 
 
+int streamCategory (const string &stream)
+{
+	if (stream=="text")
+		return TextSensorDriverMessageCategory;
+	else if (stream=="lidar")
+		return HokuyoDriverMessageCategory;
+	else if (stream=="compactlidar")
+		return LidarCompactMessageCategory;
+	else if (stream=="lidarpoints")
+		return LidarPointsMessageCategory;
+	else if (stream=="mergedlidar")
+		return LidarMergedMessageCategory;
+	else if (stream=="usbcam")
+		return USBCameraDriverMessageCategory;
+	else if (stream=="camera")
+		return CameraDriverMessageCategory;
+	else if (stream=="imu")
+		return IMUMessageCategory;
+	return -1;
+}
+
+
+int controlParameter (const string &param)
+{
+	if (param=="rate")
+		return Robocar::CONTROL_FRAME_RATE;
+	else if (param=="width")
+		return Robocar::CONTROL_IMAGE_WIDTH;
+	else if (param=="height")
+		return Robocar::CONTROL_IMAGE_HEIGHT;
+	else if (param=="output")
+		return Robocar::CONTROL_IMAGE_OUTPUT;
+	else if (param=="filter")
+		return Robocar::CONTROL_LIDAR_FILTER;
+	else if (param=="format")
+		return Robocar::CONTROL_IMAGE_FORMAT;
+	else if (param=="pacing")
+		return Robocar::CONTROL_FRAME_PACING;
+	else if (param=="change")
+		return Robocar::CONTROL_CHANGE_THRESHOLD;
+	else if (param=="quality")
+		return Robocar::CONTROL_JPEG_QUALITY;
+	else if (param=="subsampling")
+		return Robocar::CONTROL_JPEG_SUBSAMPLING;
+	return -1;
+}
+
+
+// Name or number of IMAGE_FORMAT
+int imageFormat (const string &name)
+{
+	if (name=="rgb")
+		return Robocar::IMAGE_RGB24;
+	else if (name=="yuyv")
+		return Robocar::IMAGE_YUYV;
+	else if (name=="uyvy")
+		return Robocar::IMAGE_UYVY;
+	else if (name=="gray")
+		return Robocar::IMAGE_GRAY8;
+	else if (name=="mjpeg")
+		return Robocar::IMAGE_MJPEG;
+	else if (name=="jpeg")
+		return Robocar::IMAGE_JPEG;
+	return atoi (name.c_str());
+}
+
+
+// JPEG_SUBSAMPLING by its usual name
+int jpegSubsampling (const string &name)
+{
+	if (name=="444")
+		return Robocar::JPEG_444;
+	else if (name=="422")
+		return Robocar::JPEG_422;
+	else if (name=="420")
+		return Robocar::JPEG_420;
+	return -1;
+}
+
+
+/*
+ * Parameters of lidar that only concern this client
+ */
+bool lidarRequestParameter (const string &param, double value, Robocar::_lidarRequestBuffer &req)
+{
+	if (param=="decimate")
+		req.decimation = (value < 1 ? 1 : (uint16_t)value);
+	else if (param=="from")
+		req.min_angle = value * M_PI / 180;
+	else if (param=="to")
+		req.max_angle = value * M_PI / 180;
+	else if (param=="maxrate")
+		req.max_rate = value;
+	else
+		return false;
+	return true;
+}
+
+
+/*
+ * Streams of a camera that only concern this client: shape is the
+ * main stream, preview the second one. Both take WxH[@rate][+x,y,WxH]
+ * where a zero size keeps that of the crop.
+ */
+bool imageRequestParameter (const string &param, const string &value, int target,
+	vector<Robocar::_imageRequestBuffer> &requests)
+{
+	int stream;
+	if (param=="shape")
+		stream = 0;
+	else if (param=="preview")
+		stream = 1;
+	else
+		return false;
+
+	Robocar::_imageRequestBuffer req = Robocar::ImageRequest::full (target, stream);
+	if (Robocar::ImageRequest::parse (value, req)==false) {
+		cerr << "Invalid image shape " << value << endl;
+		return true;
+	}
+	requests.push_back (req);
+	return true;
+}
+
+
+/*
+ * Usage: robocar_client_node address [stream ...] [stream.parameter=value ...]
+ * where stream is one of text, lidar, compactlidar, lidarpoints, mergedlidar, usbcam, camera, imu, and
+ * parameter is one of rate, width, height, output, filter, format, pacing, change,
+ * quality, subsampling.
+ * Format of usbcam is rgb, yuyv, uyvy, gray, mjpeg or jpeg; raw formats are
+ * converted here, and mjpeg is published compressed as it comes. jpeg
+ * is compressed by server, with quality (1-100) and subsampling
+ * (444, 422 or 420).
+ * usbcam.pacing=0 sends every frame the camera gives, even above rate.
+ * usbcam.change=N (or camera.change) holds back frames that differ from
+ * the last one sent by N levels or less in every block; 0 sends all.
+ * Lidar, in any encoding, also takes decimate, from, to (in degree)
+ * and maxrate, which only affect this client. So do shape and preview
+ * of usbcam and camera, e.g. usbcam.preview=320x240@5; camera takes
+ * shape only.
+ * Only listed streams are requested from the server.
+ */
 int main (int argc, char **argv)
 {
 	ros::init (argc, argv, "robocar_client_node");
 	string adr (argv[1]);
-	Robocar::Client client (adr);
+
+	vector<uint8_t> subscription;
+	vector<Robocar::_controlMessageBuffer> controls;
+	Robocar::_lidarRequestBuffer lidarRequest = Robocar::LidarRequest::full();
+	vector<Robocar::_imageRequestBuffer> imageRequests;
+	for (int i=2; i<argc; i++) {
+		string arg (argv[i]);
+		size_t dot = arg.find ('.'), eq = arg.find ('=');
+
+		if (dot!=string::npos && eq!=string::npos && dot<eq) {
+			int category = streamCategory (arg.substr(0, dot));
+			if ((category==HokuyoDriverMessageCategory || category==LidarCompactMessageCategory ||
+				category==LidarPointsMessageCategory) &&
+				lidarRequestParameter (arg.substr(dot+1, eq-dot-1), atof (arg.substr(eq+1).c_str()), lidarRequest))
+				continue;
+			if ((category==USBCameraDriverMessageCategory || category==CameraDriverMessageCategory) &&
+				imageRequestParameter (arg.substr(dot+1, eq-dot-1), arg.substr(eq+1), category, imageRequests))
+				continue;
+			int param = controlParameter (arg.substr(dot+1, eq-dot-1));
+			if (category < 0 || param < 0) {
+				cerr << "Unknown control " << arg << endl;
+				continue;
+			}
+			Robocar::_controlMessageBuffer ctrl;
+			ctrl.target = category;
+			ctrl.parameter = param;
+			ctrl.value = (param==Robocar::CONTROL_IMAGE_FORMAT ? imageFormat (arg.substr(eq+1)) :
+				param==Robocar::CONTROL_JPEG_SUBSAMPLING ? jpegSubsampling (arg.substr(eq+1)) :
+				atoi (arg.substr(eq+1).c_str()));
+			controls.push_back (ctrl);
+		}
+		else {
+			int category = streamCategory (arg);
+			if (category < 0)
+				cerr << "Unknown stream " << arg << endl;
+			else
+				subscription.push_back (category);
+		}
+	}
+
+	Robocar::Client client (adr, subscription, controls, lidarRequest, imageRequests);
 	__client = &client;
 	signal (SIGINT, clientSignalHandler);
 	signal (SIGTERM, clientSignalHandler);
@@ -0,0 +1,56 @@
+/*
+ * BufferPool.h
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_BUFFERPOOL_H_
+#define ROBOCAR_COMMON_INCLUDE_BUFFERPOOL_H_
+
+
+#include <vector>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+
+
+using boost::shared_ptr;
+
+
+namespace Robocar {
+
+
+/*
+ * Recycles fixed-size message payloads. A block goes back to the pool
+ * when the last message referring to it is destroyed, even if that
+ * happens after the pool itself is gone.
+ */
+class BufferPool
+{
+public:
+	// keeps at most capacity idle blocks
+	BufferPool (size_t blockSize, int capacity);
+
+	// Never fails; allocates a new block when none is idle
+	shared_ptr<uint8_t> acquire ();
+
+	size_t getBlockSize () { return shelf->blockSize; }
+
+private:
+	struct Shelf {
+		size_t blockSize;
+		int capacity;
+		std::vector<uint8_t*> blocks;
+		boost::interprocess::interprocess_mutex lock;
+		~Shelf ();
+	};
+
+	struct Returner {
+		shared_ptr<Shelf> shelf;
+		void operator() (uint8_t *block);
+	};
+
+	shared_ptr<Shelf> shelf;
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_BUFFERPOOL_H_ */
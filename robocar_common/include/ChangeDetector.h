@@ -0,0 +1,80 @@
+/*
+ * ChangeDetector.h
+ *
+ * Tells whether a camera frame differs from the last one sent,
+ * so that a still scene isn't sent again at full rate. Frames are
+ * compared as bytes, whatever their pixel format, in blocks of
+ * ChangeBlockWidth bytes by ChangeBlockRows rows, of which only
+ * every ChangeSampleStep-th row is read. A frame has changed when
+ * the mean difference in any block exceeds the threshold, so that
+ * a small moving object isn't lost in the average of the image.
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_CHANGEDETECTOR_H_
+#define ROBOCAR_COMMON_INCLUDE_CHANGEDETECTOR_H_
+
+
+#include <stdint.h>
+#include <vector>
+
+
+// Size of compared blocks, in byte and row
+#define ChangeBlockWidth 16
+#define ChangeBlockRows 16
+// Rows of a block actually compared, one of this many
+#define ChangeSampleStep 4
+// Seconds after which an unchanged frame is sent anyway
+#define ChangeKeyframeInterval 2.0
+
+
+namespace Robocar {
+
+
+/*
+ * Sum of absolute differences of a block ChangeBlockWidth bytes
+ * wide and rows high, with rows stride bytes apart in each image
+ */
+uint32_t blockDifference (const uint8_t *a, int strideA, const uint8_t *b, int strideB,
+	int rows, bool simd=true);
+
+
+class ChangeDetector
+{
+public:
+	ChangeDetector ();
+
+	/*
+	 * Mean difference of a block, in level of 0 to 255, above which
+	 * the frame has changed; 0 disables detection
+	 */
+	void setThreshold (int threshold);
+	int getThreshold () const { return threshold; }
+	bool isEnabled () const { return threshold > 0; }
+
+	// Forget the last frame, so that next one is sent
+	void reset ();
+
+	/*
+	 * Whether image, height rows of rowBytes, differs from the last
+	 * frame kept, or has another size. Stops at the first block
+	 * that changed.
+	 */
+	bool differs (const uint8_t *image, int rowBytes, int height) const;
+
+	// A frame must be sent at time t (in second) even if unchanged
+	bool keyframeDue (double t) const;
+
+	// image was sent at time t and is the new reference
+	void keep (const uint8_t *image, int rowBytes, int height, double t);
+
+private:
+	int threshold;
+	// compared rows of last frame kept, each of blocks across
+	std::vector<uint8_t> reference;
+	int rowBytes, height;
+	double lastKept;
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_CHANGEDETECTOR_H_ */
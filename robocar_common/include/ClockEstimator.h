@@ -0,0 +1,67 @@
+/*
+ * ClockEstimator.h
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_CLOCKESTIMATOR_H_
+#define ROBOCAR_COMMON_INCLUDE_CLOCKESTIMATOR_H_
+
+
+#include <stdint.h>
+
+
+namespace Robocar {
+
+
+/*
+ * Maps the clock of a device to system clock, from pairs of
+ * device time and system time of its readings as they stream.
+ * A line is fitted with exponential forgetting, so it follows
+ * slow drift; samples far from the line, such as readings that
+ * waited for the scheduler, are weighted down. Each sample costs
+ * a handful of arithmetic operations.
+ */
+class ClockEstimator
+{
+public:
+	ClockEstimator ();
+
+	/*
+	 * Both times are in nanosecond. Returns system time of the
+	 * reading from the fit. It is never later than systemTime, and
+	 * not earlier by more than MaximumClockCorrection; when samples
+	 * keep falling that far from the fit, it is started again.
+	 * Until there are enough samples, systemTime itself is returned.
+	 */
+	uint64_t correct (uint64_t deviceTime, uint64_t systemTime);
+
+	// Device clock was reset, or readings stopped for a while
+	void reset ();
+
+	// System time per device time minus one, in ppm;
+	// negative when device clock runs fast
+	double drift ();
+
+	// Distance between corrected and raw system time since last
+	// call of takeJitter(), in second
+	void takeJitter (double &mean, double &maximum, int &resyncs);
+
+private:
+	uint64_t deviceStart, systemStart;
+	int samples;
+	// consecutive samples too far from the line
+	int outliers;
+	// weighted mean and covariance, in second from start
+	double weight, meanX, meanY, covXX, covXY;
+	// typical distance from the line, for weighting
+	double scale;
+
+	double jitterSum, jitterMax;
+	int jitterCount, resyncCount;
+
+	double slope ();
+	double record (double residual);
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_CLOCKESTIMATOR_H_ */
@@ -0,0 +1,45 @@
+/*
+ * ColorConvert.h
+ *
+ * YUV 4:2:2 to packed RGB, for every camera path. All kernels
+ * compute the same fixed point formula, so their output is
+ * identical to the byte.
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_COLORCONVERT_H_
+#define ROBOCAR_COMMON_INCLUDE_COLORCONVERT_H_
+
+
+#include <stdint.h>
+
+
+namespace Robocar {
+
+
+enum ColorKernel {
+	COLOR_SCALAR = 0,
+	COLOR_SSE2,
+	COLOR_AVX2,
+	COLOR_NEON
+};
+
+
+// Fastest kernel on this processor; scalar when ROBOCAR_NO_SIMD is set
+ColorKernel colorKernel ();
+
+const char *colorKernelName (ColorKernel kernel);
+
+/*
+ * pixels must be even; rgb has room for 3*pixels bytes.
+ * A kernel this processor can't run is replaced by colorKernel().
+ */
+void yuyvToRgb (const uint8_t *yuyv, uint8_t *rgb, int pixels, ColorKernel kernel=colorKernel());
+void uyvyToRgb (const uint8_t *uyvy, uint8_t *rgb, int pixels, ColorKernel kernel=colorKernel());
+
+// Luma plane only, one byte per pixel
+void yuyvToGray (const uint8_t *yuyv, uint8_t *gray, int pixels);
+void uyvyToGray (const uint8_t *uyvy, uint8_t *gray, int pixels);
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_COLORCONVERT_H_ */
@@ -0,0 +1,78 @@
+/*
+ * ControlMessage.h
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_CONTROLMESSAGE_H_
+#define ROBOCAR_COMMON_INCLUDE_CONTROLMESSAGE_H_
+
+
+#include "Message.h"
+#include <stdint.h>
+
+
+namespace Robocar {
+
+
+/*
+ * Parameters of running drivers that can be changed by clients.
+ * Changes are applied by the driver at its next frame boundary.
+ */
+enum CONTROL_PARAMETER {
+	// frames (or scans, or probes) per second
+	CONTROL_FRAME_RATE = 1,
+	CONTROL_IMAGE_WIDTH = 2,
+	CONTROL_IMAGE_HEIGHT = 3,
+	// output image selection of the stereo camera (STEREO_ALG_OUTPUT_IMAGE_ID)
+	CONTROL_IMAGE_OUTPUT = 4,
+	// stages of lidar filter to run (SCAN_FILTER_STAGE mask), among
+	// those configured on server
+	CONTROL_LIDAR_FILTER = 5,
+	// pixel format of USB camera images (IMAGE_FORMAT)
+	CONTROL_IMAGE_FORMAT = 6,
+	// 1 to drop camera frames beyond CONTROL_FRAME_RATE, when the
+	// device can't be set to that rate; 0 to send all it gives
+	CONTROL_FRAME_PACING = 7,
+	// mean difference of a block (see ChangeDetector) below which a
+	// camera frame is taken as unchanged and not sent; 0 sends all
+	CONTROL_CHANGE_THRESHOLD = 8,
+	// of images compressed by server, 1 to 100
+	CONTROL_JPEG_QUALITY = 9,
+	// chroma kept by server compression (JPEG_SUBSAMPLING)
+	CONTROL_JPEG_SUBSAMPLING = 10,
+};
+
+
+enum CONTROL_STATUS {
+	// sent by client
+	CONTROL_REQUEST = 0,
+	// replies from server
+	CONTROL_ACCEPTED = 1,
+	CONTROL_REJECTED = 2,
+};
+
+
+#pragma pack (push)
+#pragma pack (1)
+struct _controlMessageBuffer {
+	// message category of the target driver
+	uint8_t target;
+	uint8_t parameter;
+	uint8_t status;
+	int32_t value;
+};
+#pragma pack (pop)
+
+
+class ControlMessage
+{
+public:
+	static shared_ptr<Message> create (uint8_t target, uint8_t parameter, int32_t value,
+		uint8_t status=CONTROL_REQUEST);
+
+	// returns NULL if message is malformed
+	static _controlMessageBuffer *parse (Message &msg);
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_CONTROLMESSAGE_H_ */
@@ -0,0 +1,92 @@
+/*
+ * DriverStatus.h
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_DRIVERSTATUS_H_
+#define ROBOCAR_COMMON_INCLUDE_DRIVERSTATUS_H_
+
+
+#include "Message.h"
+#include <stdint.h>
+#include <unistd.h>
+#include <string>
+
+
+namespace Robocar {
+
+
+enum DRIVER_HEALTH {
+	DRIVER_STOPPED = 0,
+	DRIVER_RUNNING = 1,
+	// device failed, driver is trying to reopen it
+	DRIVER_RECOVERING = 2,
+};
+
+
+/*
+ * Wire format of driver status
+ * Last error is a string that fills the rest of message
+ */
+#pragma pack (push)
+#pragma pack (1)
+struct _driverStatusBuffer {
+	// message category of the driver
+	uint8_t category;
+	// device number within category, for drivers that have several
+	uint8_t device;
+	uint8_t health;
+	// number of failures since server started
+	uint32_t failures;
+	// delay before next reopen attempt, in millisecond
+	uint32_t retryDelay;
+	char _lastError;
+};
+#pragma pack (pop)
+
+
+class DriverStatus
+{
+public:
+	static shared_ptr<Message> create (uint8_t category, uint8_t device, uint8_t health,
+		uint32_t failures=0, uint32_t retryDelay=0, const char *lastError="");
+
+	// returns NULL if message is malformed
+	static _driverStatusBuffer *parse (Message &msg);
+	static std::string lastError (Message &msg);
+};
+
+
+/*
+ * Exponential backoff between attempts to reopen a failed device
+ */
+class RecoveryBackoff
+{
+public:
+	RecoveryBackoff (useconds_t _initial=100000, useconds_t _maximum=10000000) :
+		initial (_initial), maximum (_maximum), delay (_initial),
+		failures (0)
+	{}
+
+	void failed ()
+	{
+		failures += 1;
+	}
+
+	void reset ()
+	{ delay = initial; }
+
+	useconds_t current () { return delay; }
+	uint32_t getFailures () { return failures; }
+
+	// Sleep for current delay, then double it. Returns false
+	// when interrupted by the abort flag
+	bool wait (volatile bool &abort);
+
+private:
+	useconds_t initial, maximum, delay;
+	uint32_t failures;
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_DRIVERSTATUS_H_ */
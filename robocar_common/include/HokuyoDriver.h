@@ -11,9 +11,27 @@
 #include "hokuyo.h"
 #include "Message.h"
 #include "MessageQueue.h"
+#include "DriverStatus.h"
+#include "BufferPool.h"
+#include "ScanFilter.h"
+#include "ClockEstimator.h"
 #include <vector>
 #include <boost/thread.hpp>
+#include <boost/function.hpp>
 #include <boost/interprocess/sync/interprocess_semaphore.hpp>
+#include <string>
+
+
+// Longest wait for a scan or a command reply, in millisecond
+#define ScanTimeout 2000
+// Consecutive scans with error status before the device is reopened
+#define MaxScanErrors 10
+// Scan payloads kept for reuse
+#define ScanPoolSize 16
+// Interval between two reports of scan statistics (filter cost, clock), in second
+#define ScanReportInterval 5
+// Lidars on one server; device numbers are below this
+#define MaximumLidars 8
 
 
 using boost::thread;
@@ -41,6 +59,10 @@ struct _hokuyoMessageBuffer {
 	float scan_time;
 	float min_range;
 	float max_range;
+	// which lidar, in the order given to the server
+	uint8_t device;
+	// keeps readings 4-byte aligned
+	uint8_t _pad[3];
 	// num of points
 	uint32_t num_ranges;
 	uint8_t _ranges;
@@ -58,11 +80,21 @@ public:
 };
 
 
+/*
+ * Called in driver thread with the readings of every scan, before
+ * they are filtered or sent, and whether or not anybody receives
+ * them. stamp is system time of the scan in nanosecond.
+ */
+typedef boost::function<void (uint8_t device, const float *ranges, int count,
+	const hokuyo::LaserConfig &config, uint64_t stamp)> ScanHook;
+
+
 class HokuyoSensorDriver
 {
 
 public:
-	HokuyoSensorDriver (MessageQueue *_msgq, const char *_devfilename) ;
+	HokuyoSensorDriver (MessageQueue *_msgq, const char *_devfilename, bool _lowLatency=false,
+		uint8_t _device=0) ;
 
 	~HokuyoSensorDriver ();
 
@@ -74,18 +106,81 @@ public:
 
 	static shared_ptr<uint8_t> serializeMessage (hokuyo::LaserScan &scanResult, uint32_t &bufferSize);
 
+	// Fills everything in message buffer but the readings
+	static void fillHeader (const hokuyo::LaserScan &scanResult, uint32_t numRanges, _hokuyoMessageBuffer *msgBuf,
+		uint8_t device=0);
+
 	void start ();
 
 	void stop () ;
 
+	// Runtime reconfiguration, applied at next scan
+	bool setParameter (uint8_t parameter, int32_t value);
+
+	thread *getThread () { return drvThread; }
+
+	uint8_t getDevice () { return device; }
+
+	/*
+	 * What the device is asked for on behalf of all clients:
+	 * readings merged by device, scans skipped and angular window.
+	 * Applied at next scan; scans skipped is combined with frame
+	 * rate control by taking the larger.
+	 */
+	void setScanShape (int cluster, int skip, float minAngle, float maxAngle);
+
+	// native configuration of the device
+	const hokuyo::LaserConfig &getConfig () { return laserconf; }
+
+	// See ScanFilter::configure(); call before start
+	bool setFilter (const std::string &spec);
+
+	// Call before start
+	void setScanHook (ScanHook hook) { scanHook = hook; }
+
 private:
 	MessageQueue *srvQueue;
 	thread *drvThread;
 	volatile bool doStop, doQuit;
 	semaphore *startSignal;
 	const char *devfilename;
+	bool lowLatency;
+	uint8_t device;
 	hokuyo::Laser *laser;
 	hokuyo::LaserConfig laserconf;
+
+	// number of scans skipped by device between two scans sent
+	int skip;
+	volatile int pendingSkip;
+	// shape wanted by clients, see setScanShape()
+	volatile int shapeCluster, shapeSkip;
+	volatile float shapeMinAngle, shapeMaxAngle;
+	volatile bool reconfigure;
+	void requestScans ();
+
+	// scans are decoded directly into these
+	BufferPool scanPool;
+
+	ScanFilter filter;
+	// stages set by control, -1 if none pending
+	volatile int pendingFilterStages;
+	int configuredFilterStages;
+	// filter cost since last report
+	double filterTime, filterMaxTime;
+	int filteredScans;
+	void runFilter (float *ranges, int count, const hokuyo::LaserConfig &config);
+
+	ScanHook scanHook;
+
+	// device time of scans to system time, refined as they come
+	ClockEstimator scanClock;
+	double lastReport;
+	int sentScans;
+	void reportStatistics ();
+
+	RecoveryBackoff backoff;
+	void recover (const std::string &error);
+	void reportStatus (uint8_t health, const std::string &error="");
 };
 
 
@@ -0,0 +1,66 @@
+/*
+ * ImageRequest.h
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_IMAGEREQUEST_H_
+#define ROBOCAR_COMMON_INCLUDE_IMAGEREQUEST_H_
+
+
+#include "Message.h"
+#include <stdint.h>
+#include <string>
+
+
+// Outputs a client may have from each camera
+#define MaximumImageStreams 4
+
+
+namespace Robocar {
+
+
+/*
+ * How a client wants the images of a camera (client to server).
+ * Each client has up to MaximumImageStreams outputs of one capture,
+ * each cropped, scaled and rate limited on its own, for example a
+ * preview all the time and full frames now and then. Without any
+ * request, stream 0 is the full image at every frame and the others
+ * are off. A request replaces the previous one of the same stream.
+ */
+#pragma pack (push)
+#pragma pack (1)
+struct _imageRequestBuffer {
+	// message category of the camera
+	uint8_t target;
+	uint8_t stream;
+	// 0 to stop this stream
+	uint8_t enabled;
+	// region of the camera image, in pixel;
+	// zero width or height for the whole image
+	uint16_t crop_x, crop_y, crop_width, crop_height;
+	// size sent; zero for the size of the region, or, when only
+	// one is zero, for its aspect ratio
+	uint16_t width, height;
+	// frames per second; 0 for every frame
+	float max_rate;
+};
+#pragma pack (pop)
+
+
+class ImageRequest
+{
+public:
+	static shared_ptr<Message> create (const _imageRequestBuffer &request);
+
+	// returns NULL if message is malformed
+	static _imageRequestBuffer *parse (Message &msg);
+
+	// what clients get without sending any request
+	static _imageRequestBuffer full (uint8_t target, uint8_t stream=0);
+
+	// Parses "WxH[@rate][+x,y,WxH]", the last part being the crop
+	static bool parse (const std::string &spec, _imageRequestBuffer &request);
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_IMAGEREQUEST_H_ */
@@ -0,0 +1,50 @@
+/*
+ * ImageResample.h
+ *
+ * Crop and scale of packed 8-bit images, with channels bytes per
+ * pixel (1 for gray, 3 for RGB). Rows are stride bytes apart, so that
+ * a region is given by its first pixel and the stride of its image.
+ * Vector and scalar code give identical output.
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_IMAGERESAMPLE_H_
+#define ROBOCAR_COMMON_INCLUDE_IMAGERESAMPLE_H_
+
+
+#include <stdint.h>
+
+
+namespace Robocar {
+
+
+struct ImageRect
+{
+	int x, y, width, height;
+};
+
+
+// Copies width x height pixels to a packed image
+void copyImage (const uint8_t *src, int width, int height, int stride, int channels, uint8_t *dst);
+
+/*
+ * Mean of each factor x factor block, factor 2 or 4; dst is
+ * width/factor x height/factor, leftover pixels are ignored
+ */
+void boxDownscale (const uint8_t *src, int width, int height, int stride, int channels,
+	int factor, uint8_t *dst, bool simd=true);
+
+// Bilinear to any size, pixel centres aligned
+void bilinearScale (const uint8_t *src, int width, int height, int stride, int channels,
+	uint8_t *dst, int dstWidth, int dstHeight, bool simd=true);
+
+/*
+ * Region roi of a packed width x height image, scaled to
+ * dstWidth x dstHeight with the cheapest of the above that gives it.
+ * roi must lie within the image.
+ */
+void resampleImage (const uint8_t *src, int width, int height, int channels, const ImageRect &roi,
+	uint8_t *dst, int dstWidth, int dstHeight);
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_IMAGERESAMPLE_H_ */
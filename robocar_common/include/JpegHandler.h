@@ -1,33 +1,137 @@
 /*
+ * JpegHandler.h
+ *
  * This class is a wrapper for Libjpeg to compress/decompress
- * in-memory image (no writing to file)
+ * in-memory image (no writing to file). Each object keeps its
+ * libjpeg state from one image to the next, so it must be used
+ * by one thread at a time.
  */
 
+#ifndef ROBOCAR_COMMON_INCLUDE_JPEGHANDLER_H_
+#define ROBOCAR_COMMON_INCLUDE_JPEGHANDLER_H_
 
+
+#include <cstdio>
+#include <stdint.h>
+#include <setjmp.h>
 #include <jpeglib.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
 #include <boost/shared_ptr.hpp>
 
 
-class JpegCompress {
+using boost::shared_ptr;
+
+
+// Quality of JPEG made by server, unless asked otherwise
+#define JpegDefaultQuality 80
+
+
+namespace Robocar {
+
+
+// Layout of the images given to JpegCompress
+enum JPEG_INPUT {
+	JPEG_GRAY = 0,
+	JPEG_RGB = 1,
+	// 4:2:2 as cameras give them, compressed without conversion
+	JPEG_YUYV = 2,
+	JPEG_UYVY = 3,
+};
+
+
+// Chroma resolution kept in JPEG; gray images have none
+enum JPEG_SUBSAMPLING {
+	JPEG_444 = 0,
+	JPEG_422 = 1,
+	JPEG_420 = 2,
+};
+
+
+class JpegException : public std::runtime_error
+{
+public:
+	JpegException (const std::string &what) : std::runtime_error (what) {}
+};
+
+
+// Turns libjpeg errors, which would exit, into a jump back to the caller
+struct JpegErrorHandler {
+	jpeg_error_mgr manager;
+	jmp_buf jump;
+	char message[JMSG_LENGTH_MAX];
+};
 
+
+class JpegCompress
+{
 public:
-	JpegCompress (int maximumSize);
+	JpegCompress (int quality=JpegDefaultQuality, JPEG_SUBSAMPLING subsampling=JPEG_420);
 	~JpegCompress ();
 
-	void compress (const char *image, int width, int height, bool isColor=true);
-	const uint8_t *data () { return store; }
+	// 1 to 100
+	void setQuality (int quality);
+	void setSubsampling (JPEG_SUBSAMPLING subsampling);
+
+	/*
+	 * Compresses a packed image into a new buffer, returned with its
+	 * size. The buffer is sized after previous images, so it seldom
+	 * has to grow while being written. Throws JpegException.
+	 */
+	shared_ptr<uint8_t> compress (const uint8_t *image, int width, int height, JPEG_INPUT input,
+		uint32_t &size);
 
 private:
-	uint8_t *store;
+	jpeg_compress_struct cinfo;
+	JpegErrorHandler error;
+	jpeg_destination_mgr destination;
+	int quality;
+	JPEG_SUBSAMPLING subsampling;
+
+	// buffer being written, and its size
+	shared_ptr<uint8_t> output;
+	uint32_t capacity;
+	// size of the last image, to size the next buffer
+	uint32_t lastSize;
+
+	// rows of Y, Cb and Cr given to libjpeg in raw mode
+	std::vector<uint8_t> planes;
+	std::vector<JSAMPROW> rows;
+
+	void setSampling ();
+	void writeRaw (const uint8_t *image, int width, int height, bool uyvy);
+
+	static void initDestination (j_compress_ptr cinfo);
+	static boolean emptyOutput (j_compress_ptr cinfo);
+	static void termDestination (j_compress_ptr cinfo);
 };
 
 
-class JpegDecompress {
+class JpegDecompress
+{
 public:
-
 	JpegDecompress ();
 	~JpegDecompress ();
 
+	/*
+	 * Decompresses to packed RGB, or gray when color is false, and
+	 * gives the size of the image. Throws JpegException.
+	 */
+	void decompress (const uint8_t *jpeg, uint32_t size, std::vector<uint8_t> &image,
+		int &width, int &height, bool color=true);
+
 private:
+	jpeg_decompress_struct dinfo;
+	JpegErrorHandler error;
+	jpeg_source_mgr source;
 
+	static void initSource (j_decompress_ptr dinfo);
+	static boolean fillInput (j_decompress_ptr dinfo);
+	static void skipInput (j_decompress_ptr dinfo, long count);
+	static void termSource (j_decompress_ptr dinfo);
 };
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_JPEGHANDLER_H_ */
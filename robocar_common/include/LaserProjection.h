@@ -0,0 +1,75 @@
+/*
+ * LaserProjection.h
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_LASERPROJECTION_H_
+#define ROBOCAR_COMMON_INCLUDE_LASERPROJECTION_H_
+
+
+#include "Message.h"
+#include <stdint.h>
+#include <vector>
+
+
+/*
+ * Wire format of lidar points
+ * header
+ * num_points pairs of float x, y in metre; x is forward, y to the left
+ * num_points float intensities, when flags has POINTS_INTENSITY
+ * Only beams with a reading within range limits become points.
+ */
+
+
+namespace Robocar {
+
+
+enum LIDAR_POINTS_FLAGS {
+	POINTS_INTENSITY = 1,
+};
+
+
+#pragma pack (push)
+#pragma pack (1)
+struct _lidarPointsHeader {
+	uint8_t flags;
+	// same as device of plain scan
+	uint8_t device;
+	// keeps points 4-byte aligned
+	uint8_t _pad[2];
+	uint32_t num_points;
+};
+#pragma pack (pop)
+
+
+/*
+ * Converts ranges to points. Sine and cosine of every beam are
+ * computed once, and again only when the scan geometry changes.
+ */
+class LaserProjection
+{
+public:
+	LaserProjection ();
+
+	/*
+	 * Beam i is at angle minAngle + i*increment. Points are written
+	 * to xy (room for 2*count floats), and intensities of the kept
+	 * beams to intensitiesOut when both intensity pointers are given.
+	 * Returns number of points.
+	 */
+	int project (const float *ranges, int count, float minAngle, float increment,
+		float minRange, float maxRange, float *xy,
+		const float *intensities=NULL, float *intensitiesOut=NULL);
+
+	// scan is a message of HokuyoDriverMessageCategory
+	shared_ptr<Message> toMessage (Message &scan);
+
+private:
+	std::vector<float> sines, cosines;
+	float tableStart, tableIncrement;
+
+	void buildTable (int count, float minAngle, float increment);
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_LASERPROJECTION_H_ */
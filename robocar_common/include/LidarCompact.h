@@ -0,0 +1,113 @@
+/*
+ * LidarCompact.h
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_LIDARCOMPACT_H_
+#define ROBOCAR_COMMON_INCLUDE_LIDARCOMPACT_H_
+
+
+#include "Message.h"
+#include "hokuyo.h"
+#include <stdint.h>
+#include <vector>
+
+
+/*
+ * Wire format of compact lidar scan
+ * header
+ * config, only when flags has COMPACT_CONFIG
+ * ranges, either
+ *   num_ranges values of 16 or 24 bit, or
+ *   num_ranges deltas of 8 bit from previous beam, followed by
+ *   num_exceptions values of 16 or 24 bit for beams whose delta
+ *   doesn't fit, marked by CompactDeltaEscape
+ * intensities, num_ranges values of 16 or 24 bit, when flags has
+ * COMPACT_INTENSITY
+ *
+ * Values are millimetres, little endian. The highest three values
+ * of each width stand for NaN, +Inf and -Inf.
+ */
+
+
+namespace Robocar {
+
+
+enum LIDAR_COMPACT_FLAGS {
+	// config block follows header
+	COMPACT_CONFIG = 1,
+	// ranges are 24 bit, otherwise 16 bit
+	COMPACT_WIDE = 2,
+	COMPACT_DELTA = 4,
+	COMPACT_INTENSITY = 8,
+	COMPACT_INTENSITY_WIDE = 16,
+};
+
+
+#define CompactDeltaEscape	(-128)
+
+
+#pragma pack (push)
+#pragma pack (1)
+struct _lidarCompactHeader {
+	uint8_t flags;
+	// same as device of plain scan
+	uint8_t device;
+	uint16_t num_ranges;
+	uint16_t num_exceptions;
+};
+
+struct _lidarCompactConfig {
+	float min_angle;
+	float max_angle;
+	float angular_increment;
+	float scan_time;
+	float min_range;
+	float max_range;
+};
+#pragma pack (pop)
+
+
+/*
+ * One per client and lidar; config is only sent when it changes
+ * from the one last sent to the client.
+ */
+class LidarCompactEncoder
+{
+public:
+	LidarCompactEncoder () : configSent (false) {}
+
+	// scan is a message of HokuyoDriverMessageCategory
+	shared_ptr<Message> encode (Message &scan);
+
+	// The last scan didn't reach the client; send config again
+	void reset () { configSent = false; }
+
+private:
+	_lidarCompactConfig config;
+	bool configSent;
+};
+
+
+// One per lidar, see device()
+class LidarCompactDecoder
+{
+public:
+	LidarCompactDecoder () : hasConfig (false) {}
+
+	// lidar of a compact scan; -1 if message is malformed
+	static int device (Message &msg);
+
+	// Returns false if message is malformed, or config
+	// has not been received yet
+	bool decode (Message &msg, hokuyo::LaserScan &scan);
+
+private:
+	_lidarCompactConfig config;
+	bool hasConfig;
+	// millimetres before conversion
+	std::vector<int32_t> values;
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_LIDARCOMPACT_H_ */
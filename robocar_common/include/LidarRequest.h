@@ -0,0 +1,55 @@
+/*
+ * LidarRequest.h
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_LIDARREQUEST_H_
+#define ROBOCAR_COMMON_INCLUDE_LIDARREQUEST_H_
+
+
+#include "Message.h"
+#include <stdint.h>
+
+
+namespace Robocar {
+
+
+/*
+ * What part of the lidar scans a client wants (client to server).
+ * Unlike control messages, this only affects the sending client;
+ * the server asks the device for less only when all clients agree.
+ * A new request replaces the previous one.
+ */
+#pragma pack (push)
+#pragma pack (1)
+struct _lidarRequestBuffer {
+	// adjacent readings merged into one, keeping the nearest;
+	// 1 for full resolution
+	uint16_t decimation;
+	// angular window in radian; min_angle >= max_angle
+	// means the whole field of view
+	float min_angle;
+	float max_angle;
+	// scans per second; 0 for every scan
+	float max_rate;
+};
+#pragma pack (pop)
+
+
+class LidarRequest
+{
+public:
+	static shared_ptr<Message> create (uint16_t decimation, float minAngle=0, float maxAngle=0, float maxRate=0);
+
+	// returns NULL if message is malformed
+	static _lidarRequestBuffer *parse (Message &msg);
+
+	// what clients get without sending any request
+	static _lidarRequestBuffer full ();
+
+	static bool hasWindow (const _lidarRequestBuffer &req)
+	{ return req.min_angle < req.max_angle; }
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_LIDARREQUEST_H_ */
@@ -17,6 +17,8 @@
 
 
 #define MessageMaximumSize 2097152
+// Room for a category header sent ahead of content, in byte
+#define MessagePreambleMaximum 16
 
 using boost::shared_ptr;
 
@@ -48,13 +50,15 @@ public:
 
 	Message () :
 		type(0),
-		size(0)
+		size(0),
+		preambleSize(0)
 	{ gettimeofday (&timestamp, NULL); }
 
 	Message(uint8_t category, int length, shared_ptr<uint8_t> source) :
 		type(category),
 		size(length),
-		content(source)
+		content(source),
+		preambleSize(0)
 	{ gettimeofday (&timestamp, NULL); }
 
 	static shared_ptr<Message> create (uint8_t category, int length, uint8_t *source);
@@ -73,10 +77,23 @@ public:
 
 	void send (boost::asio::ip::tcp::socket &serverSocket);
 
+	/*
+	 * Bytes sent ahead of content and counted in its size, kept in
+	 * the message itself; content can then be a buffer shared with
+	 * its producer, such as a camera frame. On the receiving side
+	 * they arrive as the start of content. getContent() of the
+	 * sending side gives the part after them. Fails when longer
+	 * than MessagePreambleMaximum.
+	 */
+	bool setPreamble (const void *data, uint8_t length);
+	const uint8_t *getPreamble () { return preamble; }
+	uint8_t getPreambleSize () { return preambleSize; }
+
 	static shared_ptr<Message> receive (boost::asio::ip::tcp::socket &clientSocket);
 
 	uint8_t getType() { return this->type; }
 	timeval getTimestamp() { return timestamp; }
+	void setTimestamp (const timeval &tv) { timestamp = tv; }
 	uint32_t getSize() { return size; }
 	shared_ptr<uint8_t> getPtr () { return content; }
 	char *getContent() { return (char*)content.get(); }
@@ -88,8 +105,11 @@ protected:
 	struct timeval timestamp;
 	uint32_t size;
 	shared_ptr<uint8_t> content;
+	uint8_t preamble[MessagePreambleMaximum];
+	uint8_t preambleSize;
 	//shared_ptr<_messageBuffer> serialize ();
 	_messageBuffer * serialize ();
+	void writeHeader (_messageBuffer *msgBuffer);
 	// add time element here
 
 };
@@ -23,17 +23,27 @@ namespace Robocar {
 class MessageQueue
 {
 public:
-	MessageQueue() {}
+	MessageQueue() : enabled (true) {}
 
 	// Clearing the message queue will affect that
 	// all messages will be destroyed
 	~MessageQueue();
 
-	void push (shared_ptr<Message>);
+	// Forced messages are queued even when disabled; meant for
+	// rare state changes that must not be lost
+	void push (shared_ptr<Message>, bool force=false);
 	bool empty ();
+	size_t size ();
 	shared_ptr<Message> pop ();
 
+	// A disabled queue silently drops everything pushed into it,
+	// so drivers can keep running while nobody is listening
+	void enable ();
+	void disable ();
+	bool isEnabled () { return enabled; }
+
 private:
+	volatile bool enabled;
 	queue < shared_ptr<Message> > pipeline;
 	boost::interprocess::interprocess_mutex _mutex;
 	boost::interprocess::interprocess_condition _condvar;
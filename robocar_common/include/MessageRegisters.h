@@ -14,6 +14,24 @@
 #define USBCameraDriverMessageCategory		3
 #define CameraDriverMessageCategory			4
 #define IMUMessageCategory					5
+// Messages sent from client to server
+#define SubscriptionMessageCategory			6
+// Runtime reconfiguration of drivers; request and reply
+#define ControlMessageCategory				7
+// Health of drivers
+#define DriverStatusMessageCategory			8
+// Server reports and statistics, as key/value pairs
+#define ReportMessageCategory				9
+// Per-client decimation, window and rate of lidar scans
+#define LidarRequestMessageCategory			10
+// Lidar scans in compact encoding, only sent when subscribed
+#define LidarCompactMessageCategory			11
+// Lidar scans as cartesian points, only sent when subscribed
+#define LidarPointsMessageCategory			12
+// Scans of all lidars merged around the car, only sent when subscribed
+#define LidarMergedMessageCategory			13
+// Per-client crop, scale and rate of camera images
+#define ImageRequestMessageCategory			14
 
 
 #endif /* ROBOCAR_COMMON_INCLUDE_MESSAGEREGISTERS_H_ */
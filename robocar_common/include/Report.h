@@ -0,0 +1,76 @@
+/*
+ * Report.h
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_REPORT_H_
+#define ROBOCAR_COMMON_INCLUDE_REPORT_H_
+
+
+#include "Message.h"
+#include <stdint.h>
+#include <vector>
+
+
+#define ReportKeyLength 16
+
+
+namespace Robocar {
+
+
+enum REPORT_KIND {
+	REPORT_STATISTICS = 0,
+	// governor lowered a stream to save CPU
+	REPORT_DEGRADED = 1,
+	// governor gave a stream its setting back
+	REPORT_RESTORED = 2,
+	// safety stage stopped the car
+	REPORT_SAFETY_STOP = 3,
+	// safety stage allows driving again
+	REPORT_SAFETY_RELEASE = 4,
+};
+
+
+/*
+ * Wire format of report; header followed by numEntries entries
+ */
+#pragma pack (push)
+#pragma pack (1)
+struct _reportHeader {
+	// message category the report is about, 0 for server itself
+	uint8_t source;
+	uint8_t kind;
+	uint16_t numEntries;
+};
+
+struct _reportEntry {
+	// zero-padded and terminated, so at most ReportKeyLength-1 long
+	char key[ReportKeyLength];
+	double value;
+};
+#pragma pack (pop)
+
+
+class Report
+{
+public:
+	Report (uint8_t _source, uint8_t _kind) :
+		source (_source), kind (_kind)
+	{}
+
+	void add (const char *key, double value);
+
+	shared_ptr<Message> toMessage ();
+
+	// returns NULL if message is malformed
+	static _reportHeader *parse (Message &msg);
+	static _reportEntry *entries (Message &msg)
+	{ return (_reportEntry*)(msg.getContent() + sizeof(_reportHeader)); }
+
+private:
+	uint8_t source, kind;
+	std::vector<_reportEntry> items;
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_REPORT_H_ */
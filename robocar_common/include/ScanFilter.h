@@ -0,0 +1,82 @@
+/*
+ * ScanFilter.h
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_SCANFILTER_H_
+#define ROBOCAR_COMMON_INCLUDE_SCANFILTER_H_
+
+
+#include "hokuyo.h"
+#include <string>
+#include <vector>
+
+
+namespace Robocar {
+
+
+// Stages, in the order they are applied
+enum SCAN_FILTER_STAGE {
+	// finite readings outside range limits become NaN
+	FILTER_CLIP = 1,
+	// median of each beam over consecutive scans
+	FILTER_TEMPORAL = 2,
+	// median along beams, against isolated speckles
+	FILTER_MEDIAN = 4,
+	// veiling points at object edges become NaN
+	FILTER_SHADOW = 8,
+};
+
+
+/*
+ * Filters lidar ranges in place. In medians, NaN neighbours take
+ * the value of the beam being filtered; a NaN beam becomes the
+ * median of its neighbours with readings, or stays NaN if there
+ * are not enough of them.
+ */
+class ScanFilter
+{
+public:
+	ScanFilter ();
+
+	/*
+	 * Comma separated stages:
+	 * clip[:min:max]     limits in metre, default is device limits
+	 * temporal3, temporal5
+	 * median3, median5
+	 * shadow[:deg[:n]]   minimum angle seen from the neighbour (default 10),
+	 *                    over n neighbours on each side (default 1)
+	 * Returns false on unknown stage; nothing is changed then.
+	 */
+	bool configure (const std::string &spec);
+
+	// Enable a subset of stages, keeping their parameters
+	void setStages (int _stages) { stages = _stages; }
+	int getStages () { return stages; }
+
+	void apply (float *ranges, int count, const hokuyo::LaserConfig &config);
+
+	// Forget previous scans, when the stream had a gap
+	void reset () { historyCount = 0; }
+
+private:
+	int stages;
+	float clipMin, clipMax;
+	int medianWindow, temporalWindow;
+	float shadowAngle;
+	int shadowNeighbours;
+
+	std::vector<float> scratch;
+	// previous scans for temporal median, as a ring
+	std::vector<float> history;
+	int historyCount, historyNext, historySize;
+	float historyIncrement, historyStart;
+
+	void clip (float *ranges, int count, float lo, float hi);
+	void temporal (float *ranges, int count, const hokuyo::LaserConfig &config);
+	void median (float *ranges, int count);
+	void shadow (float *ranges, int count, float increment);
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_SCANFILTER_H_ */
@@ -0,0 +1,51 @@
+/*
+ * Subscription.h
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_SUBSCRIPTION_H_
+#define ROBOCAR_COMMON_INCLUDE_SUBSCRIPTION_H_
+
+
+#include "Message.h"
+#include "MessageRegisters.h"
+#include <vector>
+#include <stdint.h>
+
+
+/*
+ * Wire format of subscription message (client to server)
+ * n bytes : message categories wanted by the client
+ * A new subscription replaces the previous one.
+ */
+
+
+namespace Robocar {
+
+// bit n is set when category n is wanted
+typedef uint32_t SubscriptionMask;
+
+// Clients that never send subscription receive everything,
+// except alternative encodings of a stream
+const SubscriptionMask SubscribeAll = 0xffffffff &
+	~((1u << LidarCompactMessageCategory) | (1u << LidarPointsMessageCategory) |
+	(1u << LidarMergedMessageCategory));
+
+
+inline bool isSubscribed (SubscriptionMask mask, uint8_t category)
+{
+	if (category >= 8*sizeof(SubscriptionMask))
+		return false;
+	return (mask & (1u << category)) != 0;
+}
+
+
+class Subscription
+{
+public:
+	static shared_ptr<Message> create (const std::vector<uint8_t> &categories);
+	static SubscriptionMask parse (Message &msg);
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_SUBSCRIPTION_H_ */
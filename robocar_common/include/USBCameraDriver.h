@@ -11,14 +11,25 @@
 
 #include "Message.h"
 #include "MessageQueue.h"
+#include "DriverStatus.h"
+#include "ChangeDetector.h"
 #include <vector>
 #include <boost/thread.hpp>
+#include <boost/function.hpp>
 #include <boost/interprocess/sync/interprocess_semaphore.hpp>
 #include <exception>
-#include "usb_cam.h"
+#include <string>
 
 
 #define defaultFrameRate 15
+#define defaultImageWidth 640
+#define defaultImageHeight 480
+// Longest wait for a frame, in millisecond
+#define grabTimeout 2000
+// Default camera device
+#define defaultCameraDevice "/dev/video0"
+// Seconds between statistics reports
+#define CameraReportInterval 5
 
 
 using boost::thread;
@@ -27,36 +38,140 @@ typedef boost::interprocess::interprocess_semaphore semaphore;
 
 namespace Robocar {
 
+
+class V4L2Capture;
+class CaptureGroup;
+struct V4L2Frame;
+class JpegPool;
+
+
+/*
+ * Pixel format of USB camera images, chosen by CONTROL_IMAGE_FORMAT.
+ * Raw formats are sent as the camera delivers them, and left to
+ * the client to convert.
+ */
+enum IMAGE_FORMAT {
+	IMAGE_RGB24 = 0,
+	// two bytes per pixel, chroma shared by each pair
+	IMAGE_YUYV = 1,
+	IMAGE_UYVY = 2,
+	// luma only
+	IMAGE_GRAY8 = 3,
+	// JPEG frames compressed by the camera, passed on undecoded
+	IMAGE_MJPEG = 4,
+	// JPEG compressed by server from YUYV capture (see JpegPool)
+	IMAGE_JPEG = 5,
+};
+
+
+inline bool imageCompressed (uint8_t format)
+{ return (format==IMAGE_MJPEG || format==IMAGE_JPEG); }
+
+// Zero for compressed formats, which take what the frame takes
+inline int imagePixelBytes (uint8_t format)
+{ return (format==IMAGE_RGB24 ? 3 : format==IMAGE_GRAY8 ? 1 : imageCompressed (format) ? 0 : 2); }
+
+
+#pragma pack (push)
+#pragma pack (1)
+struct _imageMessageBuffer {
+	uint16_t width;
+	uint16_t height;
+	// IMAGE_FORMAT
+	uint8_t format;
+	// camera number, as given to server
+	uint8_t device;
+	// output of the receiving client (see ImageRequest)
+	uint8_t stream;
+	uint8_t _data;
+};
+#pragma pack (pop)
+
+
+/*
+ * Drives one camera, or several that are captured together; frames
+ * of such cameras are sent in sets taken at the same time, with
+ * the same timestamp. Cameras are numbered from firstDevice.
+ */
 class USBCameraDriver
 {
 public:
-	USBCameraDriver (MessageQueue *_msgq, const char *_devfilename);
+	USBCameraDriver (MessageQueue *_msgq, const std::vector<std::string> &_devices,
+		uint8_t _firstDevice=0);
 	virtual ~USBCameraDriver ();
 
 	void init ();
 
 	static void threadEntryPoint (USBCameraDriver *drv);
 
-	inline void setFrameRate (int rate=defaultFrameRate)
-	{ intervalPerFrame = (long int)(1e6/(float)rate); }
-
 	void work ();
 
 	void start ();
 
 	void stop () ;
 
+	// Runtime reconfiguration, applied at next frame
+	bool setParameter (uint8_t parameter, int32_t value);
+	bool getParameter (uint8_t parameter, int32_t &value);
+
+	thread *getThread () { return drvThread; }
+
+	// Given each thread started to help the driver, such as JPEG
+	// workers, also those started before the hook is set
+	typedef boost::function<void (thread*)> WorkerHook;
+	void setWorkerHook (WorkerHook hook);
+
 private:
 	MessageQueue *srvQueue;
 	boost::thread *drvThread;
 	volatile bool doStop, doQuit;
 	boost::interprocess::interprocess_semaphore *startSignal;
-	const char *devfilename;
-	usb_cam_camera_image_t *camera;
-	useconds_t intervalPerFrame;
-	uint32_t lastImageSize;
-
-	shared_ptr<uint8_t> imageHandler ();
+	std::vector<V4L2Capture*> cameras;
+	// NULL with one camera
+	CaptureGroup *group;
+	uint8_t firstDevice;
+	bool opened;
+
+	int width, height, frameRate, format;
+	volatile int pendingWidth, pendingHeight, pendingFrameRate, pendingFormat;
+	volatile bool reconfigure;
+	// drop frames the device gives faster than frameRate
+	volatile bool pacing;
+	// stamp before which frames are dropped, in nanosecond
+	uint64_t nextDue;
+	// CONTROL_CHANGE_THRESHOLD, given to detectors at next frame
+	volatile int changeThreshold;
+	// one for each camera
+	std::vector<ChangeDetector> detectors;
+	// made when IMAGE_JPEG is first asked
+	JpegPool *jpegPool;
+	WorkerHook workerHook;
+	// keeps pool creation and setWorkerHook() apart
+	boost::mutex poolLock;
+	volatile int jpegQuality, jpegSubsampling;
+
+	// statistics since last report
+	double lastReport;
+	uint32_t sentFrames, droppedFrames, lastSequence;
+	double latency, maxLatency;
+	// sets not sent for being unchanged, and the bytes they'd take
+	uint32_t stillFrames;
+	double savedBytes;
+
+	bool grab (std::vector<V4L2Frame> &frames);
+	bool due (uint64_t stamp);
+	bool unchanged (const std::vector<V4L2Frame> &frames, uint64_t stamp);
+	void countFrame (const V4L2Frame &frame, bool sent, bool still, uint64_t stamp);
+	void reportStatistics ();
+	_imageMessageBuffer imageHeader (int camera);
+	shared_ptr<Message> imageMessage (int camera, const V4L2Frame &frame);
+	void compressImage (int camera, const V4L2Frame &frame, const timeval &stamp);
+	void applyParameters ();
+	void releaseCameras ();
+
+	RecoveryBackoff backoff;
+	void recover (const std::string &error);
+	void reportStatus (uint8_t health, const std::string &error="");
 };
 
 } /* namespace Robocar */
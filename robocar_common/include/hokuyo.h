@@ -32,6 +32,8 @@
 #include <stdint.h>
 #include <limits>
 
+#include "hokuyo_decode.h"
+
 //! A namespace containing the hokuyo device driver
 namespace hokuyo
 {
@@ -43,6 +45,9 @@ namespace hokuyo
 
   //! The maximum number of bytes that should be skipped when looking for a response
   const int MAX_SKIPPED = 1000000;
+
+  //! Size of the serial input buffer; holds several complete data lines
+  const int READ_BUF_SIZE = 4096;
   
   //! Macro for defining an exception with a given parent (std::runtime_error should be top parent)
 #define DEF_EXCEPTION(name, parent) \
@@ -139,6 +144,30 @@ namespace hokuyo
      */
     void open(const char * port_name);
 
+    //! Use an already opened descriptor instead of a serial port
+    /*!
+     * The descriptor may be a pipe or a socket carrying a recorded SCIP2.0
+     * stream. Sensor configuration is read from it (PP command), so the
+     * stream must start with a PP reply.
+     *
+     * \param fd   Descriptor to read from; closed by close()
+     */
+    void attach(int fd);
+
+    //! Request low-latency tty settings at next open()
+    /*!
+     * Asks the serial driver to push received bytes immediately instead
+     * of batching them. Not all drivers support it; failure is ignored.
+     */
+    void setLowLatency(bool enable) { low_latency_ = enable; }
+
+    //! Decode scans with the original per-value code
+    /*!
+     * Kept as reference for the table-driven decoder; both must give
+     * identical scans.
+     */
+    void setLegacyDecoder(bool enable) { legacy_decoder_ = enable; }
+
     //! Close the port
     /*!
      * This call essentiall wraps fclose.
@@ -226,6 +255,19 @@ namespace hokuyo
      */
     int serviceScan(LaserScan& scan, int timeout = -1);
 
+    //! Retrieve a scan, decoding it into caller's storage
+    /*!
+     * Ranges are written to data, immediately followed by intensities
+     * if the scan has them; scan.ranges and scan.intensities stay empty.
+     *
+     * \param data        Room for 2*MAX_READINGS floats.
+     * \param ranges      Set to number of ranges written.
+     * \param intensities Set to number of intensities written, 0 or ranges.
+     *
+     * \return Same as serviceScan().
+     */
+    int serviceScan(LaserScan& scan, float *data, int &ranges, int &intensities, int timeout = -1);
+
     //! Turn the laser off
     /*!
      * \return Status code returned from hokuyo device.
@@ -268,7 +310,9 @@ namespace hokuyo
      *  computer system time.  This function takes the same arguments
      *  as a call to request scans, since this latency may be
      *  parameter dependent.  NOTE: This method will take
-     *  approximately 10 seconds to return.
+     *  approximately 10 seconds to return.  HokuyoSensorDriver
+     *  doesn't call it; it fits the clock from streaming scans
+     *  with Robocar::ClockEstimator instead.
      *
      * \param intensity  Whether or not intensity data should be provided
      * \param min_ang    Minimal angle of the scan (radians)
@@ -337,6 +381,16 @@ namespace hokuyo
     //! Read a full line from the hokuyo using fgets
     int laserReadline(char *buf, int len, int timeout = -1);
 
+    //! Read a full line without copying it
+    /*!
+     * \param line  Set to the start of the line inside the input buffer.
+     *              It is not null-terminated, and stays valid only until
+     *              the next read from the device.
+     *
+     * \return Length of the line, including the trailing newline.
+     */
+    int laserReadlineView(const char **line, int timeout = -1);
+
     //! Wrapper around tcflush
     int laserFlush();
 
@@ -361,8 +415,18 @@ namespace hokuyo
     //! Compute the checksum of a given buffer
     bool checkSum(const char* buf, int buf_len);
 
-    //! Read in a scan
-    void readData(LaserScan& scan, bool has_intensity, int timout = -1);
+    //! Common part of both serviceScan()
+    int readScan(LaserScan& scan, float *data, int &ranges, bool &has_intensity, int timeout);
+
+    //! Read in a scan; into data instead of scan vectors if given.
+    //! Returns number of ranges.
+    int readData(LaserScan& scan, bool has_intensity, int timout = -1, float *data = NULL);
+
+    //! Read in a scan, original implementation
+    void readDataLegacy(LaserScan& scan, bool has_intensity, int timout = -1);
+
+    //! Fill error_table_ according to the model
+    void buildErrorTable();
 
     int dmin_;
     int dmax_;
@@ -388,7 +452,18 @@ namespace hokuyo
     std::string protocol_version_;
     std::string firmware_version_;
 
-    char read_buf[256];
+    bool low_latency_;
+    bool legacy_decoder_;
+
+    //! Range of each error code; codes that are not errors for this
+    //! model hold their plain value
+    float error_table_[ERROR_CODES];
+
+    //! Data blocks of a scan joined together, and their decoded values
+    char data_buf_[MAX_READINGS*6 + 64 + DECODE_PADDING];
+    uint32_t values_[MAX_READINGS*2];
+
+    char read_buf[READ_BUF_SIZE];
     int read_buf_start;
     int read_buf_end;
   };
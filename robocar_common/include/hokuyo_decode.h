@@ -0,0 +1,29 @@
+/*
+ * hokuyo_decode.h
+ *
+ * Decoding of SCIP2.0 data blocks, shared by all laser models
+ */
+
+#ifndef HOKUYO_DECODE_H_
+#define HOKUYO_DECODE_H_
+
+#include <stdint.h>
+
+
+namespace hokuyo
+{
+  //! Readable bytes needed past the last value by decodeValues()
+  const int DECODE_PADDING = 16;
+
+  //! Codes below this may be error codes, depending on the model
+  const uint32_t ERROR_CODES = 20;
+
+  //! Decode count 3-character values (6 bits per character)
+  void decodeValues(const char *src, int count, uint32_t *dst);
+
+  //! Convert millimeters to meters; values under ERROR_CODES are
+  //! looked up in error_table instead
+  void valuesToRanges(const uint32_t *values, int count, const float *error_table, float *ranges);
+}
+
+#endif
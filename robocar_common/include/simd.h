@@ -0,0 +1,42 @@
+/*
+ * simd.h
+ *
+ * Which vector instructions may be used. On x86 the kernels are
+ * compiled with target attributes and chosen at runtime, so the
+ * binary still runs on older processors; NEON is decided at
+ * compile time.
+ */
+
+#ifndef ROBOCAR_COMMON_INCLUDE_SIMD_H_
+#define ROBOCAR_COMMON_INCLUDE_SIMD_H_
+
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define ROBOCAR_SIMD_X86 1
+#include <immintrin.h>
+#define ROBOCAR_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define ROBOCAR_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+namespace Robocar {
+
+
+// Setting environment variable ROBOCAR_NO_SIMD forces scalar code
+bool simdDisabled ();
+
+#ifdef ROBOCAR_SIMD_X86
+inline bool cpuHasSSSE3 ()
+{ return simdDisabled()==false && __builtin_cpu_supports ("ssse3"); }
+
+inline bool cpuHasAVX2 ()
+{ return simdDisabled()==false && __builtin_cpu_supports ("avx2"); }
+#endif
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_COMMON_INCLUDE_SIMD_H_ */
@@ -0,0 +1,60 @@
+/*
+ * BufferPool.cpp
+ */
+
+#include "BufferPool.h"
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+
+using boost::interprocess::scoped_lock;
+using boost::interprocess::interprocess_mutex;
+
+
+namespace Robocar {
+
+
+BufferPool::BufferPool (size_t blockSize, int capacity) :
+	shelf (new Shelf)
+{
+	shelf->blockSize = blockSize;
+	shelf->capacity = capacity;
+	shelf->blocks.reserve (capacity);
+}
+
+
+shared_ptr<uint8_t> BufferPool::acquire ()
+{
+	uint8_t *block = NULL;
+	{
+		scoped_lock<interprocess_mutex> lock (shelf->lock);
+		if (shelf->blocks.empty()==false) {
+			block = shelf->blocks.back();
+			shelf->blocks.pop_back();
+		}
+	}
+	if (block==NULL)
+		block = new uint8_t [shelf->blockSize];
+
+	Returner returner;
+	returner.shelf = shelf;
+	return shared_ptr<uint8_t> (block, returner);
+}
+
+
+void BufferPool::Returner::operator() (uint8_t *block)
+{
+	scoped_lock<interprocess_mutex> lock (shelf->lock);
+	if ((int)shelf->blocks.size() < shelf->capacity)
+		shelf->blocks.push_back (block);
+	else
+		delete[] block;
+}
+
+
+BufferPool::Shelf::~Shelf ()
+{
+	for (size_t i=0; i<blocks.size(); i++)
+		delete[] blocks[i];
+}
+
+} /* namespace Robocar */
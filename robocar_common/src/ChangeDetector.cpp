@@ -0,0 +1,107 @@
+/*
+ * ChangeDetector.cpp
+ */
+
+#include "ChangeDetector.h"
+#include "simd.h"
+#include <cstring>
+
+
+namespace Robocar {
+
+
+uint32_t blockDifference (const uint8_t *a, int strideA, const uint8_t *b, int strideB,
+	int rows, bool simd)
+{
+	simd = simd && simdDisabled()==false;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simd) {
+		__m128i acc = _mm_setzero_si128 ();
+		for (int r=0; r<rows; r++)
+			acc = _mm_add_epi64 (acc, _mm_sad_epu8 (_mm_loadu_si128 ((const __m128i*)(a + r*strideA)),
+				_mm_loadu_si128 ((const __m128i*)(b + r*strideB))));
+		return _mm_cvtsi128_si32 (acc) + _mm_cvtsi128_si32 (_mm_unpackhi_epi64 (acc, acc));
+	}
+#elif defined(ROBOCAR_SIMD_NEON)
+	if (simd) {
+		// two differences per lane and row; fits 16 bits up to 128 rows
+		uint16x8_t acc = vdupq_n_u16 (0);
+		for (int r=0; r<rows; r++)
+			acc = vpadalq_u8 (acc, vabdq_u8 (vld1q_u8 (a + r*strideA), vld1q_u8 (b + r*strideB)));
+		uint64x2_t sum = vpaddlq_u32 (vpaddlq_u16 (acc));
+		return vgetq_lane_u64 (sum, 0) + vgetq_lane_u64 (sum, 1);
+	}
+#endif
+	uint32_t sum = 0;
+	for (int r=0; r<rows; r++)
+		for (int i=0; i<ChangeBlockWidth; i++) {
+			int d = a[r*strideA + i] - b[r*strideB + i];
+			sum += (d < 0 ? -d : d);
+		}
+	return sum;
+}
+
+
+ChangeDetector::ChangeDetector () :
+	threshold (0),
+	rowBytes (0), height (0),
+	lastKept (0)
+{}
+
+
+void ChangeDetector::setThreshold (int _threshold)
+{
+	threshold = _threshold;
+	reset ();
+}
+
+
+void ChangeDetector::reset ()
+{
+	reference.clear ();
+	rowBytes = height = 0;
+	lastKept = 0;
+}
+
+
+bool ChangeDetector::differs (const uint8_t *image, int _rowBytes, int _height) const
+{
+	const int across = _rowBytes / ChangeBlockWidth, down = _height / ChangeBlockRows,
+		samples = ChangeBlockRows / ChangeSampleStep;
+	if (reference.empty() || _rowBytes != rowBytes || _height != height || across==0 || down==0)
+		return true;
+
+	const int refStride = across*ChangeBlockWidth;
+	const uint32_t limit = threshold * ChangeBlockWidth * samples;
+	for (int y=0; y<down; y++) {
+		const uint8_t *row = image + y*ChangeBlockRows*_rowBytes,
+			*refRow = &reference[y*samples*refStride];
+		for (int x=0; x<across; x++) {
+			if (blockDifference (row + x*ChangeBlockWidth, ChangeSampleStep*_rowBytes,
+				refRow + x*ChangeBlockWidth, refStride, samples) > limit)
+				return true;
+		}
+	}
+	return false;
+}
+
+
+bool ChangeDetector::keyframeDue (double t) const
+{
+	return (t - lastKept >= ChangeKeyframeInterval || t < lastKept);
+}
+
+
+void ChangeDetector::keep (const uint8_t *image, int _rowBytes, int _height, double t)
+{
+	const int across = _rowBytes / ChangeBlockWidth, down = _height / ChangeBlockRows,
+		samples = ChangeBlockRows / ChangeSampleStep, refStride = across*ChangeBlockWidth;
+	rowBytes = _rowBytes;
+	height = _height;
+	lastKept = t;
+	reference.resize (down*samples*refStride);
+	for (int r=0; r<down*samples; r++)
+		memcpy (&reference[r*refStride], image + r*ChangeSampleStep*_rowBytes, refStride);
+}
+
+} /* namespace Robocar */
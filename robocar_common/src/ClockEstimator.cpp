@@ -0,0 +1,129 @@
+/*
+ * ClockEstimator.cpp
+ */
+
+#include "ClockEstimator.h"
+#include <cmath>
+#include <algorithm>
+
+
+// Weight left to a sample after the next one; 0.999 lasts some 1000 samples
+#define ClockForgetting 0.999
+// Samples before the fit is used
+#define MinimumClockSamples 20
+// Largest correction toward the past, in second
+#define MaximumClockCorrection 0.05
+// Drift beyond this is taken as a bad fit, not a real clock
+#define MaximumClockDrift 0.001
+// Consecutive samples off the line before the fit is started again
+#define ClockResyncSamples 5
+// Samples within this many scales from the line have full weight
+#define ClockHuberLimit 2.0
+// Scale never gets below this, in second
+#define MinimumClockScale 0.0002
+
+
+namespace Robocar {
+
+
+ClockEstimator::ClockEstimator () :
+	jitterSum (0), jitterMax (0),
+	jitterCount (0), resyncCount (0)
+{
+	reset ();
+}
+
+
+void ClockEstimator::reset ()
+{
+	deviceStart = systemStart = 0;
+	samples = outliers = 0;
+	weight = meanX = meanY = covXX = covXY = 0;
+	scale = 0.001;
+}
+
+
+double ClockEstimator::slope ()
+{
+	if (covXX <= 0)
+		return 1.0;
+	double b = covXY / covXX;
+	return std::max (1.0-MaximumClockDrift, std::min (1.0+MaximumClockDrift, b));
+}
+
+
+double ClockEstimator::drift ()
+{
+	return (samples >= MinimumClockSamples ? (slope() - 1.0) * 1e6 : 0);
+}
+
+
+uint64_t ClockEstimator::correct (uint64_t deviceTime, uint64_t systemTime)
+{
+	if (samples==0) {
+		deviceStart = deviceTime;
+		systemStart = systemTime;
+	}
+	double x = ((int64_t)(deviceTime - deviceStart)) * 1e-9,
+		y = ((int64_t)(systemTime - systemStart)) * 1e-9;
+
+	// Predict before this sample is taken in
+	double fitted = (samples > 0 ? meanY + slope() * (x - meanX) : y),
+		residual = y - fitted;
+
+	if (samples >= MinimumClockSamples && fabs (residual) > MaximumClockCorrection) {
+		// A stall of the reader passes; a jump of device clock,
+		// or a fit gone astray, doesn't
+		if (++outliers < ClockResyncSamples)
+			return systemTime - (uint64_t)(record (residual) * 1e9);
+		reset ();
+		resyncCount += 1;
+		return correct (deviceTime, systemTime);
+	}
+	outliers = 0;
+
+	// Huber weight
+	double limit = ClockHuberLimit * scale,
+		w = (fabs (residual) <= limit ? 1.0 : limit / fabs (residual));
+	scale += 0.05 * (std::min (fabs (residual), 2*limit) - scale);
+	scale = std::max (scale, (double)MinimumClockScale);
+
+	weight = ClockForgetting * weight + w;
+	double dx = x - meanX;
+	meanX += w / weight * dx;
+	meanY += w / weight * (y - meanY);
+	covXX = ClockForgetting * covXX + w * dx * (x - meanX);
+	covXY = ClockForgetting * covXY + w * dx * (y - meanY);
+	samples += 1;
+
+	if (samples <= MinimumClockSamples)
+		return systemTime;
+
+	return systemTime - (uint64_t)(record (residual) * 1e9);
+}
+
+
+/*
+ * A reading can't arrive before it was taken, so only late
+ * ones are moved, and by no more than the limit
+ */
+double ClockEstimator::record (double residual)
+{
+	double correction = std::max (0.0, std::min (residual, (double)MaximumClockCorrection));
+	jitterSum += correction;
+	jitterMax = std::max (jitterMax, correction);
+	jitterCount += 1;
+	return correction;
+}
+
+
+void ClockEstimator::takeJitter (double &mean, double &maximum, int &resyncs)
+{
+	mean = (jitterCount > 0 ? jitterSum / jitterCount : 0);
+	maximum = jitterMax;
+	resyncs = resyncCount;
+	jitterSum = jitterMax = 0;
+	jitterCount = resyncCount = 0;
+}
+
+} /* namespace Robocar */
@@ -0,0 +1,310 @@
+/*
+ * ColorConvert.cpp
+ */
+
+#include "ColorConvert.h"
+#include "simd.h"
+
+
+/*
+ * Coefficients of the conversion, over 2^15, as usb_cam has always used:
+ * r = y + 1.136*v
+ * g = y - 0.396*u - 0.578*v
+ * b = y + 2.041*u
+ * with u and v centred on zero. Vector kernels split the coefficients
+ * above 2^15 into a whole part and a fraction, which rounds the same.
+ */
+#define ColorRV 37221
+#define ColorGU 12975
+#define ColorGV 18949
+#define ColorBU 66883
+
+
+namespace Robocar {
+
+
+static inline uint8_t clip (int v)
+{
+	return (v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+
+/*
+ * Reference for the vector kernels. In a macropixel, luma is at
+ * bytes 0 and 2 for YUYV, and 1 and 3 for UYVY.
+ */
+template <bool uyvy>
+static void convertScalar (const uint8_t *src, uint8_t *dst, int pixels)
+{
+	for (int i=0; i+2 <= pixels; i+=2, src+=4, dst+=6) {
+		int y0 = src[uyvy ? 1 : 0],
+			u = src[uyvy ? 0 : 1] - 128,
+			y1 = src[uyvy ? 3 : 2],
+			v = src[uyvy ? 2 : 3] - 128;
+		int r = (v*ColorRV) >> 15,
+			g = (u*ColorGU + v*ColorGV) >> 15,
+			b = (u*ColorBU) >> 15;
+		dst[0] = clip (y0+r);
+		dst[1] = clip (y0-g);
+		dst[2] = clip (y0+b);
+		dst[3] = clip (y1+r);
+		dst[4] = clip (y1-g);
+		dst[5] = clip (y1+b);
+	}
+}
+
+
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+/*
+ * Eight pixels of 16 bytes to 16-bit r, g, b. Chroma stays
+ * interleaved: u in even lanes, v in odd ones.
+ * (v*37221)>>15 == v + mulhi(2v, 4453), (u*66883)>>15 == 2u + mulhi(2u, 1347)
+ */
+template <bool uyvy>
+static inline void termsSSE2 (__m128i x, __m128i &r, __m128i &g, __m128i &b)
+{
+	const __m128i lowByte = _mm_set1_epi16 (0xff),
+		lowHalf = _mm_set1_epi32 (0xffff);
+	__m128i y = (uyvy ? _mm_srli_epi16 (x, 8) : _mm_and_si128 (x, lowByte)),
+		uv = _mm_sub_epi16 ((uyvy ? _mm_and_si128 (x, lowByte) : _mm_srli_epi16 (x, 8)),
+			_mm_set1_epi16 (128));
+
+	// b term in even lanes, r term in odd
+	__m128i t = _mm_add_epi16 (
+		_mm_mulhi_epi16 (_mm_add_epi16 (uv, uv), _mm_set1_epi32 (((ColorRV-32768) << 16) | (ColorBU-65536))),
+		_mm_add_epi16 (uv, _mm_and_si128 (uv, lowHalf)));
+	__m128i gt = _mm_srai_epi32 (_mm_madd_epi16 (uv, _mm_set1_epi32 ((ColorGV << 16) | ColorGU)), 15);
+
+	// every term goes to both pixels of its pair
+	b = _mm_add_epi16 (y, _mm_or_si128 (_mm_and_si128 (t, lowHalf), _mm_slli_epi32 (t, 16)));
+	r = _mm_add_epi16 (y, _mm_or_si128 (_mm_andnot_si128 (lowHalf, t), _mm_srli_epi32 (t, 16)));
+	g = _mm_sub_epi16 (y, _mm_or_si128 (_mm_and_si128 (gt, lowHalf), _mm_slli_epi32 (gt, 16)));
+}
+
+
+// Four RGB0 pixels to 12 bytes at the bottom
+static inline __m128i pack3SSE2 (__m128i p)
+{
+	const __m128i lowWord = _mm_set_epi32 (0, -1, 0, -1);
+	__m128i q = _mm_or_si128 (_mm_and_si128 (p, lowWord),
+		_mm_srli_epi64 (_mm_andnot_si128 (lowWord, p), 8));
+	return _mm_or_si128 (_mm_move_epi64 (q), _mm_slli_si128 (_mm_srli_si128 (q, 8), 6));
+}
+
+
+/*
+ * Stores 16 pixels as 48 bytes; each 16-byte store runs over
+ * the next one, and the last runs 4 bytes past the end
+ */
+static inline void storeSSE2 (__m128i r, __m128i g, __m128i b, uint8_t *dst)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	__m128i rg0 = _mm_unpacklo_epi8 (r, g), rg1 = _mm_unpackhi_epi8 (r, g),
+		b0 = _mm_unpacklo_epi8 (b, zero), b1 = _mm_unpackhi_epi8 (b, zero);
+	_mm_storeu_si128 ((__m128i*)(dst), pack3SSE2 (_mm_unpacklo_epi16 (rg0, b0)));
+	_mm_storeu_si128 ((__m128i*)(dst+12), pack3SSE2 (_mm_unpackhi_epi16 (rg0, b0)));
+	_mm_storeu_si128 ((__m128i*)(dst+24), pack3SSE2 (_mm_unpacklo_epi16 (rg1, b1)));
+	_mm_storeu_si128 ((__m128i*)(dst+36), pack3SSE2 (_mm_unpackhi_epi16 (rg1, b1)));
+}
+
+
+template <bool uyvy>
+static int convertSSE2 (const uint8_t *src, uint8_t *dst, int pixels)
+{
+	int i = 0;
+	// the 4 bytes written past a group belong to the next pair
+	for (; i+18 <= pixels; i+=16) {
+		__m128i r0, g0, b0, r1, g1, b1;
+		termsSSE2<uyvy> (_mm_loadu_si128 ((const __m128i*)(src + 2*i)), r0, g0, b0);
+		termsSSE2<uyvy> (_mm_loadu_si128 ((const __m128i*)(src + 2*i + 16)), r1, g1, b1);
+		storeSSE2 (_mm_packus_epi16 (r0, r1), _mm_packus_epi16 (g0, g1),
+			_mm_packus_epi16 (b0, b1), dst + 3*i);
+	}
+	return i;
+}
+
+
+// Same as the SSE2 kernel, on both 128-bit lanes
+template <bool uyvy>
+ROBOCAR_TARGET("avx2")
+static inline void termsAVX2 (__m256i x, __m256i &r, __m256i &g, __m256i &b)
+{
+	const __m256i lowByte = _mm256_set1_epi16 (0xff),
+		lowHalf = _mm256_set1_epi32 (0xffff);
+	__m256i y = (uyvy ? _mm256_srli_epi16 (x, 8) : _mm256_and_si256 (x, lowByte)),
+		uv = _mm256_sub_epi16 ((uyvy ? _mm256_and_si256 (x, lowByte) : _mm256_srli_epi16 (x, 8)),
+			_mm256_set1_epi16 (128));
+
+	__m256i t = _mm256_add_epi16 (
+		_mm256_mulhi_epi16 (_mm256_add_epi16 (uv, uv), _mm256_set1_epi32 (((ColorRV-32768) << 16) | (ColorBU-65536))),
+		_mm256_add_epi16 (uv, _mm256_and_si256 (uv, lowHalf)));
+	__m256i gt = _mm256_srai_epi32 (_mm256_madd_epi16 (uv, _mm256_set1_epi32 ((ColorGV << 16) | ColorGU)), 15);
+
+	b = _mm256_add_epi16 (y, _mm256_or_si256 (_mm256_and_si256 (t, lowHalf), _mm256_slli_epi32 (t, 16)));
+	r = _mm256_add_epi16 (y, _mm256_or_si256 (_mm256_andnot_si256 (lowHalf, t), _mm256_srli_epi32 (t, 16)));
+	g = _mm256_sub_epi16 (y, _mm256_or_si256 (_mm256_and_si256 (gt, lowHalf), _mm256_slli_epi32 (gt, 16)));
+}
+
+
+ROBOCAR_TARGET("avx2")
+static inline __m256i pack3AVX2 (__m256i p)
+{
+	const __m256i lowWord = _mm256_set_epi32 (0, -1, 0, -1, 0, -1, 0, -1),
+		lowQuad = _mm256_set_epi32 (0, 0, -1, -1, 0, 0, -1, -1);
+	__m256i q = _mm256_or_si256 (_mm256_and_si256 (p, lowWord),
+		_mm256_srli_epi64 (_mm256_andnot_si256 (lowWord, p), 8));
+	return _mm256_or_si256 (_mm256_and_si256 (q, lowQuad), _mm256_slli_si256 (_mm256_srli_si256 (q, 8), 6));
+}
+
+
+template <bool uyvy>
+ROBOCAR_TARGET("avx2")
+static int convertAVX2 (const uint8_t *src, uint8_t *dst, int pixels)
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	int i = 0;
+	for (; i+34 <= pixels; i+=32) {
+		__m256i a = _mm256_loadu_si256 ((const __m256i*)(src + 2*i)),
+			c = _mm256_loadu_si256 ((const __m256i*)(src + 2*i + 32));
+		// lanes hold pixels 0-7 & 16-23, and 8-15 & 24-31, so that
+		// packing gives 0-15 in low lane and 16-31 in high lane
+		__m256i r0, g0, b0, r1, g1, b1;
+		termsAVX2<uyvy> (_mm256_permute2x128_si256 (a, c, 0x20), r0, g0, b0);
+		termsAVX2<uyvy> (_mm256_permute2x128_si256 (a, c, 0x31), r1, g1, b1);
+		__m256i r = _mm256_packus_epi16 (r0, r1),
+			g = _mm256_packus_epi16 (g0, g1),
+			b = _mm256_packus_epi16 (b0, b1);
+
+		__m256i rg0 = _mm256_unpacklo_epi8 (r, g), rg1 = _mm256_unpackhi_epi8 (r, g),
+			bz0 = _mm256_unpacklo_epi8 (b, zero), bz1 = _mm256_unpackhi_epi8 (b, zero);
+		__m256i p[4] = {
+			pack3AVX2 (_mm256_unpacklo_epi16 (rg0, bz0)),
+			pack3AVX2 (_mm256_unpackhi_epi16 (rg0, bz0)),
+			pack3AVX2 (_mm256_unpacklo_epi16 (rg1, bz1)),
+			pack3AVX2 (_mm256_unpackhi_epi16 (rg1, bz1))
+		};
+		// in address order, so each store covers the tail of the one before
+		uint8_t *out = dst + 3*i;
+		for (int k=0; k<4; k++)
+			_mm_storeu_si128 ((__m128i*)(out + 12*k), _mm256_castsi256_si128 (p[k]));
+		for (int k=0; k<4; k++)
+			_mm_storeu_si128 ((__m128i*)(out + 48 + 12*k), _mm256_extracti128_si256 (p[k], 1));
+	}
+	return i;
+}
+#endif
+
+
+#ifdef ROBOCAR_SIMD_NEON
+static inline int16x8_t termNEON (int16x8_t c, int32_t k)
+{
+	int32x4_t lo = vmulq_n_s32 (vmovl_s16 (vget_low_s16 (c)), k),
+		hi = vmulq_n_s32 (vmovl_s16 (vget_high_s16 (c)), k);
+	return vcombine_s16 (vmovn_s32 (vshrq_n_s32 (lo, 15)), vmovn_s32 (vshrq_n_s32 (hi, 15)));
+}
+
+
+template <bool uyvy>
+static int convertNEON (const uint8_t *src, uint8_t *dst, int pixels)
+{
+	const int16x8_t half = vdupq_n_s16 (128);
+	int i = 0;
+	for (; i+16 <= pixels; i+=16) {
+		uint8x8x4_t in = vld4_u8 (src + 2*i);
+		int16x8_t y0 = vreinterpretq_s16_u16 (vmovl_u8 (in.val[uyvy ? 1 : 0])),
+			y1 = vreinterpretq_s16_u16 (vmovl_u8 (in.val[uyvy ? 3 : 2])),
+			u = vsubq_s16 (vreinterpretq_s16_u16 (vmovl_u8 (in.val[uyvy ? 0 : 1])), half),
+			v = vsubq_s16 (vreinterpretq_s16_u16 (vmovl_u8 (in.val[uyvy ? 2 : 3])), half);
+
+		int16x8_t r = termNEON (v, ColorRV), b = termNEON (u, ColorBU);
+		int32x4_t glo = vmlaq_n_s32 (vmulq_n_s32 (vmovl_s16 (vget_low_s16 (u)), ColorGU),
+				vmovl_s16 (vget_low_s16 (v)), ColorGV),
+			ghi = vmlaq_n_s32 (vmulq_n_s32 (vmovl_s16 (vget_high_s16 (u)), ColorGU),
+				vmovl_s16 (vget_high_s16 (v)), ColorGV);
+		int16x8_t g = vcombine_s16 (vmovn_s32 (vshrq_n_s32 (glo, 15)), vmovn_s32 (vshrq_n_s32 (ghi, 15)));
+
+		// even and odd pixels back in order
+		uint8x8x2_t rr = vzip_u8 (vqmovun_s16 (vaddq_s16 (y0, r)), vqmovun_s16 (vaddq_s16 (y1, r))),
+			gg = vzip_u8 (vqmovun_s16 (vsubq_s16 (y0, g)), vqmovun_s16 (vsubq_s16 (y1, g))),
+			bb = vzip_u8 (vqmovun_s16 (vaddq_s16 (y0, b)), vqmovun_s16 (vaddq_s16 (y1, b)));
+		uint8x16x3_t out;
+		out.val[0] = vcombine_u8 (rr.val[0], rr.val[1]);
+		out.val[1] = vcombine_u8 (gg.val[0], gg.val[1]);
+		out.val[2] = vcombine_u8 (bb.val[0], bb.val[1]);
+		vst3q_u8 (dst + 3*i, out);
+	}
+	return i;
+}
+#endif
+
+
+ColorKernel colorKernel ()
+{
+	static const ColorKernel best =
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+		cpuHasAVX2() ? COLOR_AVX2 : simdDisabled()==false ? COLOR_SSE2 : COLOR_SCALAR;
+#elif defined(ROBOCAR_SIMD_NEON)
+		simdDisabled()==false ? COLOR_NEON : COLOR_SCALAR;
+#else
+		COLOR_SCALAR;
+#endif
+	return best;
+}
+
+
+const char *colorKernelName (ColorKernel kernel)
+{
+	static const char *names[] = {"scalar", "sse2", "avx2", "neon"};
+	return names[kernel];
+}
+
+
+template <bool uyvy>
+static void convert (const uint8_t *src, uint8_t *dst, int pixels, ColorKernel kernel)
+{
+	ColorKernel best = colorKernel ();
+	if (kernel != COLOR_SCALAR && kernel != best && !(kernel==COLOR_SSE2 && best==COLOR_AVX2))
+		kernel = best;
+
+	int i = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (kernel==COLOR_AVX2)
+		i = convertAVX2<uyvy> (src, dst, pixels);
+	// remainder of AVX2 too
+	if (kernel != COLOR_SCALAR)
+		i += convertSSE2<uyvy> (src + 2*i, dst + 3*i, pixels - i);
+#elif defined(ROBOCAR_SIMD_NEON)
+	if (kernel==COLOR_NEON)
+		i = convertNEON<uyvy> (src, dst, pixels);
+#endif
+	convertScalar<uyvy> (src + 2*i, dst + 3*i, pixels - i);
+}
+
+
+void yuyvToRgb (const uint8_t *yuyv, uint8_t *rgb, int pixels, ColorKernel kernel)
+{
+	convert<false> (yuyv, rgb, pixels, kernel);
+}
+
+
+void uyvyToRgb (const uint8_t *uyvy, uint8_t *rgb, int pixels, ColorKernel kernel)
+{
+	convert<true> (uyvy, rgb, pixels, kernel);
+}
+
+
+// Simple enough for the compiler to vectorize
+void yuyvToGray (const uint8_t *yuyv, uint8_t *gray, int pixels)
+{
+	for (int i=0; i<pixels; i++)
+		gray[i] = yuyv[2*i];
+}
+
+
+void uyvyToGray (const uint8_t *uyvy, uint8_t *gray, int pixels)
+{
+	for (int i=0; i<pixels; i++)
+		gray[i] = uyvy[2*i+1];
+}
+
+} /* namespace Robocar */
@@ -0,0 +1,30 @@
+/*
+ * ControlMessage.cpp
+ */
+
+#include "ControlMessage.h"
+#include "MessageRegisters.h"
+
+
+namespace Robocar {
+
+
+shared_ptr<Message> ControlMessage::create (uint8_t target, uint8_t parameter, int32_t value, uint8_t status)
+{
+	_controlMessageBuffer *ctrl = new _controlMessageBuffer;
+	ctrl->target = target;
+	ctrl->parameter = parameter;
+	ctrl->status = status;
+	ctrl->value = value;
+	return Message::create (ControlMessageCategory, sizeof(_controlMessageBuffer), (uint8_t*)ctrl);
+}
+
+
+_controlMessageBuffer *ControlMessage::parse (Message &msg)
+{
+	if (msg.getSize() < sizeof(_controlMessageBuffer))
+		return NULL;
+	return (_controlMessageBuffer*)msg.getContent();
+}
+
+} /* namespace Robocar */
@@ -0,0 +1,63 @@
+/*
+ * DriverStatus.cpp
+ */
+
+#include "DriverStatus.h"
+#include "MessageRegisters.h"
+#include <cstring>
+#include <string>
+
+
+#define BackoffSlice 50000
+
+
+namespace Robocar {
+
+
+shared_ptr<Message> DriverStatus::create (uint8_t category, uint8_t device, uint8_t health,
+	uint32_t failures, uint32_t retryDelay, const char *lastError)
+{
+	size_t errlen = strlen (lastError);
+	uint32_t size = sizeof(_driverStatusBuffer) - 1 + errlen;
+	_driverStatusBuffer *status = (_driverStatusBuffer*)new uint8_t [size+1];
+	status->category = category;
+	status->device = device;
+	status->health = health;
+	status->failures = failures;
+	status->retryDelay = retryDelay;
+	memcpy (&status->_lastError, lastError, errlen);
+	return Message::create (DriverStatusMessageCategory, size, (uint8_t*)status);
+}
+
+
+_driverStatusBuffer *DriverStatus::parse (Message &msg)
+{
+	if (msg.getSize() < sizeof(_driverStatusBuffer) - 1)
+		return NULL;
+	return (_driverStatusBuffer*)msg.getContent();
+}
+
+
+std::string DriverStatus::lastError (Message &msg)
+{
+	_driverStatusBuffer *status = parse (msg);
+	if (status==NULL)
+		return std::string ();
+	return std::string (&status->_lastError, msg.getSize() - (sizeof(_driverStatusBuffer) - 1));
+}
+
+
+bool RecoveryBackoff::wait (volatile bool &abort)
+{
+	for (useconds_t slept=0; slept<delay; slept+=BackoffSlice) {
+		if (abort==true)
+			return false;
+		usleep (BackoffSlice);
+	}
+	delay *= 2;
+	if (delay > maximum)
+		delay = maximum;
+	return abort==false;
+}
+
+} /* namespace Robocar */
@@ -8,7 +8,12 @@
 
 #include "MessageRegisters.h"
 #include "HokuyoDriver.h"
+#include "ControlMessage.h"
+#include "Report.h"
 #include "debug.h"
+#include <math.h>
+#include <cstring>
+#include <algorithm>
 /*#include "boost/date_time/posix_time/posix_time.hpp"
 
 
@@ -72,10 +77,22 @@ shared_ptr<hokuyo::LaserScan> HokuyoMessage::deserialize(Message &msg)
 }
 
 
-HokuyoSensorDriver::HokuyoSensorDriver (MessageQueue *_msgq, const char *_devfilename) :
+HokuyoSensorDriver::HokuyoSensorDriver (MessageQueue *_msgq, const char *_devfilename, bool _lowLatency,
+	uint8_t _device) :
 	srvQueue(_msgq),
+	doStop (false), doQuit (false),
 	devfilename(_devfilename),
-	doStop (false)
+	lowLatency(_lowLatency),
+	device(_device),
+	skip (0), pendingSkip (0),
+	shapeCluster (1), shapeSkip (0),
+	shapeMinAngle (0), shapeMaxAngle (0),
+	reconfigure (false),
+	scanPool (sizeof(_hokuyoMessageBuffer) - 1 + 2*hokuyo::MAX_READINGS*sizeof(float), ScanPoolSize),
+	pendingFilterStages (-1), configuredFilterStages (0),
+	filterTime (0), filterMaxTime (0),
+	filteredScans (0),
+	lastReport (0), sentScans (0)
 {
 	init ();
 	startSignal = new semaphore (0);
@@ -85,7 +102,9 @@ HokuyoSensorDriver::HokuyoSensorDriver (MessageQueue *_msgq, const char *_devfil
 
 HokuyoSensorDriver::~HokuyoSensorDriver ()
 {
-	laser->close();
+	try {
+		laser->close();
+	} catch (hokuyo::Exception &e) {}
 	delete laser;
 }
 
@@ -93,6 +112,7 @@ HokuyoSensorDriver::~HokuyoSensorDriver ()
 void HokuyoSensorDriver::init ()
 {
 	laser = new hokuyo::Laser ();
+	laser->setLowLatency (lowLatency);
 	laser->open (devfilename);
 	laser->getConfig (this->laserconf);
 }
@@ -109,35 +129,103 @@ void HokuyoSensorDriver::work ()
 {
 	while (doQuit==false) {
 		hokuyo::LaserScan scanResult;
+		bool scanning = false;
+		int scanErrors = 0;
 
-		laser->laserOn();
-		debug ("Laser scans work");
-		laser->requestScans(false,
-			laserconf.min_angle,
-			laserconf.max_angle);
+		reportStatus (DRIVER_RUNNING);
 
 		while (doStop==false) {
-			int status = laser->serviceScan (scanResult);
-			if (status != 0) {
-				debug ("Error getting scan");
-				break;
+			shared_ptr<uint8_t> buffer;
+			_hokuyoMessageBuffer *msgBuf;
+			int status, numRanges, numIntensities;
+
+			try {
+				if (laser->portOpen()==false) {
+					laser->open (devfilename);
+					laser->getConfig (laserconf);
+					// reopening resets device clock
+					scanClock.reset ();
+					debug ("Laser reopened");
+					reportStatus (DRIVER_RUNNING);
+				}
+				if (scanning==false) {
+					laser->laserOn();
+					debug ("Laser scans work");
+					requestScans ();
+					scanning = true;
+				}
+				if (reconfigure==true) {
+					laser->stopScanning ();
+					requestScans ();
+				}
+
+				buffer = scanPool.acquire ();
+				msgBuf = (_hokuyoMessageBuffer*)buffer.get();
+				status = laser->serviceScan (scanResult, (float*)&msgBuf->_ranges,
+					numRanges, numIntensities, ScanTimeout);
+				if (status != 0) {
+					// Device is still talking; restarting the scan
+					// sequence is enough unless it keeps failing
+					debug ("Error getting scan: %d", status);
+					if (++scanErrors >= MaxScanErrors) {
+						recover ("Repeated scan errors");
+						scanning = false;
+						scanErrors = 0;
+					}
+					else {
+						laser->stopScanning ();
+						requestScans ();
+					}
+					continue;
+				}
+				scanErrors = 0;
+				backoff.reset ();
+			} catch (hokuyo::Exception &e) {
+				recover (e.what());
+				scanning = false;
+				continue;
 			}
 
-			uint32_t bufferSize;
-			shared_ptr<uint8_t> buffer =
-				HokuyoSensorDriver::serializeMessage
-					(scanResult, bufferSize);
+			// Stamped from device clock; the fit keeps
+			// learning even when nobody receives scans
+			uint64_t scanTime = scanClock.correct (scanResult.self_time_stamp, scanResult.system_time_stamp);
+			timeval stamp = nanosecond_to_timeval (scanTime);
+			if (scanHook)
+				scanHook (device, (float*)&msgBuf->_ranges, numRanges, scanResult.config, scanTime);
+
+			// Keep the laser streaming, but don't bother
+			// sending scans that nobody will receive
+			if (srvQueue->isEnabled()==false) {
+				filter.reset ();
+				continue;
+			}
+
+			// Readings are already in place
+			runFilter ((float*)&msgBuf->_ranges, numRanges, scanResult.config);
+			fillHeader (scanResult, numRanges, msgBuf, device);
+			uint32_t bufferSize = sizeof(_hokuyoMessageBuffer) - 1
+				+ (numRanges + numIntensities) * sizeof(float);
 			shared_ptr<Message> sensorMsg
 				(new Message (
 					HokuyoDriverMessageCategory,
 					bufferSize,
 					buffer));
+			sensorMsg->setTimestamp (stamp);
 			srvQueue->push(sensorMsg);
+			sentScans += 1;
+			reportStatistics ();
 			//sendScan (scanResult);
 		}
 
-		laser->stopScanning();
-		laser->laserOff();
+		if (laser->portOpen()) {
+			try {
+				laser->stopScanning();
+				laser->laserOff();
+			} catch (hokuyo::Exception &e) {
+				debug ("Laser: %s", e.what());
+			}
+		}
+		reportStatus (DRIVER_STOPPED);
 
 		if (doQuit==true) break;
 		startSignal->wait();
@@ -145,6 +233,94 @@ void HokuyoSensorDriver::work ()
 }
 
 
+bool HokuyoSensorDriver::setFilter (const std::string &spec)
+{
+	if (filter.configure (spec)==false)
+		return false;
+	configuredFilterStages = filter.getStages ();
+	return true;
+}
+
+
+// Filter in place, and keep its cost for report
+void HokuyoSensorDriver::runFilter (float *ranges, int count, const hokuyo::LaserConfig &config)
+{
+	if (pendingFilterStages >= 0) {
+		filter.setStages (pendingFilterStages);
+		pendingFilterStages = -1;
+	}
+	if (filter.getStages()==0)
+		return;
+
+	struct timespec t0, t1;
+	clock_gettime (CLOCK_MONOTONIC, &t0);
+	filter.apply (ranges, count, config);
+	clock_gettime (CLOCK_MONOTONIC, &t1);
+
+	double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+	filterTime += elapsed;
+	filterMaxTime = std::max (filterMaxTime, elapsed);
+	filteredScans += 1;
+}
+
+
+void HokuyoSensorDriver::reportStatistics ()
+{
+	struct timespec t;
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	double now = t.tv_sec + t.tv_nsec * 1e-9;
+	if (lastReport==0)
+		lastReport = now;
+	if (now - lastReport < ScanReportInterval)
+		return;
+
+	Report rep (HokuyoDriverMessageCategory, REPORT_STATISTICS);
+	rep.add ("device", device);
+	rep.add ("scans", sentScans);
+	if (filteredScans > 0) {
+		rep.add ("filter_mean_us", filterTime / filteredScans * 1e6);
+		rep.add ("filter_max_us", filterMaxTime * 1e6);
+	}
+	double jitterMean, jitterMax;
+	int resyncs;
+	scanClock.takeJitter (jitterMean, jitterMax, resyncs);
+	rep.add ("clock_drift_ppm", scanClock.drift ());
+	rep.add ("jitter_mean_us", jitterMean * 1e6);
+	rep.add ("jitter_max_us", jitterMax * 1e6);
+	rep.add ("clock_resyncs", resyncs);
+	srvQueue->push (rep.toMessage ());
+
+	filterTime = filterMaxTime = 0;
+	filteredScans = sentScans = 0;
+	lastReport = now;
+}
+
+
+/*
+ * Close the device and wait before the next reopen attempt,
+ * which is done at the top of work loop
+ */
+void HokuyoSensorDriver::recover (const std::string &error)
+{
+	debug ("Laser failure on %s: %s", devfilename, error.c_str());
+	try {
+		laser->close ();
+	} catch (hokuyo::Exception &e) {}
+
+	backoff.failed ();
+	// lidars share one category; the device tells them apart
+	reportStatus (DRIVER_RECOVERING, std::string (devfilename) + ": " + error);
+	backoff.wait (doStop);
+}
+
+
+void HokuyoSensorDriver::reportStatus (uint8_t health, const std::string &error)
+{
+	srvQueue->push (DriverStatus::create (HokuyoDriverMessageCategory, device, health,
+		backoff.getFailures(), backoff.current()/1000, error.c_str()), true);
+}
+
+
 shared_ptr <uint8_t>
 HokuyoSensorDriver::serializeMessage (hokuyo::LaserScan &scanResult, uint32_t &bufferSize)
 {
@@ -156,20 +332,94 @@ HokuyoSensorDriver::serializeMessage (hokuyo::LaserScan &scanResult, uint32_t &b
 
 	// buffer
 	_hokuyoMessageBuffer *msgBuf = (_hokuyoMessageBuffer*)malloc (bufferSize);
+	fillHeader (scanResult, scanResult.ranges.size(), msgBuf);
+	// copy data
+	memcpy (&(msgBuf->_ranges), scanResult.ranges.data(), msgBuf->num_ranges*sizeof(float));
+	//void *ptrForIntensity = (void*)&(msgBuf->_ranges) + scanResult.ranges.size()*sizeof(float);
+	float *ptrForIntensity = &(((float*)&(msgBuf->_ranges))[scanResult.ranges.size()]);
+	memcpy (ptrForIntensity, scanResult.intensities.data(), scanResult.intensities.size()*sizeof(float));
+
+	return shared_ptr<uint8_t> ((unsigned char*)msgBuf);
+}
+
+
+void HokuyoSensorDriver::fillHeader (const hokuyo::LaserScan &scanResult, uint32_t numRanges, _hokuyoMessageBuffer *msgBuf,
+	uint8_t device)
+{
 	msgBuf->min_angle = scanResult.config.min_angle;
 	msgBuf->max_angle = scanResult.config.max_angle;
 	msgBuf->angular_increment = scanResult.config.ang_increment;
 	msgBuf->scan_time = scanResult.config.scan_time;
 	msgBuf->min_range = scanResult.config.min_range;
 	msgBuf->max_range = scanResult.config.max_range;
-	msgBuf->num_ranges = scanResult.ranges.size();
-	// copy data
-	memcpy (&(msgBuf->_ranges), scanResult.ranges.data(), msgBuf->num_ranges*sizeof(float));
-	//void *ptrForIntensity = (void*)&(msgBuf->_ranges) + scanResult.ranges.size()*sizeof(float);
-	float *ptrForIntensity = &(((float*)(msgBuf->_ranges))[scanResult.ranges.size()]);
-	memcpy (ptrForIntensity, scanResult.intensities.data(), scanResult.intensities.size()*sizeof(float));
+	msgBuf->device = device;
+	memset (msgBuf->_pad, 0, sizeof(msgBuf->_pad));
+	msgBuf->num_ranges = numRanges;
+}
 
-	return shared_ptr<uint8_t> ((unsigned char*)msgBuf);
+
+void HokuyoSensorDriver::requestScans ()
+{
+	reconfigure = false;
+	skip = std::max ((int)pendingSkip, (int)shapeSkip);
+
+	float minAngle = laserconf.min_angle,
+		maxAngle = laserconf.max_angle;
+	if (shapeMinAngle < shapeMaxAngle) {
+		minAngle = std::max (minAngle, (float)shapeMinAngle);
+		maxAngle = std::min (maxAngle, (float)shapeMaxAngle);
+	}
+
+	laser->requestScans(false,
+		minAngle,
+		maxAngle,
+		shapeCluster, skip, 0, ScanTimeout);
+}
+
+
+void HokuyoSensorDriver::setScanShape (int cluster, int skip, float minAngle, float maxAngle)
+{
+	if (cluster==shapeCluster && skip==shapeSkip &&
+		minAngle==shapeMinAngle && maxAngle==shapeMaxAngle)
+		return;
+
+	shapeCluster = cluster;
+	shapeSkip = skip;
+	shapeMinAngle = minAngle;
+	shapeMaxAngle = maxAngle;
+	reconfigure = true;
+}
+
+
+/*
+ * Scan rate of the device is fixed; lower rates are obtained
+ * by asking the device to skip scans. Filter stages can be
+ * switched among those given to setFilter().
+ */
+bool HokuyoSensorDriver::setParameter (uint8_t parameter, int32_t value)
+{
+	// only stages that were configured can be turned on
+	if (parameter==CONTROL_LIDAR_FILTER) {
+		if (value < 0 || (value & ~configuredFilterStages) != 0)
+			return false;
+		pendingFilterStages = value;
+		return true;
+	}
+
+	if (parameter != CONTROL_FRAME_RATE || value < 1)
+		return false;
+
+	double nativeRate = 1.0 / laserconf.scan_time;
+	int newSkip = (int)round (nativeRate / value) - 1;
+	if (newSkip < 0)
+		newSkip = 0;
+	// skip is a single digit in SCIP
+	if (newSkip > 9)
+		newSkip = 9;
+
+	pendingSkip = newSkip;
+	reconfigure = true;
+	return true;
 }
 
 
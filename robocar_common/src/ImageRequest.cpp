@@ -0,0 +1,80 @@
+/*
+ * ImageRequest.cpp
+ */
+
+#include "ImageRequest.h"
+#include "MessageRegisters.h"
+#include <cstdio>
+
+
+namespace Robocar {
+
+
+shared_ptr<Message> ImageRequest::create (const _imageRequestBuffer &request)
+{
+	_imageRequestBuffer *req = new _imageRequestBuffer;
+	*req = request;
+	return Message::create (ImageRequestMessageCategory, sizeof(_imageRequestBuffer), (uint8_t*)req);
+}
+
+
+_imageRequestBuffer *ImageRequest::parse (Message &msg)
+{
+	if (msg.getSize() < sizeof(_imageRequestBuffer))
+		return NULL;
+	_imageRequestBuffer *req = (_imageRequestBuffer*)msg.getContent();
+	if (req->stream >= MaximumImageStreams)
+		return NULL;
+	if (!(req->max_rate > 0))
+		req->max_rate = 0;
+	return req;
+}
+
+
+_imageRequestBuffer ImageRequest::full (uint8_t target, uint8_t stream)
+{
+	_imageRequestBuffer req;
+	req.target = target;
+	req.stream = stream;
+	req.enabled = (stream==0);
+	req.crop_x = req.crop_y = req.crop_width = req.crop_height = 0;
+	req.width = req.height = 0;
+	req.max_rate = 0;
+	return req;
+}
+
+
+bool ImageRequest::parse (const std::string &spec, _imageRequestBuffer &request)
+{
+	unsigned w=0, h=0, cx=0, cy=0, cw=0, ch=0;
+	float rate = 0;
+	const char *s = spec.c_str();
+	int n = 0;
+	if (sscanf (s, "%ux%u%n", &w, &h, &n) < 2)
+		return false;
+	s += n;
+	if (*s=='@') {
+		if (sscanf (s, "@%f%n", &rate, &n) < 1 || rate < 0)
+			return false;
+		s += n;
+	}
+	if (*s=='+') {
+		if (sscanf (s, "+%u,%u,%ux%u%n", &cx, &cy, &cw, &ch, &n) < 4)
+			return false;
+		s += n;
+	}
+	if (*s != '\0' || w > 0xffff || h > 0xffff || cx > 0xffff || cy > 0xffff || cw > 0xffff || ch > 0xffff)
+		return false;
+
+	request.enabled = 1;
+	request.width = w;
+	request.height = h;
+	request.max_rate = rate;
+	request.crop_x = cx;
+	request.crop_y = cy;
+	request.crop_width = cw;
+	request.crop_height = ch;
+	return true;
+}
+
+} /* namespace Robocar */
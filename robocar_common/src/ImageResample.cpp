@@ -0,0 +1,241 @@
+/*
+ * ImageResample.cpp
+ *
+ * Both scalings are done in two passes: rows are first combined
+ * into a line of 16-bit sums, which is contiguous and done with
+ * vectors, and the line is then reduced across.
+ */
+
+#include "ImageResample.h"
+#include "simd.h"
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+
+// Fraction bits of bilinear weights
+#define BilinearShift 8
+#define BilinearOne (1 << BilinearShift)
+
+
+namespace Robocar {
+
+
+static bool useVectors (bool simd)
+{
+	return simd && simdDisabled()==false;
+}
+
+
+// acc[i] += row[i]
+static void addRow (const uint8_t *row, uint16_t *acc, int n, bool simd)
+{
+	int i = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simd) {
+		const __m128i zero = _mm_setzero_si128 ();
+		for (; i+16 <= n; i+=16) {
+			__m128i v = _mm_loadu_si128 ((const __m128i*)(row+i));
+			__m128i lo = _mm_loadu_si128 ((const __m128i*)(acc+i)),
+				hi = _mm_loadu_si128 ((const __m128i*)(acc+i+8));
+			_mm_storeu_si128 ((__m128i*)(acc+i), _mm_add_epi16 (lo, _mm_unpacklo_epi8 (v, zero)));
+			_mm_storeu_si128 ((__m128i*)(acc+i+8), _mm_add_epi16 (hi, _mm_unpackhi_epi8 (v, zero)));
+		}
+	}
+#elif defined(ROBOCAR_SIMD_NEON)
+	if (simd) {
+		for (; i+16 <= n; i+=16) {
+			uint8x16_t v = vld1q_u8 (row+i);
+			vst1q_u16 (acc+i, vaddw_u8 (vld1q_u16 (acc+i), vget_low_u8 (v)));
+			vst1q_u16 (acc+i+8, vaddw_u8 (vld1q_u16 (acc+i+8), vget_high_u8 (v)));
+		}
+	}
+#endif
+	for (; i<n; i++)
+		acc[i] += row[i];
+}
+
+
+/*
+ * out[i] is the rounded mean of factor sums step apart, starting
+ * at acc[i]; factor is 2 or 4, so the mean is a shift
+ */
+static void boxLine (const uint16_t *acc, uint8_t *out, int n, int step, int factor, bool simd)
+{
+	const int shift = (factor==2 ? 2 : 4), bias = 1 << (shift-1);
+	int i = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simd) {
+		const __m128i b = _mm_set1_epi16 (bias);
+		for (; i+8 <= n; i+=8) {
+			__m128i s = _mm_add_epi16 (_mm_loadu_si128 ((const __m128i*)(acc+i)),
+				_mm_loadu_si128 ((const __m128i*)(acc+i+step)));
+			if (factor==4) {
+				s = _mm_add_epi16 (s, _mm_loadu_si128 ((const __m128i*)(acc+i+2*step)));
+				s = _mm_add_epi16 (s, _mm_loadu_si128 ((const __m128i*)(acc+i+3*step)));
+			}
+			s = _mm_srli_epi16 (_mm_add_epi16 (s, b), shift);
+			_mm_storel_epi64 ((__m128i*)(out+i), _mm_packus_epi16 (s, s));
+		}
+	}
+#elif defined(ROBOCAR_SIMD_NEON)
+	if (simd) {
+		for (; i+8 <= n; i+=8) {
+			uint16x8_t s = vaddq_u16 (vld1q_u16 (acc+i), vld1q_u16 (acc+i+step));
+			if (factor==4)
+				s = vaddq_u16 (s, vaddq_u16 (vld1q_u16 (acc+i+2*step), vld1q_u16 (acc+i+3*step)));
+			vst1_u8 (out+i, vqmovn_u16 (vshlq_u16 (vaddq_u16 (s, vdupq_n_u16 (bias)),
+				vdupq_n_s16 (-shift))));
+		}
+	}
+#endif
+	for (; i<n; i++) {
+		int s = 0;
+		for (int k=0; k<factor; k++)
+			s += acc[i + k*step];
+		out[i] = (s + bias) >> shift;
+	}
+}
+
+
+// out[i] = a[i]*(BilinearOne-w) + b[i]*w, which fits 16 bits
+static void blendRows (const uint8_t *a, const uint8_t *b, int w, uint16_t *out, int n, bool simd)
+{
+	int i = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simd) {
+		const __m128i zero = _mm_setzero_si128 (),
+			wa = _mm_set1_epi16 (BilinearOne - w), wb = _mm_set1_epi16 (w);
+		for (; i+16 <= n; i+=16) {
+			__m128i va = _mm_loadu_si128 ((const __m128i*)(a+i)),
+				vb = _mm_loadu_si128 ((const __m128i*)(b+i));
+			__m128i lo = _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (va, zero), wa),
+					_mm_mullo_epi16 (_mm_unpacklo_epi8 (vb, zero), wb)),
+				hi = _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (va, zero), wa),
+					_mm_mullo_epi16 (_mm_unpackhi_epi8 (vb, zero), wb));
+			_mm_storeu_si128 ((__m128i*)(out+i), lo);
+			_mm_storeu_si128 ((__m128i*)(out+i+8), hi);
+		}
+	}
+#elif defined(ROBOCAR_SIMD_NEON)
+	// a weight of BilinearOne doesn't fit a byte; such rows are left to scalar code
+	if (simd && w > 0 && w < BilinearOne) {
+		const uint8x8_t wa = vdup_n_u8 (BilinearOne - w), wb = vdup_n_u8 (w);
+		for (; i+16 <= n; i+=16) {
+			uint8x16_t va = vld1q_u8 (a+i), vb = vld1q_u8 (b+i);
+			vst1q_u16 (out+i, vmlal_u8 (vmull_u8 (vget_low_u8 (va), wa), vget_low_u8 (vb), wb));
+			vst1q_u16 (out+i+8, vmlal_u8 (vmull_u8 (vget_high_u8 (va), wa), vget_high_u8 (vb), wb));
+		}
+	}
+#endif
+	for (; i<n; i++)
+		out[i] = a[i]*(BilinearOne - w) + b[i]*w;
+}
+
+
+void copyImage (const uint8_t *src, int width, int height, int stride, int channels, uint8_t *dst)
+{
+	for (int y=0; y<height; y++)
+		memcpy (dst + y*width*channels, src + y*stride, width*channels);
+}
+
+
+void boxDownscale (const uint8_t *src, int width, int height, int stride, int channels,
+	int factor, uint8_t *dst, bool simd)
+{
+	simd = useVectors (simd);
+	int dw = width / factor, dh = height / factor;
+	if (dw <= 0 || dh <= 0)
+		return;
+	const int line = dw*factor*channels,
+		// last position whose block fits in the line
+		reach = line - (factor-1)*channels;
+	std::vector<uint16_t> acc (line);
+	std::vector<uint8_t> means (reach);
+
+	for (int y=0; y<dh; y++) {
+		std::fill (acc.begin(), acc.end(), 0);
+		for (int k=0; k<factor; k++)
+			addRow (src + (y*factor + k)*stride, &acc[0], line, simd);
+		boxLine (&acc[0], &means[0], reach, channels, factor, simd);
+		uint8_t *out = dst + y*dw*channels;
+		for (int x=0; x<dw; x++)
+			for (int c=0; c<channels; c++)
+				out[x*channels + c] = means[x*factor*channels + c];
+	}
+}
+
+
+/*
+ * First source pixel and weight of the second one, for each
+ * destination pixel along one axis
+ */
+static void bilinearTable (int from, int to, std::vector<int> &index, std::vector<int> &weight)
+{
+	index.resize (to);
+	weight.resize (to);
+	for (int i=0; i<to; i++) {
+		// centre of pixel i in source, in fixed point
+		int64_t p = ((int64_t)(2*i + 1) * from * BilinearOne) / (2*to) - BilinearOne/2;
+		if (p < 0)
+			p = 0;
+		int k = p >> BilinearShift;
+		if (k >= from-1) {
+			index[i] = from-1;
+			weight[i] = 0;
+		}
+		else {
+			index[i] = k;
+			weight[i] = p & (BilinearOne-1);
+		}
+	}
+}
+
+
+void bilinearScale (const uint8_t *src, int width, int height, int stride, int channels,
+	uint8_t *dst, int dstWidth, int dstHeight, bool simd)
+{
+	simd = useVectors (simd);
+	if (width <= 0 || height <= 0 || dstWidth <= 0 || dstHeight <= 0)
+		return;
+	std::vector<int> xs, wx, ys, wy;
+	bilinearTable (width, dstWidth, xs, wx);
+	bilinearTable (height, dstHeight, ys, wy);
+	const int line = width*channels;
+	std::vector<uint16_t> rows (line);
+
+	for (int y=0; y<dstHeight; y++) {
+		const uint8_t *a = src + ys[y]*stride,
+			*b = (ys[y]+1 < height ? a + stride : a);
+		blendRows (a, b, wy[y], &rows[0], line, simd);
+
+		uint8_t *out = dst + y*dstWidth*channels;
+		for (int x=0; x<dstWidth; x++) {
+			const uint16_t *p = &rows[xs[x]*channels],
+				*q = (xs[x]+1 < width ? p + channels : p);
+			uint32_t w = wx[x];
+			for (int c=0; c<channels; c++)
+				out[x*channels + c] = (p[c]*(BilinearOne - w) + q[c]*w + (1 << (2*BilinearShift-1)))
+					>> (2*BilinearShift);
+		}
+	}
+}
+
+
+void resampleImage (const uint8_t *src, int width, int, int channels, const ImageRect &roi,
+	uint8_t *dst, int dstWidth, int dstHeight)
+{
+	const int stride = width*channels;
+	const uint8_t *origin = src + roi.y*stride + roi.x*channels;
+
+	if (dstWidth==roi.width && dstHeight==roi.height)
+		copyImage (origin, roi.width, roi.height, stride, channels, dst);
+	else if (dstWidth*2==roi.width && dstHeight*2==roi.height)
+		boxDownscale (origin, roi.width, roi.height, stride, channels, 2, dst);
+	else if (dstWidth*4==roi.width && dstHeight*4==roi.height)
+		boxDownscale (origin, roi.width, roi.height, stride, channels, 4, dst);
+	else
+		bilinearScale (origin, roi.width, roi.height, stride, channels, dst, dstWidth, dstHeight);
+}
+
+} /* namespace Robocar */
@@ -0,0 +1,426 @@
+/*
+ * JpegHandler.cpp
+ *
+ * YUYV and UYVY are given to libjpeg in raw mode: their luma and
+ * chroma only have to be split into planes, and libjpeg skips its
+ * own color conversion and downsampling. Chroma is rescaled so that
+ * a decoder, with the coefficients of JFIF, gives the colors of
+ * ColorConvert; luma is taken as full range.
+ *
+ * Errors jump back to the function that called libjpeg, which
+ * throws from there. Code between such call and libjpeg must not
+ * hold objects with destructors, since the jump skips them.
+ */
+
+#include "JpegHandler.h"
+#include "simd.h"
+#include <cstring>
+#include <algorithm>
+
+
+// Least buffer given to a compressed image
+#define JpegMinimumBuffer 4096
+/*
+ * Chroma scale to JFIF, over 2^15: ColorConvert takes b = y + 2.041*u
+ * and r = y + 1.136*v where JFIF has 1.772 and 1.402. Green then
+ * agrees as well. Both are even, so that SSE2 can take them halved
+ * as signed 16-bit.
+ */
+#define JpegScaleU 37744
+#define JpegScaleV 26550
+
+
+namespace Robocar {
+
+
+static void jumpOnError (j_common_ptr cinfo)
+{
+	JpegErrorHandler *error = (JpegErrorHandler*)cinfo->err;
+	(*cinfo->err->format_message) (cinfo, error->message);
+	longjmp (error->jump, 1);
+}
+
+
+JpegCompress::JpegCompress (int _quality, JPEG_SUBSAMPLING _subsampling) :
+	quality (_quality),
+	subsampling (_subsampling),
+	capacity (0),
+	lastSize (0)
+{
+	cinfo.err = jpeg_std_error (&error.manager);
+	error.manager.error_exit = jumpOnError;
+	jpeg_create_compress (&cinfo);
+	cinfo.client_data = this;
+	destination.init_destination = initDestination;
+	destination.empty_output_buffer = emptyOutput;
+	destination.term_destination = termDestination;
+	cinfo.dest = &destination;
+}
+
+
+JpegCompress::~JpegCompress ()
+{
+	jpeg_destroy_compress (&cinfo);
+}
+
+
+void JpegCompress::setQuality (int _quality)
+{
+	quality = std::min (100, std::max (1, _quality));
+}
+
+
+void JpegCompress::setSubsampling (JPEG_SUBSAMPLING _subsampling)
+{
+	subsampling = _subsampling;
+}
+
+
+void JpegCompress::initDestination (j_compress_ptr cinfo)
+{
+	JpegCompress *self = (JpegCompress*)cinfo->client_data;
+	self->output = shared_ptr<uint8_t> (new uint8_t [self->capacity]);
+	self->destination.next_output_byte = self->output.get();
+	self->destination.free_in_buffer = self->capacity;
+}
+
+
+// Full buffer is moved to one twice as large
+boolean JpegCompress::emptyOutput (j_compress_ptr cinfo)
+{
+	JpegCompress *self = (JpegCompress*)cinfo->client_data;
+	uint32_t grown = 2*self->capacity;
+	shared_ptr<uint8_t> larger (new uint8_t [grown]);
+	memcpy (larger.get(), self->output.get(), self->capacity);
+	self->output = larger;
+	self->destination.next_output_byte = larger.get() + self->capacity;
+	self->destination.free_in_buffer = grown - self->capacity;
+	self->capacity = grown;
+	return TRUE;
+}
+
+
+void JpegCompress::termDestination (j_compress_ptr)
+{}
+
+
+// Luma is every second byte, from the first for YUYV and second for UYVY
+template <bool uyvy>
+static void splitLuma (const uint8_t *src, int width, uint8_t *y, int padded)
+{
+	int i = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simdDisabled()==false) {
+		const __m128i lowByte = _mm_set1_epi16 (0xff);
+		for (; i+16 <= width; i+=16) {
+			__m128i x0 = _mm_loadu_si128 ((const __m128i*)(src + 2*i)),
+				x1 = _mm_loadu_si128 ((const __m128i*)(src + 2*i + 16));
+			if (uyvy)
+				_mm_storeu_si128 ((__m128i*)(y+i), _mm_packus_epi16 (_mm_srli_epi16 (x0, 8), _mm_srli_epi16 (x1, 8)));
+			else
+				_mm_storeu_si128 ((__m128i*)(y+i), _mm_packus_epi16 (_mm_and_si128 (x0, lowByte),
+					_mm_and_si128 (x1, lowByte)));
+		}
+	}
+#elif defined(ROBOCAR_SIMD_NEON)
+	if (simdDisabled()==false) {
+		for (; i+16 <= width; i+=16)
+			vst1q_u8 (y+i, vld2q_u8 (src + 2*i).val[uyvy ? 1 : 0]);
+	}
+#endif
+	const uint8_t *s = src + (uyvy ? 1 : 0);
+	for (; i<width; i++)
+		y[i] = s[2*i];
+	for (int i=width; i<padded; i++)
+		y[i] = y[width-1];
+}
+
+
+static inline uint8_t scaleChroma (int c, int scale)
+{
+	c = 128 + (((c - 128) * scale + 16384) >> 15);
+	return (c < 0 ? 0 : c > 255 ? 255 : c);
+}
+
+
+/*
+ * Chroma of the pairs of row a, averaged with row b when they differ
+ * (4:2:0), or repeated for both pixels of a pair when full (4:4:4)
+ */
+template <bool uyvy>
+static void splitChroma (const uint8_t *a, const uint8_t *b, int pairs, bool full,
+	uint8_t *u, uint8_t *v, int padded)
+{
+	const int uo = (uyvy ? 0 : 1), vo = uo + 2;
+	int i = 0, n = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	/*
+	 * Eight pairs at a time, u in even 16-bit lanes and v in odd.
+	 * (d*s + 2^14) >> 15 is taken as (mulhi(8d, s/2) + 1) >> 1,
+	 * which is the same.
+	 */
+	if (simdDisabled()==false) {
+		const __m128i lowByte = _mm_set1_epi16 (0xff), zero = _mm_setzero_si128 (),
+			centre = _mm_set1_epi16 (128), one = _mm_set1_epi16 (1),
+			scale = _mm_set1_epi32 (((JpegScaleV/2) << 16) | (JpegScaleU/2));
+		for (; i+8 <= pairs; i+=8, n+=(full ? 16 : 8)) {
+			__m128i x[2];
+			for (int k=0; k<2; k++) {
+				x[k] = _mm_loadu_si128 ((const __m128i*)(a + 4*i + 16*k));
+				if (b != a)
+					x[k] = _mm_avg_epu8 (x[k], _mm_loadu_si128 ((const __m128i*)(b + 4*i + 16*k)));
+				__m128i c = (uyvy ? _mm_and_si128 (x[k], lowByte) : _mm_srli_epi16 (x[k], 8));
+				c = _mm_mulhi_epi16 (_mm_slli_epi16 (_mm_sub_epi16 (c, centre), 3), scale);
+				x[k] = _mm_add_epi16 (_mm_srai_epi16 (_mm_add_epi16 (c, one), 1), centre);
+			}
+			__m128i uv = _mm_packus_epi16 (x[0], x[1]),
+				cu = _mm_packus_epi16 (_mm_and_si128 (uv, lowByte), zero),
+				cv = _mm_packus_epi16 (_mm_srli_epi16 (uv, 8), zero);
+			if (full) {
+				_mm_storeu_si128 ((__m128i*)(u+n), _mm_unpacklo_epi8 (cu, cu));
+				_mm_storeu_si128 ((__m128i*)(v+n), _mm_unpacklo_epi8 (cv, cv));
+			}
+			else {
+				_mm_storel_epi64 ((__m128i*)(u+n), cu);
+				_mm_storel_epi64 ((__m128i*)(v+n), cv);
+			}
+		}
+	}
+#elif defined(ROBOCAR_SIMD_NEON)
+	// sixteen pairs at a time
+	if (simdDisabled()==false) {
+		for (; i+16 <= pairs; i+=16, n+=(full ? 32 : 16)) {
+			uint8x16x4_t x = vld4q_u8 (a + 4*i);
+			uint8x16_t c[2] = { x.val[uo], x.val[vo] };
+			if (b != a) {
+				uint8x16x4_t y = vld4q_u8 (b + 4*i);
+				c[0] = vrhaddq_u8 (c[0], y.val[uo]);
+				c[1] = vrhaddq_u8 (c[1], y.val[vo]);
+			}
+			for (int k=0; k<2; k++) {
+				const int32_t s = (k==0 ? JpegScaleU : JpegScaleV);
+				int16x8_t lo = vreinterpretq_s16_u16 (vsubl_u8 (vget_low_u8 (c[k]), vdup_n_u8 (128))),
+					hi = vreinterpretq_s16_u16 (vsubl_u8 (vget_high_u8 (c[k]), vdup_n_u8 (128)));
+				int16x8_t slo = vcombine_s16 (vrshrn_n_s32 (vmulq_n_s32 (vmovl_s16 (vget_low_s16 (lo)), s), 15),
+						vrshrn_n_s32 (vmulq_n_s32 (vmovl_s16 (vget_high_s16 (lo)), s), 15)),
+					shi = vcombine_s16 (vrshrn_n_s32 (vmulq_n_s32 (vmovl_s16 (vget_low_s16 (hi)), s), 15),
+						vrshrn_n_s32 (vmulq_n_s32 (vmovl_s16 (vget_high_s16 (hi)), s), 15));
+				c[k] = vcombine_u8 (vqmovun_s16 (vaddq_s16 (slo, vdupq_n_s16 (128))),
+					vqmovun_s16 (vaddq_s16 (shi, vdupq_n_s16 (128))));
+			}
+			if (full) {
+				uint8x16x2_t pu = {{ c[0], c[0] }}, pv = {{ c[1], c[1] }};
+				vst2q_u8 (u+n, pu);
+				vst2q_u8 (v+n, pv);
+			}
+			else {
+				vst1q_u8 (u+n, c[0]);
+				vst1q_u8 (v+n, c[1]);
+			}
+		}
+	}
+#endif
+	for (; i<pairs; i++) {
+		int cu = a[4*i + uo], cv = a[4*i + vo];
+		if (b != a) {
+			cu = (cu + b[4*i + uo] + 1) >> 1;
+			cv = (cv + b[4*i + vo] + 1) >> 1;
+		}
+		cu = scaleChroma (cu, JpegScaleU);
+		cv = scaleChroma (cv, JpegScaleV);
+		u[n] = cu;
+		v[n] = cv;
+		n++;
+		if (full) {
+			u[n] = cu;
+			v[n] = cv;
+			n++;
+		}
+	}
+	for (; n<padded; n++) {
+		u[n] = u[n-1];
+		v[n] = v[n-1];
+	}
+}
+
+
+// Sampling of luma against chroma; chroma keeps 1x1
+void JpegCompress::setSampling ()
+{
+	if (cinfo.num_components < 3)
+		return;
+	cinfo.comp_info[0].h_samp_factor = (subsampling==JPEG_444 ? 1 : 2);
+	cinfo.comp_info[0].v_samp_factor = (subsampling==JPEG_420 ? 2 : 1);
+	for (int c=1; c<3; c++)
+		cinfo.comp_info[c].h_samp_factor = cinfo.comp_info[c].v_samp_factor = 1;
+}
+
+
+/*
+ * Image goes in bands of one row of MCU. Rows and columns past the
+ * edge of image repeat the last ones, since libjpeg reads whole blocks.
+ */
+void JpegCompress::writeRaw (const uint8_t *image, int width, int height, bool uyvy)
+{
+	const int hs = cinfo.comp_info[0].h_samp_factor, vs = cinfo.comp_info[0].v_samp_factor,
+		lines = vs*DCTSIZE,
+		lumaWidth = (width + hs*DCTSIZE - 1) / (hs*DCTSIZE) * (hs*DCTSIZE),
+		chromaWidth = lumaWidth / hs,
+		pairs = width / 2,
+		stride = 2*width;
+
+	planes.resize (lines*lumaWidth + 2*DCTSIZE*chromaWidth);
+	rows.resize (lines + 2*DCTSIZE);
+	for (int r=0; r<lines; r++)
+		rows[r] = &planes[r*lumaWidth];
+	for (int r=0; r<2*DCTSIZE; r++)
+		rows[lines + r] = &planes[lines*lumaWidth + r*chromaWidth];
+	JSAMPARRAY bands[3] = { &rows[0], &rows[lines], &rows[lines + DCTSIZE] };
+
+	for (int y0=0; y0<height; y0+=lines) {
+		for (int r=0; r<lines; r++) {
+			const uint8_t *src = image + std::min (y0 + r, height-1) * stride;
+			if (uyvy)
+				splitLuma<true> (src, width, rows[r], lumaWidth);
+			else
+				splitLuma<false> (src, width, rows[r], lumaWidth);
+			if (r % vs)
+				continue;
+			const uint8_t *next = (vs==2 ? image + std::min (y0 + r + 1, height-1) * stride : src);
+			int c = r / vs;
+			if (uyvy)
+				splitChroma<true> (src, next, pairs, hs==1, bands[1][c], bands[2][c], chromaWidth);
+			else
+				splitChroma<false> (src, next, pairs, hs==1, bands[1][c], bands[2][c], chromaWidth);
+		}
+		jpeg_write_raw_data (&cinfo, bands, lines);
+	}
+}
+
+
+shared_ptr<uint8_t> JpegCompress::compress (const uint8_t *image, int width, int height,
+	JPEG_INPUT input, uint32_t &size)
+{
+	bool yuv = (input==JPEG_YUYV || input==JPEG_UYVY);
+	if (width <= 0 || height <= 0 || (yuv && width < 2))
+		throw JpegException ("Invalid image size");
+
+	// sized after last image, with room to spare
+	capacity = std::max<uint32_t> (JpegMinimumBuffer,
+		lastSize ? lastSize + lastSize/4 : width*height/2);
+
+	if (setjmp (error.jump)) {
+		jpeg_abort_compress (&cinfo);
+		output.reset ();
+		throw JpegException (error.message);
+	}
+
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = (input==JPEG_GRAY ? 1 : 3);
+	cinfo.in_color_space = (input==JPEG_GRAY ? JCS_GRAYSCALE : yuv ? JCS_YCbCr : JCS_RGB);
+	jpeg_set_defaults (&cinfo);
+	jpeg_set_quality (&cinfo, quality, TRUE);
+	setSampling ();
+	cinfo.raw_data_in = (yuv ? TRUE : FALSE);
+	jpeg_start_compress (&cinfo, TRUE);
+
+	if (yuv)
+		writeRaw (image, width, height, input==JPEG_UYVY);
+	else {
+		rows.resize (height);
+		int stride = width * cinfo.input_components;
+		for (int r=0; r<height; r++)
+			rows[r] = (JSAMPROW)(image + r*stride);
+		while (cinfo.next_scanline < cinfo.image_height)
+			jpeg_write_scanlines (&cinfo, &rows[cinfo.next_scanline], height - cinfo.next_scanline);
+	}
+	jpeg_finish_compress (&cinfo);
+
+	size = capacity - destination.free_in_buffer;
+	lastSize = size;
+	shared_ptr<uint8_t> jpeg = output;
+	output.reset ();
+	return jpeg;
+}
+
+
+JpegDecompress::JpegDecompress ()
+{
+	dinfo.err = jpeg_std_error (&error.manager);
+	error.manager.error_exit = jumpOnError;
+	jpeg_create_decompress (&dinfo);
+	source.init_source = initSource;
+	source.fill_input_buffer = fillInput;
+	source.skip_input_data = skipInput;
+	source.resync_to_restart = jpeg_resync_to_restart;
+	source.term_source = termSource;
+	source.next_input_byte = NULL;
+	source.bytes_in_buffer = 0;
+	dinfo.src = &source;
+}
+
+
+JpegDecompress::~JpegDecompress ()
+{
+	jpeg_destroy_decompress (&dinfo);
+}
+
+
+void JpegDecompress::initSource (j_decompress_ptr)
+{}
+
+
+// Image cut short is ended, so that what came is still shown
+boolean JpegDecompress::fillInput (j_decompress_ptr dinfo)
+{
+	static const JOCTET end[2] = { 0xFF, JPEG_EOI };
+	dinfo->src->next_input_byte = end;
+	dinfo->src->bytes_in_buffer = 2;
+	return TRUE;
+}
+
+
+void JpegDecompress::skipInput (j_decompress_ptr dinfo, long count)
+{
+	if (count <= 0)
+		return;
+	if ((size_t)count > dinfo->src->bytes_in_buffer) {
+		fillInput (dinfo);
+		return;
+	}
+	dinfo->src->next_input_byte += count;
+	dinfo->src->bytes_in_buffer -= count;
+}
+
+
+void JpegDecompress::termSource (j_decompress_ptr)
+{}
+
+
+void JpegDecompress::decompress (const uint8_t *jpeg, uint32_t size, std::vector<uint8_t> &image,
+	int &width, int &height, bool color)
+{
+	if (setjmp (error.jump)) {
+		jpeg_abort_decompress (&dinfo);
+		throw JpegException (error.message);
+	}
+
+	source.next_input_byte = jpeg;
+	source.bytes_in_buffer = size;
+	jpeg_read_header (&dinfo, TRUE);
+	dinfo.out_color_space = (color ? JCS_RGB : JCS_GRAYSCALE);
+	jpeg_start_decompress (&dinfo);
+
+	width = dinfo.output_width;
+	height = dinfo.output_height;
+	int stride = width * dinfo.output_components;
+	image.resize (stride * height);
+	while (dinfo.output_scanline < dinfo.output_height) {
+		JSAMPROW row = &image[dinfo.output_scanline * stride];
+		jpeg_read_scanlines (&dinfo, &row, 1);
+	}
+	jpeg_finish_decompress (&dinfo);
+}
+
+} /* namespace Robocar */
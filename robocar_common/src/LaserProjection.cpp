@@ -0,0 +1,196 @@
+/*
+ * LaserProjection.cpp
+ */
+
+#include "LaserProjection.h"
+#include "HokuyoDriver.h"
+#include "MessageRegisters.h"
+#include "simd.h"
+#include <cmath>
+#include <cstring>
+
+
+namespace Robocar {
+
+
+/*
+ * Points of beams done so far are packed to the front; every lane
+ * is written, but the position only moves for valid ones
+ */
+static inline int packPoints (const float *x, const float *y, const float *in, int valid,
+	float *xy, float *out, int pos)
+{
+	for (int k=0; k<4; k++) {
+		xy[2*pos] = x[k];
+		xy[2*pos+1] = y[k];
+		if (out != NULL)
+			out[pos] = in[k];
+		pos += (valid >> k) & 1;
+	}
+	return pos;
+}
+
+
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+static int projectSSE2 (const float *ranges, int count, const float *sines, const float *cosines,
+	float minRange, float maxRange, float *xy, const float *intensities, float *intensitiesOut,
+	int &done)
+{
+	const __m128 lo = _mm_set1_ps (minRange), hi = _mm_set1_ps (maxRange);
+	int pos = 0, i = 0;
+	for (; i+4 <= count; i += 4) {
+		__m128 r = _mm_loadu_ps (ranges+i);
+		__m128 x = _mm_mul_ps (r, _mm_loadu_ps (cosines+i)),
+			y = _mm_mul_ps (r, _mm_loadu_ps (sines+i));
+		// false for NaN
+		int valid = _mm_movemask_ps (_mm_and_ps (_mm_cmpge_ps (r, lo), _mm_cmple_ps (r, hi)));
+
+		if (valid==0xf) {
+			_mm_storeu_ps (xy + 2*pos, _mm_unpacklo_ps (x, y));
+			_mm_storeu_ps (xy + 2*pos + 4, _mm_unpackhi_ps (x, y));
+			if (intensitiesOut != NULL)
+				_mm_storeu_ps (intensitiesOut + pos, _mm_loadu_ps (intensities+i));
+			pos += 4;
+		}
+		else if (valid != 0) {
+			float xs[4], ys[4];
+			_mm_storeu_ps (xs, x);
+			_mm_storeu_ps (ys, y);
+			pos = packPoints (xs, ys, (intensitiesOut ? intensities+i : NULL), valid,
+				xy, intensitiesOut, pos);
+		}
+	}
+	done = i;
+	return pos;
+}
+#endif
+
+
+#ifdef ROBOCAR_SIMD_NEON
+static int projectNEON (const float *ranges, int count, const float *sines, const float *cosines,
+	float minRange, float maxRange, float *xy, const float *intensities, float *intensitiesOut,
+	int &done)
+{
+	const float32x4_t lo = vdupq_n_f32 (minRange), hi = vdupq_n_f32 (maxRange);
+	const uint32x4_t bits = {1, 2, 4, 8};
+	int pos = 0, i = 0;
+	for (; i+4 <= count; i += 4) {
+		float32x4_t r = vld1q_f32 (ranges+i);
+		float32x4x2_t p;
+		p.val[0] = vmulq_f32 (r, vld1q_f32 (cosines+i));
+		p.val[1] = vmulq_f32 (r, vld1q_f32 (sines+i));
+		uint32x4_t v = vandq_u32 (vandq_u32 (vcgeq_f32 (r, lo), vcleq_f32 (r, hi)), bits);
+		uint32x2_t v2 = vorr_u32 (vget_low_u32 (v), vget_high_u32 (v));
+		int valid = vget_lane_u32 (v2, 0) | vget_lane_u32 (v2, 1);
+
+		if (valid==0xf) {
+			vst2q_f32 (xy + 2*pos, p);
+			if (intensitiesOut != NULL)
+				vst1q_f32 (intensitiesOut + pos, vld1q_f32 (intensities+i));
+			pos += 4;
+		}
+		else if (valid != 0) {
+			float xs[4], ys[4];
+			vst1q_f32 (xs, p.val[0]);
+			vst1q_f32 (ys, p.val[1]);
+			pos = packPoints (xs, ys, (intensitiesOut ? intensities+i : NULL), valid,
+				xy, intensitiesOut, pos);
+		}
+	}
+	done = i;
+	return pos;
+}
+#endif
+
+
+LaserProjection::LaserProjection () :
+	tableStart (0), tableIncrement (0)
+{}
+
+
+void LaserProjection::buildTable (int count, float minAngle, float increment)
+{
+	sines.resize (count);
+	cosines.resize (count);
+	for (int i=0; i<count; i++) {
+		double angle = minAngle + (double)i*increment;
+		sines[i] = sin (angle);
+		cosines[i] = cos (angle);
+	}
+	tableStart = minAngle;
+	tableIncrement = increment;
+}
+
+
+int LaserProjection::project (const float *ranges, int count, float minAngle, float increment,
+	float minRange, float maxRange, float *xy,
+	const float *intensities, float *intensitiesOut)
+{
+	if (count > (int)sines.size() || minAngle != tableStart || increment != tableIncrement)
+		buildTable (count, minAngle, increment);
+	if (intensities==NULL)
+		intensitiesOut = NULL;
+
+	// xy has room for every beam, so writing a whole
+	// group of four past the last point is safe
+	int pos = 0, i = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simdDisabled()==false)
+		pos = projectSSE2 (ranges, count, &sines[0], &cosines[0], minRange, maxRange,
+			xy, intensities, intensitiesOut, i);
+#elif defined(ROBOCAR_SIMD_NEON)
+	if (simdDisabled()==false)
+		pos = projectNEON (ranges, count, &sines[0], &cosines[0], minRange, maxRange,
+			xy, intensities, intensitiesOut, i);
+#endif
+
+	for (; i<count; i++) {
+		float r = ranges[i];
+		if (r >= minRange && r <= maxRange) {
+			xy[2*pos] = r * cosines[i];
+			xy[2*pos+1] = r * sines[i];
+			if (intensitiesOut != NULL)
+				intensitiesOut[pos] = intensities[i];
+			pos++;
+		}
+	}
+	return pos;
+}
+
+
+shared_ptr<Message> LaserProjection::toMessage (Message &scan)
+{
+	const uint32_t scanHeaderSize = sizeof(_hokuyoMessageBuffer) - 1;
+	_hokuyoMessageBuffer *in = (_hokuyoMessageBuffer*)scan.getContent();
+	int n = (scan.getSize() >= scanHeaderSize ? in->num_ranges : 0);
+	if (scan.getSize() < scanHeaderSize + n*sizeof(float))
+		n = 0;
+	bool hasIntensity = (n > 0 && scan.getSize() >= scanHeaderSize + 2*n*sizeof(float));
+	const float *ranges = (const float*)&in->_ranges;
+
+	// room for all beams; only the points are sent
+	shared_ptr<uint8_t> buffer (new uint8_t [sizeof(_lidarPointsHeader) + 3*n*sizeof(float)]);
+	_lidarPointsHeader *header = (_lidarPointsHeader*)buffer.get();
+	float *xy = (float*)(buffer.get() + sizeof(_lidarPointsHeader));
+	std::vector<float> intensities;
+	if (hasIntensity)
+		intensities.resize (n);
+
+	int points = (n > 0 ? project (ranges, n, in->min_angle, in->angular_increment,
+		in->min_range, in->max_range, xy,
+		(hasIntensity ? ranges+n : NULL), (hasIntensity ? &intensities[0] : NULL)) : 0);
+
+	header->flags = (hasIntensity ? POINTS_INTENSITY : 0);
+	header->device = (scan.getSize() >= scanHeaderSize ? in->device : 0);
+	memset (header->_pad, 0, sizeof(header->_pad));
+	header->num_points = points;
+	if (hasIntensity)
+		memcpy (xy + 2*points, &intensities[0], points*sizeof(float));
+
+	uint32_t size = sizeof(_lidarPointsHeader) + (hasIntensity ? 3 : 2)*points*sizeof(float);
+	shared_ptr<Message> msg (new Message (LidarPointsMessageCategory, size, buffer));
+	msg->setTimestamp (scan.getTimestamp ());
+	return msg;
+}
+
+} /* namespace Robocar */
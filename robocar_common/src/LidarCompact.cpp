@@ -0,0 +1,461 @@
+/*
+ * LidarCompact.cpp
+ */
+
+#include "LidarCompact.h"
+#include "HokuyoDriver.h"
+#include "MessageRegisters.h"
+#include "simd.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+
+namespace Robocar {
+
+
+uint64_t timeval_to_nanosecond (const struct timeval &tv);
+
+
+// Highest code of each width; the two below it are +Inf and -Inf
+#define CompactNaN16	0xffff
+#define CompactNaN24	0xffffff
+#define CompactReservedCodes	3
+
+
+static inline void putValue (uint8_t *&dst, uint32_t v, bool wide)
+{
+	*dst++ = v & 0xff;
+	*dst++ = (v >> 8) & 0xff;
+	if (wide)
+		*dst++ = (v >> 16) & 0xff;
+}
+
+
+static inline uint32_t getValue (const uint8_t *&src, bool wide)
+{
+	uint32_t v = src[0] | (src[1] << 8);
+	if (wide)
+		v |= (src[2] << 16);
+	src += (wide ? 3 : 2);
+	return v;
+}
+
+
+static float codeToRange (int32_t code, int32_t nanCode)
+{
+	if (code==nanCode)
+		return std::numeric_limits<float>::quiet_NaN();
+	else if (code==nanCode-1)
+		return std::numeric_limits<float>::infinity();
+	else
+		return -std::numeric_limits<float>::infinity();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Decoding kernels. Each returns number of values done; the caller
+// finishes the rest.
+
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+static int widen16SSE2 (const uint8_t *src, int count, int32_t *dst)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	int i = 0;
+	for (; i+8 <= count; i += 8) {
+		__m128i x = _mm_loadu_si128 ((const __m128i*)(src + 2*i));
+		_mm_storeu_si128 ((__m128i*)(dst + i), _mm_unpacklo_epi16 (x, zero));
+		_mm_storeu_si128 ((__m128i*)(dst + i + 4), _mm_unpackhi_epi16 (x, zero));
+	}
+	return i;
+}
+
+
+// Escapes count as zero delta; they are patched afterwards
+static int prefixSumSSE2 (const int8_t *src, int count, int32_t *dst)
+{
+	const __m128i escape = _mm_set1_epi8 (CompactDeltaEscape);
+	__m128i carry = _mm_setzero_si128 ();
+	int i = 0;
+	for (; i+16 <= count; i += 16) {
+		__m128i d = _mm_loadu_si128 ((const __m128i*)(src + i));
+		d = _mm_andnot_si128 (_mm_cmpeq_epi8 (d, escape), d);
+
+		// sign extension, 8 to 16 to 32 bit
+		__m128i lo = _mm_srai_epi16 (_mm_unpacklo_epi8 (d, d), 8),
+			hi = _mm_srai_epi16 (_mm_unpackhi_epi8 (d, d), 8);
+		__m128i q[4] = {
+			_mm_srai_epi32 (_mm_unpacklo_epi16 (lo, lo), 16),
+			_mm_srai_epi32 (_mm_unpackhi_epi16 (lo, lo), 16),
+			_mm_srai_epi32 (_mm_unpacklo_epi16 (hi, hi), 16),
+			_mm_srai_epi32 (_mm_unpackhi_epi16 (hi, hi), 16)
+		};
+
+		for (int k=0; k<4; k++) {
+			__m128i s = _mm_add_epi32 (q[k], _mm_slli_si128 (q[k], 4));
+			s = _mm_add_epi32 (s, _mm_slli_si128 (s, 8));
+			s = _mm_add_epi32 (s, carry);
+			_mm_storeu_si128 ((__m128i*)(dst + i + 4*k), s);
+			carry = _mm_shuffle_epi32 (s, 0xff);
+		}
+	}
+	return i;
+}
+
+
+// Same division as the decoder of the device, for identical floats
+static int toRangesSSE2 (const int32_t *mm, int count, int32_t nanCode, float *ranges)
+{
+	const __m128 thousand = _mm_set1_ps (1000.0f);
+	const __m128i limit = _mm_set1_epi32 (nanCode - CompactReservedCodes);
+	int i = 0;
+	for (; i+4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128 ((const __m128i*)(mm + i));
+		_mm_storeu_ps (ranges + i, _mm_div_ps (_mm_cvtepi32_ps (v), thousand));
+
+		int codes = _mm_movemask_ps (_mm_castsi128_ps (_mm_cmpgt_epi32 (v, limit)));
+		for (int k=0; codes != 0; k++, codes >>= 1)
+			if (codes & 1)
+				ranges[i+k] = codeToRange (mm[i+k], nanCode);
+	}
+	return i;
+}
+#endif
+
+
+#ifdef ROBOCAR_SIMD_NEON
+static int widen16NEON (const uint8_t *src, int count, int32_t *dst)
+{
+	int i = 0;
+	for (; i+8 <= count; i += 8) {
+		uint16x8_t x = vreinterpretq_u16_u8 (vld1q_u8 (src + 2*i));
+		vst1q_s32 (dst + i, vreinterpretq_s32_u32 (vmovl_u16 (vget_low_u16 (x))));
+		vst1q_s32 (dst + i + 4, vreinterpretq_s32_u32 (vmovl_u16 (vget_high_u16 (x))));
+	}
+	return i;
+}
+
+
+static int prefixSumNEON (const int8_t *src, int count, int32_t *dst)
+{
+	const int32x4_t zero = vdupq_n_s32 (0);
+	int32x4_t carry = zero;
+	int i = 0;
+	for (; i+16 <= count; i += 16) {
+		int8x16_t d = vld1q_s8 (src + i);
+		d = vbicq_s8 (d, vreinterpretq_s8_u8 (vceqq_s8 (d, vdupq_n_s8 (CompactDeltaEscape))));
+
+		int16x8_t lo = vmovl_s8 (vget_low_s8 (d)),
+			hi = vmovl_s8 (vget_high_s8 (d));
+		int32x4_t q[4] = {
+			vmovl_s16 (vget_low_s16 (lo)), vmovl_s16 (vget_high_s16 (lo)),
+			vmovl_s16 (vget_low_s16 (hi)), vmovl_s16 (vget_high_s16 (hi))
+		};
+
+		for (int k=0; k<4; k++) {
+			int32x4_t s = vaddq_s32 (q[k], vextq_s32 (zero, q[k], 3));
+			s = vaddq_s32 (s, vextq_s32 (zero, s, 2));
+			s = vaddq_s32 (s, carry);
+			vst1q_s32 (dst + i + 4*k, s);
+			carry = vdupq_n_s32 (vgetq_lane_s32 (s, 3));
+		}
+	}
+	return i;
+}
+
+
+#ifdef __aarch64__
+static int toRangesNEON (const int32_t *mm, int count, int32_t nanCode, float *ranges)
+{
+	const float32x4_t thousand = vdupq_n_f32 (1000.0f);
+	const int32x4_t limit = vdupq_n_s32 (nanCode - CompactReservedCodes);
+	int i = 0;
+	for (; i+4 <= count; i += 4) {
+		int32x4_t v = vld1q_s32 (mm + i);
+		vst1q_f32 (ranges + i, vdivq_f32 (vcvtq_f32_s32 (v), thousand));
+
+		if (vmaxvq_u32 (vcgtq_s32 (v, limit)) != 0)
+			for (int k=0; k<4; k++)
+				if (mm[i+k] > nanCode - CompactReservedCodes)
+					ranges[i+k] = codeToRange (mm[i+k], nanCode);
+	}
+	return i;
+}
+#endif
+#endif
+
+
+static void widen16 (const uint8_t *src, int count, int32_t *dst)
+{
+	int i = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simdDisabled()==false)
+		i = widen16SSE2 (src, count, dst);
+#elif defined(ROBOCAR_SIMD_NEON)
+	if (simdDisabled()==false)
+		i = widen16NEON (src, count, dst);
+#endif
+	for (src += 2*i; i<count; i++)
+		dst[i] = getValue (src, false);
+}
+
+
+static void prefixSum (const int8_t *src, int count, int32_t *dst)
+{
+	int i = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simdDisabled()==false)
+		i = prefixSumSSE2 (src, count, dst);
+#elif defined(ROBOCAR_SIMD_NEON)
+	if (simdDisabled()==false)
+		i = prefixSumNEON (src, count, dst);
+#endif
+	int32_t sum = (i > 0 ? dst[i-1] : 0);
+	for (; i<count; i++) {
+		if (src[i] != CompactDeltaEscape)
+			sum += src[i];
+		dst[i] = sum;
+	}
+}
+
+
+static void toRanges (const int32_t *mm, int count, int32_t nanCode, float *ranges)
+{
+	int i = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simdDisabled()==false)
+		i = toRangesSSE2 (mm, count, nanCode, ranges);
+#elif defined(ROBOCAR_SIMD_NEON) && defined(__aarch64__)
+	if (simdDisabled()==false)
+		i = toRangesNEON (mm, count, nanCode, ranges);
+#endif
+	for (; i<count; i++) {
+		if (mm[i] > nanCode - CompactReservedCodes)
+			ranges[i] = codeToRange (mm[i], nanCode);
+		else
+			ranges[i] = ((float)mm[i]) / 1000.0f;
+	}
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+shared_ptr<Message> LidarCompactEncoder::encode (Message &scan)
+{
+	const uint32_t scanHeaderSize = sizeof(_hokuyoMessageBuffer) - 1;
+	_hokuyoMessageBuffer *in = (_hokuyoMessageBuffer*)scan.getContent();
+	int n = (scan.getSize() >= scanHeaderSize ? in->num_ranges : 0);
+	if (scan.getSize() < scanHeaderSize + n*sizeof(float) || n > 0xffff)
+		n = 0;
+	bool hasIntensity = (n > 0 && scan.getSize() >= scanHeaderSize + 2*n*sizeof(float));
+	const float *ranges = (const float*)&in->_ranges,
+		*intensities = ranges + n;
+
+	// Millimetres; specials are kept negative until the width is known
+	std::vector<int32_t> mm (n);
+	int32_t farthest = 0;
+	for (int i=0; i<n; i++) {
+		float r = ranges[i];
+		if (r != r)
+			mm[i] = -1;
+		else if (std::isinf (r))
+			mm[i] = (r > 0 ? -2 : -3);
+		else {
+			mm[i] = (r > 0 ? (int32_t)lround (r*1000.0) : 0);
+			if (mm[i] > CompactNaN24 - CompactReservedCodes)
+				mm[i] = CompactNaN24 - CompactReservedCodes;
+			if (mm[i] > farthest)
+				farthest = mm[i];
+		}
+	}
+
+	uint8_t flags = 0;
+	bool wide = (farthest > CompactNaN16 - CompactReservedCodes);
+	int32_t nanCode = (wide ? CompactNaN24 : CompactNaN16);
+	if (wide)
+		flags |= COMPACT_WIDE;
+	for (int i=0; i<n; i++)
+		if (mm[i] < 0)
+			mm[i] = nanCode + 1 + mm[i];
+
+	// Delta coding is used only if it's smaller
+	int width = (wide ? 3 : 2), exceptions = 0;
+	for (int i=0; i<n; i++) {
+		int32_t d = mm[i] - (i > 0 ? mm[i-1] : 0);
+		if (d <= CompactDeltaEscape || d > 127)
+			exceptions++;
+	}
+	bool delta = (n + exceptions*width < n*width);
+	if (delta)
+		flags |= COMPACT_DELTA;
+
+	bool intensityWide = false;
+	if (hasIntensity) {
+		flags |= COMPACT_INTENSITY;
+		for (int i=0; i<n; i++)
+			if (intensities[i] > 0xffff)
+				intensityWide = true;
+		if (intensityWide)
+			flags |= COMPACT_INTENSITY_WIDE;
+	}
+
+	_lidarCompactConfig current;
+	current.min_angle = in->min_angle;
+	current.max_angle = in->max_angle;
+	current.angular_increment = in->angular_increment;
+	current.scan_time = in->scan_time;
+	current.min_range = in->min_range;
+	current.max_range = in->max_range;
+	if (configSent==false || memcmp (&current, &config, sizeof(config)) != 0) {
+		flags |= COMPACT_CONFIG;
+		config = current;
+		configSent = true;
+	}
+
+	uint32_t size = sizeof(_lidarCompactHeader)
+		+ ((flags & COMPACT_CONFIG) ? sizeof(_lidarCompactConfig) : 0)
+		+ (delta ? n + exceptions*width : n*width)
+		+ (hasIntensity ? n*(intensityWide ? 3 : 2) : 0);
+	shared_ptr<uint8_t> buffer (new uint8_t [size]);
+
+	_lidarCompactHeader *header = (_lidarCompactHeader*)buffer.get();
+	header->flags = flags;
+	header->device = (scan.getSize() >= scanHeaderSize ? in->device : 0);
+	header->num_ranges = n;
+	header->num_exceptions = (delta ? exceptions : 0);
+	uint8_t *dst = buffer.get() + sizeof(_lidarCompactHeader);
+	if (flags & COMPACT_CONFIG) {
+		memcpy (dst, &config, sizeof(config));
+		dst += sizeof(config);
+	}
+
+	if (delta) {
+		int8_t *deltas = (int8_t*)dst;
+		dst += n;
+		for (int i=0; i<n; i++) {
+			int32_t d = mm[i] - (i > 0 ? mm[i-1] : 0);
+			if (d <= CompactDeltaEscape || d > 127) {
+				deltas[i] = CompactDeltaEscape;
+				putValue (dst, mm[i], wide);
+			}
+			else
+				deltas[i] = d;
+		}
+	}
+	else {
+		for (int i=0; i<n; i++)
+			putValue (dst, mm[i], wide);
+	}
+
+	for (int i=0; hasIntensity && i<n; i++) {
+		float v = intensities[i];
+		uint32_t iv = (v > 0 ? (uint32_t)lround (v) : 0);
+		putValue (dst, (iv > CompactNaN24 ? CompactNaN24 : iv), intensityWide);
+	}
+
+	shared_ptr<Message> compact (new Message (LidarCompactMessageCategory, size, buffer));
+	compact->setTimestamp (scan.getTimestamp ());
+	return compact;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+int LidarCompactDecoder::device (Message &msg)
+{
+	if (msg.getSize() < sizeof(_lidarCompactHeader))
+		return -1;
+	return ((_lidarCompactHeader*)msg.getContent())->device;
+}
+
+
+bool LidarCompactDecoder::decode (Message &msg, hokuyo::LaserScan &scan)
+{
+	uint32_t size = msg.getSize ();
+	if (size < sizeof(_lidarCompactHeader))
+		return false;
+	const uint8_t *src = (const uint8_t*)msg.getContent ();
+	_lidarCompactHeader header;
+	memcpy (&header, src, sizeof(header));
+	src += sizeof(header);
+
+	int n = header.num_ranges;
+	bool wide = (header.flags & COMPACT_WIDE);
+	int width = (wide ? 3 : 2),
+		intensityWidth = ((header.flags & COMPACT_INTENSITY_WIDE) ? 3 : 2);
+	uint32_t expected = sizeof(header)
+		+ ((header.flags & COMPACT_CONFIG) ? sizeof(_lidarCompactConfig) : 0)
+		+ ((header.flags & COMPACT_DELTA) ? n + header.num_exceptions*width : n*width)
+		+ ((header.flags & COMPACT_INTENSITY) ? n*intensityWidth : 0);
+	if (size < expected)
+		return false;
+
+	if (header.flags & COMPACT_CONFIG) {
+		memcpy (&config, src, sizeof(config));
+		src += sizeof(config);
+		hasConfig = true;
+	}
+	if (hasConfig==false)
+		return false;
+
+	values.resize (n);
+	if (header.flags & COMPACT_DELTA) {
+		const int8_t *deltas = (const int8_t*)src;
+		src += n;
+		prefixSum (deltas, n, values.data());
+
+		// Each escaped value shifts every beam after it,
+		// up to the next escape
+		const void *p = deltas;
+		int e = -1;
+		int32_t shift = 0;
+		for (int k=0; k<header.num_exceptions; k++) {
+			p = memchr (p, (uint8_t)CompactDeltaEscape, n - ((const int8_t*)p - deltas));
+			if (p==NULL)
+				return false;
+			int next = (const int8_t*)p - deltas;
+			for (int i=e+1; i<next; i++)
+				values[i] += shift;
+			shift = getValue (src, wide) - values[next];
+			values[next] += shift;
+			e = next;
+			p = (const int8_t*)p + 1;
+		}
+		for (int i=e+1; i<n; i++)
+			values[i] += shift;
+	}
+	else if (wide==false) {
+		widen16 (src, n, values.data());
+		src += 2*n;
+	}
+	else {
+		for (int i=0; i<n; i++)
+			values[i] = getValue (src, true);
+	}
+
+	scan.ranges.resize (n);
+	toRanges (values.data(), n, (wide ? CompactNaN24 : CompactNaN16), scan.ranges.data());
+
+	scan.intensities.clear ();
+	if (header.flags & COMPACT_INTENSITY) {
+		scan.intensities.resize (n);
+		if (intensityWidth==2)
+			widen16 (src, n, values.data());
+		else {
+			const uint8_t *isrc = src;
+			for (int i=0; i<n; i++)
+				values[i] = getValue (isrc, true);
+		}
+		for (int i=0; i<n; i++)
+			scan.intensities[i] = values[i];
+	}
+
+	scan.config.min_angle = config.min_angle;
+	scan.config.max_angle = config.max_angle;
+	scan.config.ang_increment = config.angular_increment;
+	scan.config.scan_time = config.scan_time;
+	scan.config.min_range = config.min_range;
+	scan.config.max_range = config.max_range;
+	scan.system_time_stamp = timeval_to_nanosecond (msg.getTimestamp());
+	return true;
+}
+
+} /* namespace Robocar */
@@ -0,0 +1,45 @@
+/*
+ * LidarRequest.cpp
+ */
+
+#include "LidarRequest.h"
+#include "MessageRegisters.h"
+
+
+namespace Robocar {
+
+
+shared_ptr<Message> LidarRequest::create (uint16_t decimation, float minAngle, float maxAngle, float maxRate)
+{
+	_lidarRequestBuffer *req = new _lidarRequestBuffer;
+	req->decimation = decimation;
+	req->min_angle = minAngle;
+	req->max_angle = maxAngle;
+	req->max_rate = maxRate;
+	return Message::create (LidarRequestMessageCategory, sizeof(_lidarRequestBuffer), (uint8_t*)req);
+}
+
+
+_lidarRequestBuffer *LidarRequest::parse (Message &msg)
+{
+	if (msg.getSize() < sizeof(_lidarRequestBuffer))
+		return NULL;
+	_lidarRequestBuffer *req = (_lidarRequestBuffer*)msg.getContent();
+	if (req->decimation < 1)
+		req->decimation = 1;
+	if (req->max_rate < 0)
+		req->max_rate = 0;
+	return req;
+}
+
+
+_lidarRequestBuffer LidarRequest::full ()
+{
+	_lidarRequestBuffer req;
+	req.decimation = 1;
+	req.min_angle = req.max_angle = 0;
+	req.max_rate = 0;
+	return req;
+}
+
+} /* namespace Robocar */
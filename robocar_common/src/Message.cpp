@@ -9,25 +9,42 @@
 #include <cstring>
 #include <stdlib.h>
 #include <endian.h>
+#include <boost/array.hpp>
 
 
 
 namespace Robocar {
 
+/*
+ * Header and content go out in one gather write, so the
+ * content is never copied
+ */
 void Message::send (boost::asio::ip::tcp::socket &serverSocket)
 {
-	_messageBuffer *buffer = serialize ();
-	boost::asio::write (
-		serverSocket,
-		boost::asio::buffer(
-			buffer, getWireSize()
-		)
-	);
-	delete[] buffer;
+	_messageBuffer header;
+	writeHeader (&header);
+
+	boost::array<boost::asio::const_buffer, 3> parts = {{
+		boost::asio::buffer (&header, sizeof(header)-sizeof(header.__msgStart)),
+		boost::asio::buffer (preamble, preambleSize),
+		boost::asio::buffer (content.get(), size - preambleSize)
+	}};
+	boost::asio::write (serverSocket, parts);
 	return;
 }
 
 
+bool Message::setPreamble (const void *data, uint8_t length)
+{
+	if (length > MessagePreambleMaximum)
+		return false;
+	memcpy (preamble, data, length);
+	size = size - preambleSize + length;
+	preambleSize = length;
+	return true;
+}
+
+
 shared_ptr<Message> Message::create (uint8_t category, int length, uint8_t *source)
 {
 	shared_ptr<uint8_t> buffer (source);
@@ -51,6 +68,14 @@ shared_ptr<Message> Message::create (uint8_t category, int length, shared_ptr<ui
 _messageBuffer * Message::serialize ()
 {
 	_messageBuffer * msgBuffer = ((_messageBuffer*)(new uint8_t[getWireSize()]));
+	writeHeader (msgBuffer);
+	memcpy (&(msgBuffer->__msgStart), preamble, preambleSize);
+	memcpy (&(msgBuffer->__msgStart) + preambleSize, content.get(), size - preambleSize);
+	return msgBuffer;
+}
+
+void Message::writeHeader (_messageBuffer *msgBuffer)
+{
 	msgBuffer->type = type;
 
 	// Date handling
@@ -58,10 +83,9 @@ _messageBuffer * Message::serialize ()
 	msgBuffer->time_microsecond = (uint64_t)timestamp.tv_usec;
 
 	msgBuffer->size = htobe32(size);
-	memcpy (&(msgBuffer->__msgStart), content.get(), size);
-	return msgBuffer;
 }
 
+
 shared_ptr<Message> Message::receive (boost::asio::ip::tcp::socket &clientSocket)
 {
 	_messageBuffer header;
@@ -21,9 +21,11 @@ MessageQueue::~MessageQueue()
 	}
 }
 
-void MessageQueue::push(shared_ptr<Message> src)
+void MessageQueue::push(shared_ptr<Message> src, bool force)
 {
 	scoped_lock<interprocess_mutex> lock(_mutex);
+	if (enabled==false && force==false)
+		return;
 	pipeline.push (src);
 	lock.unlock();
 	_condvar.notify_one();
@@ -35,6 +37,12 @@ bool MessageQueue::empty()
 	return pipeline.empty();
 }
 
+size_t MessageQueue::size()
+{
+	scoped_lock<interprocess_mutex> lock(_mutex);
+	return pipeline.size();
+}
+
 shared_ptr<Message> MessageQueue::pop ()
 {
 	scoped_lock<interprocess_mutex> lock(_mutex);
@@ -47,4 +55,19 @@ shared_ptr<Message> MessageQueue::pop ()
 	return front;
 }
 
+void MessageQueue::enable ()
+{
+	scoped_lock<interprocess_mutex> lock(_mutex);
+	enabled = true;
+}
+
+void MessageQueue::disable ()
+{
+	scoped_lock<interprocess_mutex> lock(_mutex);
+	enabled = false;
+	// Stale messages must not be delivered to the next client
+	while (!pipeline.empty())
+		pipeline.pop();
+}
+
 } /* namespace Robocar */
@@ -0,0 +1,50 @@
+/*
+ * Report.cpp
+ */
+
+#include "Report.h"
+#include "MessageRegisters.h"
+#include <cstring>
+#include <algorithm>
+
+
+namespace Robocar {
+
+
+// Keys that don't fit are cut, but stay terminated
+void Report::add (const char *key, double value)
+{
+	size_t length = strlen (key);
+	_reportEntry entry;
+	memset (entry.key, 0, ReportKeyLength);
+	memcpy (entry.key, key, std::min (length, (size_t)ReportKeyLength-1));
+	entry.value = value;
+	items.push_back (entry);
+}
+
+
+shared_ptr<Message> Report::toMessage ()
+{
+	uint32_t size = sizeof(_reportHeader) + items.size()*sizeof(_reportEntry);
+	uint8_t *buffer = new uint8_t [size];
+	_reportHeader *header = (_reportHeader*)buffer;
+	header->source = source;
+	header->kind = kind;
+	header->numEntries = items.size();
+	if (items.empty()==false)
+		memcpy (buffer+sizeof(_reportHeader), &items[0], items.size()*sizeof(_reportEntry));
+	return Message::create (ReportMessageCategory, size, buffer);
+}
+
+
+_reportHeader *Report::parse (Message &msg)
+{
+	if (msg.getSize() < sizeof(_reportHeader))
+		return NULL;
+	_reportHeader *header = (_reportHeader*)msg.getContent();
+	if (msg.getSize() < sizeof(_reportHeader) + header->numEntries*sizeof(_reportEntry))
+		return NULL;
+	return header;
+}
+
+} /* namespace Robocar */
@@ -0,0 +1,459 @@
+/*
+ * ScanFilter.cpp
+ */
+
+#include "ScanFilter.h"
+#include "simd.h"
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <limits>
+#include <algorithm>
+#include <sstream>
+
+
+#define DefaultShadowAngle 10.0
+#define MaximumShadowNeighbours 16
+
+
+namespace Robocar {
+
+
+static const float Infinity = std::numeric_limits<float>::infinity();
+static const float NotANumber = std::numeric_limits<float>::quiet_NaN();
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar versions; vector kernels below must give the same results
+
+static inline float farIfNaN (float x)
+{ return (x != x ? Infinity : x); }
+
+
+// NaN doesn't vote; it takes the value of the center
+static inline float voteOf (float x, float center)
+{ return (x != x ? center : x); }
+
+
+static inline float median3 (float a, float b, float c)
+{ return std::max (std::min (a, b), std::min (std::max (a, b), c)); }
+
+
+static inline float median5 (float a, float b, float c, float d, float e)
+{
+	return median3 (e,
+		std::max (std::min (a, b), std::min (c, d)),
+		std::min (std::max (a, b), std::max (c, d)));
+}
+
+
+static inline float medianAt (const float *const *in, int window, int i, float center)
+{
+	float c = farIfNaN (center);
+	float m = (window==3 ?
+		median3 (voteOf (in[0][i], c), voteOf (in[1][i], c), voteOf (in[2][i], c)) :
+		median5 (voteOf (in[0][i], c), voteOf (in[1][i], c), voteOf (in[2][i], c),
+			voteOf (in[3][i], c), voteOf (in[4][i], c)));
+	return (m==Infinity && center != center ? center : m);
+}
+
+
+static inline bool isShadow (float r1, float r2, float s, float c, float t)
+{
+	if (std::isfinite (r1)==false || std::isfinite (r2)==false)
+		return false;
+	float y = r2 * s;
+	float x = r1 - r2 * c;
+	return y < t * std::fabs (x);
+}
+
+
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+///////////////////////////////////////////////////////////////////////////////
+static inline __m128 voteOfSSE (__m128 x, __m128 center)
+{
+	__m128 nan = _mm_cmpunord_ps (x, x);
+	return _mm_or_ps (_mm_and_ps (nan, center), _mm_andnot_ps (nan, x));
+}
+
+
+static inline __m128 median3SSE (__m128 a, __m128 b, __m128 c)
+{ return _mm_max_ps (_mm_min_ps (a, b), _mm_min_ps (_mm_max_ps (a, b), c)); }
+
+
+static int medianSSE2 (const float *const *in, int window, const float *center, float *out, int count)
+{
+	const __m128 inf = _mm_set1_ps (Infinity);
+	int i = 0;
+	for (; i+4 <= count; i += 4) {
+		__m128 ctr = _mm_loadu_ps (center+i);
+		__m128 v = voteOfSSE (ctr, inf);
+		__m128 a = voteOfSSE (_mm_loadu_ps (in[0]+i), v),
+			b = voteOfSSE (_mm_loadu_ps (in[1]+i), v),
+			c = voteOfSSE (_mm_loadu_ps (in[2]+i), v);
+		__m128 m;
+		if (window==3)
+			m = median3SSE (a, b, c);
+		else {
+			__m128 d = voteOfSSE (_mm_loadu_ps (in[3]+i), v),
+				e = voteOfSSE (_mm_loadu_ps (in[4]+i), v);
+			m = median3SSE (e,
+				_mm_max_ps (_mm_min_ps (a, b), _mm_min_ps (c, d)),
+				_mm_min_ps (_mm_max_ps (a, b), _mm_max_ps (c, d)));
+		}
+		__m128 keep = _mm_and_ps (_mm_cmpunord_ps (ctr, ctr), _mm_cmpeq_ps (m, inf));
+		_mm_storeu_ps (out+i, _mm_or_ps (_mm_and_ps (keep, ctr), _mm_andnot_ps (keep, m)));
+	}
+	return i;
+}
+
+
+static int clipSSE2 (float *ranges, int count, float lo, float hi)
+{
+	const __m128 vlo = _mm_set1_ps (lo), vhi = _mm_set1_ps (hi),
+		inf = _mm_set1_ps (Infinity), ninf = _mm_set1_ps (-Infinity),
+		nan = _mm_set1_ps (NotANumber);
+	int i = 0;
+	for (; i+4 <= count; i += 4) {
+		__m128 r = _mm_loadu_ps (ranges+i);
+		__m128 out = _mm_or_ps (
+			_mm_and_ps (_mm_cmplt_ps (r, vlo), _mm_cmpgt_ps (r, ninf)),
+			_mm_and_ps (_mm_cmpgt_ps (r, vhi), _mm_cmplt_ps (r, inf)));
+		_mm_storeu_ps (ranges+i, _mm_or_ps (_mm_and_ps (out, nan), _mm_andnot_ps (out, r)));
+	}
+	return i;
+}
+
+
+// Beams from first to last-1, all neighbours within the array
+static int shadowSSE2 (const float *in, float *out, int first, int last,
+	const float *sines, const float *cosines, int neighbours, float t)
+{
+	const __m128 zero = _mm_setzero_ps (), vt = _mm_set1_ps (t),
+		nan = _mm_set1_ps (NotANumber),
+		absMask = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+	int i = first;
+	for (; i+4 <= last; i += 4) {
+		__m128 r1 = _mm_loadu_ps (in+i);
+		// finite means x-x is zero
+		__m128 valid = _mm_cmpeq_ps (_mm_sub_ps (r1, r1), zero);
+		__m128 mark = _mm_setzero_ps ();
+		for (int k=1; k<=neighbours; k++) {
+			__m128 s = _mm_set1_ps (sines[k]), c = _mm_set1_ps (cosines[k]);
+			for (int side=-1; side<=1; side+=2) {
+				__m128 r2 = _mm_loadu_ps (in+i+side*k);
+				__m128 y = _mm_mul_ps (r2, s);
+				__m128 x = _mm_sub_ps (r1, _mm_mul_ps (r2, c));
+				__m128 hit = _mm_cmplt_ps (y, _mm_mul_ps (vt, _mm_and_ps (x, absMask)));
+				hit = _mm_and_ps (hit, _mm_cmpeq_ps (_mm_sub_ps (r2, r2), zero));
+				mark = _mm_or_ps (mark, hit);
+			}
+		}
+		mark = _mm_and_ps (mark, valid);
+		_mm_storeu_ps (out+i, _mm_or_ps (_mm_and_ps (mark, nan), _mm_andnot_ps (mark, r1)));
+	}
+	return i;
+}
+#endif
+
+
+#ifdef ROBOCAR_SIMD_NEON
+///////////////////////////////////////////////////////////////////////////////
+static inline float32x4_t voteOfNEON (float32x4_t x, float32x4_t center)
+{ return vbslq_f32 (vceqq_f32 (x, x), x, center); }
+
+
+static inline float32x4_t median3NEON (float32x4_t a, float32x4_t b, float32x4_t c)
+{ return vmaxq_f32 (vminq_f32 (a, b), vminq_f32 (vmaxq_f32 (a, b), c)); }
+
+
+static int medianNEON (const float *const *in, int window, const float *center, float *out, int count)
+{
+	const float32x4_t inf = vdupq_n_f32 (Infinity);
+	int i = 0;
+	for (; i+4 <= count; i += 4) {
+		float32x4_t ctr = vld1q_f32 (center+i);
+		float32x4_t v = voteOfNEON (ctr, inf);
+		float32x4_t a = voteOfNEON (vld1q_f32 (in[0]+i), v),
+			b = voteOfNEON (vld1q_f32 (in[1]+i), v),
+			c = voteOfNEON (vld1q_f32 (in[2]+i), v);
+		float32x4_t m;
+		if (window==3)
+			m = median3NEON (a, b, c);
+		else {
+			float32x4_t d = voteOfNEON (vld1q_f32 (in[3]+i), v),
+				e = voteOfNEON (vld1q_f32 (in[4]+i), v);
+			m = median3NEON (e,
+				vmaxq_f32 (vminq_f32 (a, b), vminq_f32 (c, d)),
+				vminq_f32 (vmaxq_f32 (a, b), vmaxq_f32 (c, d)));
+		}
+		uint32x4_t keep = vandq_u32 (vmvnq_u32 (vceqq_f32 (ctr, ctr)), vceqq_f32 (m, inf));
+		vst1q_f32 (out+i, vbslq_f32 (keep, ctr, m));
+	}
+	return i;
+}
+
+
+static int clipNEON (float *ranges, int count, float lo, float hi)
+{
+	const float32x4_t vlo = vdupq_n_f32 (lo), vhi = vdupq_n_f32 (hi),
+		inf = vdupq_n_f32 (Infinity), ninf = vdupq_n_f32 (-Infinity),
+		nan = vdupq_n_f32 (NotANumber);
+	int i = 0;
+	for (; i+4 <= count; i += 4) {
+		float32x4_t r = vld1q_f32 (ranges+i);
+		uint32x4_t out = vorrq_u32 (
+			vandq_u32 (vcltq_f32 (r, vlo), vcgtq_f32 (r, ninf)),
+			vandq_u32 (vcgtq_f32 (r, vhi), vcltq_f32 (r, inf)));
+		vst1q_f32 (ranges+i, vbslq_f32 (out, nan, r));
+	}
+	return i;
+}
+
+
+static int shadowNEON (const float *in, float *out, int first, int last,
+	const float *sines, const float *cosines, int neighbours, float t)
+{
+	const float32x4_t zero = vdupq_n_f32 (0), vt = vdupq_n_f32 (t),
+		nan = vdupq_n_f32 (NotANumber);
+	int i = first;
+	for (; i+4 <= last; i += 4) {
+		float32x4_t r1 = vld1q_f32 (in+i);
+		uint32x4_t valid = vceqq_f32 (vsubq_f32 (r1, r1), zero);
+		uint32x4_t mark = vdupq_n_u32 (0);
+		for (int k=1; k<=neighbours; k++) {
+			float32x4_t s = vdupq_n_f32 (sines[k]), c = vdupq_n_f32 (cosines[k]);
+			for (int side=-1; side<=1; side+=2) {
+				float32x4_t r2 = vld1q_f32 (in+i+side*k);
+				float32x4_t y = vmulq_f32 (r2, s);
+				float32x4_t x = vsubq_f32 (r1, vmulq_f32 (r2, c));
+				uint32x4_t hit = vcltq_f32 (y, vmulq_f32 (vt, vabsq_f32 (x)));
+				hit = vandq_u32 (hit, vceqq_f32 (vsubq_f32 (r2, r2), zero));
+				mark = vorrq_u32 (mark, hit);
+			}
+		}
+		mark = vandq_u32 (mark, valid);
+		vst1q_f32 (out+i, vbslq_f32 (mark, nan, r1));
+	}
+	return i;
+}
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+static void medianOf (const float *const *in, int window, const float *center, float *out, int count)
+{
+	int i = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simdDisabled()==false)
+		i = medianSSE2 (in, window, center, out, count);
+#elif defined(ROBOCAR_SIMD_NEON)
+	if (simdDisabled()==false)
+		i = medianNEON (in, window, center, out, count);
+#endif
+	for (; i<count; i++)
+		out[i] = medianAt (in, window, i, center[i]);
+}
+
+
+ScanFilter::ScanFilter () :
+	stages (0),
+	clipMin (0), clipMax (0),
+	medianWindow (3), temporalWindow (3),
+	shadowAngle (DefaultShadowAngle), shadowNeighbours (1),
+	historyCount (0), historyNext (0), historySize (0),
+	historyIncrement (0), historyStart (0)
+{}
+
+
+bool ScanFilter::configure (const std::string &spec)
+{
+	int newStages = 0;
+	float newClipMin = 0, newClipMax = 0;
+	int newMedian = medianWindow, newTemporal = temporalWindow;
+	float newShadow = DefaultShadowAngle;
+	int newNeighbours = 1;
+
+	std::stringstream ss (spec);
+	std::string stage;
+	while (std::getline (ss, stage, ',')) {
+		if (stage.empty())
+			continue;
+		if (stage=="clip")
+			newStages |= FILTER_CLIP;
+		else if (stage.compare (0, 5, "clip:")==0) {
+			if (sscanf (stage.c_str(), "clip:%f:%f", &newClipMin, &newClipMax) != 2 ||
+				newClipMin >= newClipMax)
+				return false;
+			newStages |= FILTER_CLIP;
+		}
+		else if (stage=="median3" || stage=="median5") {
+			newMedian = stage[6] - '0';
+			newStages |= FILTER_MEDIAN;
+		}
+		else if (stage=="temporal3" || stage=="temporal5") {
+			newTemporal = stage[8] - '0';
+			newStages |= FILTER_TEMPORAL;
+		}
+		else if (stage=="shadow")
+			newStages |= FILTER_SHADOW;
+		else if (stage.compare (0, 7, "shadow:")==0) {
+			if (sscanf (stage.c_str(), "shadow:%f:%d", &newShadow, &newNeighbours) < 1 ||
+				newShadow <= 0 || newShadow >= 90 ||
+				newNeighbours < 1 || newNeighbours > MaximumShadowNeighbours)
+				return false;
+			newStages |= FILTER_SHADOW;
+		}
+		else
+			return false;
+	}
+
+	stages = newStages;
+	clipMin = newClipMin;
+	clipMax = newClipMax;
+	medianWindow = newMedian;
+	temporalWindow = newTemporal;
+	shadowAngle = newShadow;
+	shadowNeighbours = newNeighbours;
+	reset ();
+	return true;
+}
+
+
+void ScanFilter::apply (float *ranges, int count, const hokuyo::LaserConfig &config)
+{
+	if (count <= 0)
+		return;
+
+	if (stages & FILTER_CLIP) {
+		if (clipMin < clipMax)
+			clip (ranges, count, clipMin, clipMax);
+		else
+			clip (ranges, count, config.min_range, config.max_range);
+	}
+	if (stages & FILTER_TEMPORAL)
+		temporal (ranges, count, config);
+	else
+		reset ();
+	if (stages & FILTER_MEDIAN)
+		median (ranges, count);
+	if (stages & FILTER_SHADOW)
+		shadow (ranges, count, config.ang_increment);
+}
+
+
+void ScanFilter::clip (float *ranges, int count, float lo, float hi)
+{
+	int i = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simdDisabled()==false)
+		i = clipSSE2 (ranges, count, lo, hi);
+#elif defined(ROBOCAR_SIMD_NEON)
+	if (simdDisabled()==false)
+		i = clipNEON (ranges, count, lo, hi);
+#endif
+	for (; i<count; i++) {
+		float r = ranges[i];
+		if ((r < lo && r > -Infinity) || (r > hi && r < Infinity))
+			ranges[i] = NotANumber;
+	}
+}
+
+
+/*
+ * Past scans are kept as they were before this stage; the history
+ * starts over when the scan geometry changes
+ */
+void ScanFilter::temporal (float *ranges, int count, const hokuyo::LaserConfig &config)
+{
+	int past = temporalWindow - 1;
+	if (historySize != count || historyIncrement != config.ang_increment ||
+		historyStart != config.min_angle || history.size() != (size_t)(past*count)) {
+		history.resize (past*count);
+		historySize = count;
+		historyIncrement = config.ang_increment;
+		historyStart = config.min_angle;
+		historyCount = 0;
+	}
+	if (historyCount==0)
+		historyNext = 0;
+
+	scratch.assign (ranges, ranges+count);
+	if (historyCount==past) {
+		const float *in[5];
+		in[0] = &scratch[0];
+		for (int k=0; k<past; k++)
+			in[k+1] = &history[k*count];
+		medianOf (in, temporalWindow, &scratch[0], ranges, count);
+	}
+
+	memcpy (&history[historyNext*count], &scratch[0], count*sizeof(float));
+	historyNext = (historyNext + 1) % past;
+	if (historyCount < past)
+		historyCount++;
+}
+
+
+// Beams at both ends are kept as they are
+void ScanFilter::median (float *ranges, int count)
+{
+	int half = medianWindow / 2;
+	if (count < medianWindow)
+		return;
+	scratch.assign (ranges, ranges+count);
+
+	const float *in[5];
+	for (int k=0; k<medianWindow; k++)
+		in[k] = &scratch[k];
+	medianOf (in, medianWindow, &scratch[half], ranges+half, count - 2*half);
+}
+
+
+/*
+ * A point is a shadow when the line to one of its neighbours is
+ * nearly parallel to the beam; tan of angle between them is
+ * y/|x| with neighbour at (x, y) seen from the point.
+ */
+void ScanFilter::shadow (float *ranges, int count, float increment)
+{
+	int n = shadowNeighbours;
+	if (count <= 2*n)
+		return;
+
+	float sines[MaximumShadowNeighbours+1], cosines[MaximumShadowNeighbours+1];
+	for (int k=1; k<=n; k++) {
+		sines[k] = sin (k*increment);
+		cosines[k] = cos (k*increment);
+	}
+	float t = tan (shadowAngle * M_PI / 180);
+
+	scratch.assign (ranges, ranges+count);
+	const float *in = &scratch[0];
+
+	int i = n;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+	if (simdDisabled()==false)
+		i = shadowSSE2 (in, ranges, n, count-n, sines, cosines, n, t);
+#elif defined(ROBOCAR_SIMD_NEON)
+	if (simdDisabled()==false)
+		i = shadowNEON (in, ranges, n, count-n, sines, cosines, n, t);
+#endif
+
+	// the rest, and both ends with neighbours on one side only
+	for (int j=0; j<count; j++) {
+		if (j >= n && j < i)
+			continue;
+		bool mark = false;
+		for (int k=1; k<=n && mark==false; k++) {
+			if (j-k >= 0 && isShadow (in[j], in[j-k], sines[k], cosines[k], t))
+				mark = true;
+			if (j+k < count && isShadow (in[j], in[j+k], sines[k], cosines[k], t))
+				mark = true;
+		}
+		if (mark)
+			ranges[j] = NotANumber;
+	}
+}
+
+} /* namespace Robocar */
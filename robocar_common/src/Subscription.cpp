@@ -0,0 +1,34 @@
+/*
+ * Subscription.cpp
+ */
+
+#include "Subscription.h"
+#include "MessageRegisters.h"
+#include <cstring>
+
+
+namespace Robocar {
+
+
+shared_ptr<Message> Subscription::create (const std::vector<uint8_t> &categories)
+{
+	shared_ptr<uint8_t> buf (new uint8_t [categories.size()+1]);
+	if (categories.size() > 0)
+		memcpy (buf.get(), categories.data(), categories.size());
+	return Message::create (SubscriptionMessageCategory, categories.size(), buf);
+}
+
+
+SubscriptionMask Subscription::parse (Message &msg)
+{
+	SubscriptionMask mask = 0;
+	uint8_t *categories = (uint8_t*)msg.getContent();
+
+	for (uint32_t i=0; i<msg.getSize(); i++) {
+		if (categories[i] < 8*sizeof(SubscriptionMask))
+			mask |= (1u << categories[i]);
+	}
+	return mask;
+}
+
+} /* namespace Robocar */
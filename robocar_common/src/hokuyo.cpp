@@ -35,6 +35,8 @@
 #include <time.h>
 
 #include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 
 //#include "ros/console.h"
 
@@ -75,7 +77,8 @@ FILE *logfile;
 hokuyo::Laser::Laser() :
                       dmin_(0), dmax_(0), ares_(0), amin_(0), amax_(0), afrt_(0), rate_(0),
                       wrapped_(0), last_time_(0), time_repeat_count_(0), offset_(0),
-                      laser_fd_(-1)
+                      laser_fd_(-1), low_latency_(false), legacy_decoder_(false),
+                      read_buf_start(0), read_buf_end(0)
 { 
 #ifdef USE_LOG_FILE
   if (!logfile)
@@ -146,6 +149,18 @@ hokuyo::Laser::open(const char * port_name)
     tcflush (laser_fd_, TCIFLUSH);
     if (tcsetattr (laser_fd_, TCSANOW, &newtio) < 0)
       HOKUYO_EXCEPT(hokuyo::Exception, "Unable to set serial port attributes. The port you specified (%s) may not be a serial port.", port_name); /// @todo tcsetattr returns true if at least one attribute was set. Hence, we might not have set everything on success.
+
+    if (low_latency_)
+    {
+      // Without this, some USB-serial drivers hold received bytes for
+      // up to 16ms before waking the reader
+      struct serial_struct serinfo;
+      if (ioctl(laser_fd_, TIOCGSERIAL, &serinfo) == 0)
+      {
+        serinfo.flags |= ASYNC_LOW_LATENCY;
+        ioctl(laser_fd_, TIOCSSERIAL, &serinfo);
+      }
+    }
     usleep (200000);
 
     // Some models (04LX) need to be told to go into SCIP2 mode...
@@ -181,6 +196,30 @@ hokuyo::Laser::open(const char * port_name)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+void
+hokuyo::Laser::attach(int fd)
+{
+  if (portOpen())
+    close();
+
+  laser_fd_ = fd;
+  read_buf_start = read_buf_end = 0;
+  fcntl(laser_fd_, F_SETFL, fcntl(laser_fd_, F_GETFL, 0) | O_NONBLOCK);
+
+  try
+  {
+    querySensorConfig();
+  }
+  catch (hokuyo::Exception& e)
+  {
+    ::close(laser_fd_);
+    laser_fd_ = -1;
+    throw e;
+  }
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 void hokuyo::Laser::reset ()
 {
@@ -322,7 +361,10 @@ hokuyo::Laser::laserWrite(const char* msg)
 int
 hokuyo::Laser::laserFlush()
 {
-  int retval = tcflush(laser_fd_, TCIOFLUSH);
+  int retval = 0;
+  // Attached pipes and sockets have nothing to flush
+  if (isatty(laser_fd_))
+    retval = tcflush(laser_fd_, TCIOFLUSH);
   if (retval != 0)
     HOKUYO_EXCEPT(hokuyo::Exception, "tcflush failed");
   read_buf_start = 0;
@@ -333,80 +375,117 @@ hokuyo::Laser::laserFlush()
 
 
 ///////////////////////////////////////////////////////////////////////////////
-int 
-hokuyo::Laser::laserReadline(char *buf, int len, int timeout)
+int
+hokuyo::Laser::laserReadlineView(const char **line, int timeout)
 {
-  int current=0;
-
   struct pollfd ufd[1];
   int retval;
   ufd[0].fd = laser_fd_;
   ufd[0].events = POLLIN;
-    
+
   if (timeout == 0)
     timeout = -1; // For compatibility with former behavior, 0 means no timeout. For poll, negative means no timeout.
 
+  // Bytes already searched for end of line
+  int searched = 0;
+
   while (true)
   {
-    if (read_buf_start == read_buf_end) // Need to read?
+    char *start = &read_buf[read_buf_start];
+    char *eol = (char*)memchr(start + searched, '\n', read_buf_end - read_buf_start - searched);
+    if (eol != NULL)
     {
-      if ((retval = poll(ufd, 1, timeout)) < 0)
-        HOKUYO_EXCEPT(hokuyo::Exception, "poll failed   --  error = %d: %s", errno, strerror(errno));
+      int len = eol - start + 1;
+      read_buf_start += len;
+      *line = start;
+#ifdef USE_LOG_FILE
+      long long outtime = timeHelper();
+      fprintf(logfile, "In: %lli.%09lli %.*s", outtime / 1000000000L, outtime % 1000000000L, len, start);
+#endif
+      return len;
+    }
+    searched = read_buf_end - read_buf_start;
 
-      if (retval == 0)
-        HOKUYO_EXCEPT(hokuyo::TimeoutException, "timeout reached");
-      
-      if (ufd[0].revents & POLLERR)
-        HOKUYO_EXCEPT(hokuyo::Exception, "error on socket, possibly unplugged");
-      
-      int bytes = read(laser_fd_, read_buf, sizeof(read_buf));
-      if (bytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
-        HOKUYO_EXCEPT(hokuyo::Exception, "read failed");
+    // Incomplete line; move it to front to make room for the rest
+    if (read_buf_start != 0)
+    {
+      memmove(read_buf, start, searched);
       read_buf_start = 0;
-      read_buf_end = bytes;
+      read_buf_end = searched;
     }
-       
-    while (read_buf_end != read_buf_start)
+    if (read_buf_end == READ_BUF_SIZE)
     {
-      if (current == len - 1)
-      {
-        buf[current] = 0;
-        HOKUYO_EXCEPT(hokuyo::Exception, "buffer filled without end of line being found");
-      }
+      read_buf_start = read_buf_end = 0;
+      HOKUYO_EXCEPT(hokuyo::Exception, "buffer filled without end of line being found");
+    }
 
-      buf[current] = read_buf[read_buf_start++];
-      if (buf[current++] == '\n')
-      {
-        buf[current] = 0;
-        return current;
-      }
+    if ((retval = poll(ufd, 1, timeout)) < 0)
+      HOKUYO_EXCEPT(hokuyo::Exception, "poll failed   --  error = %d: %s", errno, strerror(errno));
+
+    if (retval == 0)
+      HOKUYO_EXCEPT(hokuyo::TimeoutException, "timeout reached");
+
+    if (ufd[0].revents & POLLERR)
+      HOKUYO_EXCEPT(hokuyo::Exception, "error on socket, possibly unplugged");
+
+    int bytes = read(laser_fd_, &read_buf[read_buf_end], READ_BUF_SIZE - read_buf_end);
+    if (bytes == -1)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        HOKUYO_EXCEPT(hokuyo::Exception, "read failed");
+      bytes = 0;
     }
+    if (bytes == 0 && (ufd[0].revents & POLLHUP))
+      HOKUYO_EXCEPT(hokuyo::Exception, "device closed, possibly unplugged");
+    read_buf_end += bytes;
+  }
+}
 
-#ifdef USE_LOG_FILE
-    long long outtime = timeHelper();
-    fprintf(logfile, "In: %lli.%09lli %s", outtime / 1000000000L, outtime % 1000000000L, buf);
-#endif
+
+///////////////////////////////////////////////////////////////////////////////
+int 
+hokuyo::Laser::laserReadline(char *buf, int len, int timeout)
+{
+  const char *line;
+  int bytes = laserReadlineView(&line, timeout);
+
+  if (bytes > len - 1)
+  {
+    memcpy(buf, line, len - 1);
+    buf[len - 1] = 0;
+    HOKUYO_EXCEPT(hokuyo::Exception, "buffer filled without end of line being found");
   }
+
+  memcpy(buf, line, bytes);
+  buf[bytes] = 0;
+  return bytes;
 }
 
 
 char*
 hokuyo::Laser::laserReadlineAfter(char* buf, int len, const char* str, int timeout)
 {
-  buf[0] = 0;
-  char* ind = &buf[0];
-
-  int bytes_read = 0;
+  int str_len = strlen(str);
+  const char *line;
+  int bytes_read;
   int skipped = 0;
 
-  while ((strncmp(buf, str, strlen(str))) != 0) {
-    bytes_read = laserReadline(buf,len,timeout);
+  for (;;)
+  {
+    bytes_read = laserReadlineView(&line, timeout);
+    if (bytes_read >= str_len && memcmp(line, str, str_len) == 0)
+      break;
 
     if ((skipped += bytes_read) > MAX_SKIPPED)
       HOKUYO_EXCEPT(hokuyo::Exception, "too many bytes skipped while searching for match");
   }
 
-  return ind += strlen(str);
+  if (bytes_read > len - 1)
+    HOKUYO_EXCEPT(hokuyo::Exception, "buffer filled without end of line being found");
+  memcpy(buf, line, bytes_read);
+  buf[bytes_read] = 0;
+
+  return buf + str_len;
 }
 
 
@@ -443,11 +522,44 @@ hokuyo::Laser::querySensorConfig()
     
   ind = laserReadlineAfter(buf,100,"SCAN:",-1);
   sscanf(ind, "%d", &rate_);
-    
+
+  buildErrorTable();
   return;
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+void
+hokuyo::Laser::buildErrorTable()
+{
+  const float inf = std::numeric_limits<float>::infinity();
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+
+  for (uint32_t code = 0; code < ERROR_CODES; code++)
+    error_table_[code] = ((float)code)/1000.0;
+
+  if (dmax_ > 20000)
+  {
+    // UTM-30LX, see the SCIP2.0 reference on page 12, Table 4
+    error_table_[1] = inf;  // No Object in Range
+    error_table_[2] = -inf; // Object is too near (Internal Error)
+    error_table_[3] = nan;  // Measurement Error (May be due to interference)
+    error_table_[4] = nan;  // Object out of range (at the near end)
+    error_table_[5] = nan;  // Other errors
+  }
+  else
+  {
+    // URG-04LX UBG-04LX-F01 UHG-08LX, Table 3
+    error_table_[0] = inf;  // Detected object is possibly at 22m
+    error_table_[1] = nan;  // Reflected light has low intensity
+    error_table_[2] = nan;
+    error_table_[6] = inf;  // Detected object is possibly at 5.7m
+    for (uint32_t code = 7; code < ERROR_CODES; code++)
+      error_table_[code] = nan;
+  }
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 bool
 hokuyo::Laser::checkSum(const char* buf, int buf_len)
@@ -499,9 +611,86 @@ hokuyo::Laser::readTime(int timeout)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+int
+hokuyo::Laser::readData(hokuyo::LaserScan& scan, bool has_intensity, int timeout, float *data)
+{
+  if (legacy_decoder_)
+  {
+    readDataLegacy(scan, has_intensity, timeout);
+    int count = scan.ranges.size();
+    if (data != NULL)
+    {
+      std::copy(scan.ranges.begin(), scan.ranges.end(), data);
+      std::copy(scan.intensities.begin(), scan.intensities.end(), data + count);
+      scan.ranges.clear();
+      scan.intensities.clear();
+    }
+    return count;
+  }
+
+  int data_size = 3;
+  if (has_intensity)
+    data_size = 6;
+
+  scan.self_time_stamp = readTime(timeout);
+
+  // Join data blocks first; a value may be split across two lines
+  const char *line;
+  int bytes;
+  int data_len = 0;
+
+  while ((bytes = laserReadlineView(&line, timeout)) != 1) // \n\n ends the scan
+  {
+    if (!checkSum(line, bytes))
+      HOKUYO_EXCEPT(hokuyo::CorruptedDataException, "Checksum failed on data read.");
+
+    bytes -= 2;
+    if (data_len + bytes > (int)sizeof(data_buf_) - DECODE_PADDING)
+      HOKUYO_EXCEPT(hokuyo::CorruptedDataException, "Got more readings than expected");
+    memcpy(&data_buf_[data_len], line, bytes);
+    data_len += bytes;
+  }
+
+  int count = data_len / data_size;
+  if (count > (int)MAX_READINGS)
+    HOKUYO_EXCEPT(hokuyo::CorruptedDataException, "Got more readings than expected");
+
+  decodeValues(data_buf_, count * data_size / 3, values_);
+
+  float *ranges = data;
+  float *intensities = (data != NULL ? data + count : NULL);
+  if (data == NULL)
+  {
+    scan.ranges.reserve(MAX_READINGS);
+    scan.ranges.resize(count);
+    ranges = scan.ranges.data();
+    if (has_intensity)
+    {
+      scan.intensities.reserve(MAX_READINGS);
+      scan.intensities.resize(count);
+      intensities = scan.intensities.data();
+    }
+  }
+
+  if (has_intensity)
+  {
+    // Ranges and intensities are interleaved; compact ranges in place
+    for (int i = 0; i < count; i++)
+    {
+      intensities[i] = values_[2*i + 1];
+      values_[i] = values_[2*i];
+    }
+  }
+
+  valuesToRanges(values_, count, error_table_, ranges);
+  return count;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 void
-hokuyo::Laser::readData(hokuyo::LaserScan& scan, bool has_intensity, int timeout)
+hokuyo::Laser::readDataLegacy(hokuyo::LaserScan& scan, bool has_intensity, int timeout)
 {
   scan.ranges.clear();
   scan.intensities.clear();
@@ -796,8 +985,36 @@ hokuyo::Laser::isIntensitySupported()
   } 
 }
 
+// Fixed-width, zero-padded decimal field of a SCIP2.0 echo
+static int parseDecimal(const char *field, int width)
+{
+  int value = 0;
+  for (int i = 0; i < width && field[i] >= '0' && field[i] <= '9'; i++)
+    value = value*10 + (field[i] - '0');
+  return value;
+}
+
 int
 hokuyo::Laser::serviceScan(hokuyo::LaserScan& scan, int timeout)
+{
+  int ranges;
+  bool intensity;
+  return readScan(scan, NULL, ranges, intensity, timeout);
+}
+
+int
+hokuyo::Laser::serviceScan(hokuyo::LaserScan& scan, float *data, int &ranges, int &intensities, int timeout)
+{
+  bool intensity = false;
+  ranges = intensities = 0;
+  int status = readScan(scan, data, ranges, intensity, timeout);
+  if (status == 0 && intensity)
+    intensities = ranges;
+  return status;
+}
+
+int
+hokuyo::Laser::readScan(hokuyo::LaserScan& scan, float *data, int &ranges, bool &intensity, int timeout)
 {
   if (!portOpen())
     HOKUYO_EXCEPT(hokuyo::Exception, "Port not open.");
@@ -808,14 +1025,14 @@ hokuyo::Laser::serviceScan(hokuyo::LaserScan& scan, int timeout)
 
   char buf[100];
 
-  bool intensity = false;
+  intensity = false;
   int min_i;
   int max_i;
   int cluster;
   int skip;
-  int left;
 
   char* ind;
+  const char* line;
 
   int status = -1;
 
@@ -832,15 +1049,17 @@ hokuyo::Laser::serviceScan(hokuyo::LaserScan& scan, int timeout)
 
     ind++;
 
-    sscanf(ind, "%4d%4d%2d%1d%2d", &min_i, &max_i, &cluster, &skip, &left);  
-    laserReadline(buf,100,timeout);
-
-    buf[4] = 0;
+    // Echo is MD/ME followed by start(4) end(4) cluster(2) skip(1) count(2);
+    // scans remaining in count aren't needed
+    min_i = parseDecimal(ind, 4);
+    max_i = parseDecimal(ind + 4, 4);
+    cluster = parseDecimal(ind + 8, 2);
+    skip = parseDecimal(ind + 10, 1);
 
-    if (!checkSum(buf, 4))
-      HOKUYO_EXCEPT(hokuyo::CorruptedDataException, "Checksum failed on status code: %s", buf);
+    if (laserReadlineView(&line, timeout) < 4 || !checkSum(line, 4))
+      HOKUYO_EXCEPT(hokuyo::CorruptedDataException, "Checksum failed on status code: %.2s", line);
 
-    sscanf(buf, "%2d", &status);
+    status = parseDecimal(line, 2);
 
     if (status != 99)
       return status;
@@ -855,7 +1074,7 @@ hokuyo::Laser::serviceScan(hokuyo::LaserScan& scan, int timeout)
   scan.config.min_range  =  dmin_ / 1000.0;
   scan.config.max_range  =  dmax_ / 1000.0;
 
-  readData(scan, intensity, timeout);
+  ranges = readData(scan, intensity, timeout, data);
 
   long long inc = (long long)(min_i * scan.config.time_increment * 1000000000);
 
@@ -0,0 +1,163 @@
+/*
+ * hokuyo_decode.cpp
+ */
+
+#include "hokuyo_decode.h"
+#include "simd.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+static int
+decodeValuesScalar(const char *src, int count, uint32_t *dst)
+{
+  for (int i = 0; i < count; i++, src += 3)
+    dst[i] = ((src[0]-0x30) << 12) | ((src[1]-0x30) << 6) | (src[2]-0x30);
+  return count;
+}
+
+
+#ifdef ROBOCAR_SIMD_X86
+///////////////////////////////////////////////////////////////////////////////
+// Four values per 12 bytes. Characters of each value are shuffled into
+// one 32-bit lane as [c2, c1, 0, c0], then two multiply-adds give
+// c2 + 64*c1 + 4096*c0.
+ROBOCAR_TARGET("ssse3")
+static int
+decodeValuesSSSE3(const char *src, int count, uint32_t *dst)
+{
+  const __m128i zero = _mm_set1_epi8(0x30);
+  const __m128i lanes = _mm_setr_epi8(2, 1, -1, 0, 5, 4, -1, 3, 8, 7, -1, 6, 11, 10, -1, 9);
+  const __m128i byte_weights = _mm_setr_epi8(1, 64, 0, 64, 1, 64, 0, 64, 1, 64, 0, 64, 1, 64, 0, 64);
+  const __m128i pair_weights = _mm_setr_epi16(1, 64, 1, 64, 1, 64, 1, 64);
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128i chars = _mm_loadu_si128((const __m128i*)(src + 3*i));
+    chars = _mm_shuffle_epi8(_mm_sub_epi8(chars, zero), lanes);
+    __m128i pairs = _mm_maddubs_epi16(chars, byte_weights);
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_madd_epi16(pairs, pair_weights));
+  }
+  return i;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Division rather than multiplication by 0.001, so results are identical
+// to the scalar (float)v/1000.0 for every 18-bit value
+static int
+valuesToRangesSSE2(const uint32_t *values, int count, const float *error_table, float *ranges)
+{
+  const __m128 thousand = _mm_set1_ps(1000.0f);
+  const __m128i codes = _mm_set1_epi32(hokuyo::ERROR_CODES);
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+    _mm_storeu_ps(ranges + i, _mm_div_ps(_mm_cvtepi32_ps(v), thousand));
+
+    // Error codes are rare; patch them one by one
+    int errors = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, codes)));
+    for (int k = 0; errors != 0; k++, errors >>= 1)
+      if (errors & 1)
+        ranges[i + k] = error_table[values[i + k]];
+  }
+  return i;
+}
+#endif
+
+
+#ifdef ROBOCAR_SIMD_NEON
+///////////////////////////////////////////////////////////////////////////////
+// Sixteen values per 48 bytes; vld3 separates the three characters
+static int
+decodeValuesNEON(const char *src, int count, uint32_t *dst)
+{
+  const uint8x16_t zero = vdupq_n_u8(0x30);
+
+  int i = 0;
+  for (; i + 16 <= count; i += 16)
+  {
+    uint8x16x3_t c = vld3q_u8((const uint8_t*)src + 3*i);
+    uint8x16_t c0 = vsubq_u8(c.val[0], zero);
+    uint8x16_t c1 = vsubq_u8(c.val[1], zero);
+    uint8x16_t c2 = vsubq_u8(c.val[2], zero);
+
+    // low 12 bits fit in 16-bit lanes
+    uint16x8_t lo_a = vorrq_u16(vshlq_n_u16(vmovl_u8(vget_low_u8(c1)), 6), vmovl_u8(vget_low_u8(c2)));
+    uint16x8_t lo_b = vorrq_u16(vshlq_n_u16(vmovl_u8(vget_high_u8(c1)), 6), vmovl_u8(vget_high_u8(c2)));
+    uint16x8_t hi_a = vmovl_u8(vget_low_u8(c0));
+    uint16x8_t hi_b = vmovl_u8(vget_high_u8(c0));
+
+    vst1q_u32(dst + i,      vorrq_u32(vshll_n_u16(vget_low_u16(hi_a), 12),  vmovl_u16(vget_low_u16(lo_a))));
+    vst1q_u32(dst + i + 4,  vorrq_u32(vshll_n_u16(vget_high_u16(hi_a), 12), vmovl_u16(vget_high_u16(lo_a))));
+    vst1q_u32(dst + i + 8,  vorrq_u32(vshll_n_u16(vget_low_u16(hi_b), 12),  vmovl_u16(vget_low_u16(lo_b))));
+    vst1q_u32(dst + i + 12, vorrq_u32(vshll_n_u16(vget_high_u16(hi_b), 12), vmovl_u16(vget_high_u16(lo_b))));
+  }
+  return i;
+}
+
+
+#ifdef __aarch64__
+///////////////////////////////////////////////////////////////////////////////
+static int
+valuesToRangesNEON(const uint32_t *values, int count, const float *error_table, float *ranges)
+{
+  const float32x4_t thousand = vdupq_n_f32(1000.0f);
+  const uint32x4_t codes = vdupq_n_u32(hokuyo::ERROR_CODES);
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    uint32x4_t v = vld1q_u32(values + i);
+    vst1q_f32(ranges + i, vdivq_f32(vcvtq_f32_u32(v), thousand));
+
+    if (vmaxvq_u32(vcltq_u32(v, codes)) != 0)
+      for (int k = 0; k < 4; k++)
+        if (values[i + k] < hokuyo::ERROR_CODES)
+          ranges[i + k] = error_table[values[i + k]];
+  }
+  return i;
+}
+#endif
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+void
+hokuyo::decodeValues(const char *src, int count, uint32_t *dst)
+{
+  int done = 0;
+#if defined(ROBOCAR_SIMD_X86)
+  static const bool ssse3 = Robocar::cpuHasSSSE3();
+  if (ssse3)
+    done = decodeValuesSSSE3(src, count, dst);
+#elif defined(ROBOCAR_SIMD_NEON)
+  if (!Robocar::simdDisabled())
+    done = decodeValuesNEON(src, count, dst);
+#endif
+  decodeValuesScalar(src + 3*done, count - done, dst + done);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+void
+hokuyo::valuesToRanges(const uint32_t *values, int count, const float *error_table, float *ranges)
+{
+  int done = 0;
+#if defined(ROBOCAR_SIMD_X86) && defined(__SSE2__)
+  if (!Robocar::simdDisabled())
+    done = valuesToRangesSSE2(values, count, error_table, ranges);
+#elif defined(ROBOCAR_SIMD_NEON) && defined(__aarch64__)
+  if (!Robocar::simdDisabled())
+    done = valuesToRangesNEON(values, count, error_table, ranges);
+#endif
+  for (int i = done; i < count; i++)
+  {
+    if (values[i] < ERROR_CODES)
+      ranges[i] = error_table[values[i]];
+    else
+      ranges[i] = ((float)values[i])/1000.0;
+  }
+}
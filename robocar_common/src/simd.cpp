@@ -0,0 +1,18 @@
+/*
+ * simd.cpp
+ */
+
+#include "simd.h"
+#include <stdlib.h>
+
+
+namespace Robocar {
+
+
+bool simdDisabled ()
+{
+	static const bool disabled = (getenv ("ROBOCAR_NO_SIMD") != NULL);
+	return disabled;
+}
+
+} /* namespace Robocar */
@@ -11,6 +11,9 @@
 #include <iostream>
 #include <boost/shared_ptr.hpp>
 #include "NetpbmWriter.h"
+#include "ControlMessage.h"
+#include "Report.h"
+#include <time.h>
 
 
 using std::cerr;
@@ -22,7 +25,13 @@ namespace Robocar {
 
 CameraDriver::CameraDriver (MessageQueue *_msgq) :
 	srvQueue (_msgq),
-	doStop (false), doQuit(false)
+	doStop (false), doQuit(false),
+	pendingFrameRate (CameraFrameRate),
+	pendingImageOutput (zmp::zrc::SOF_NORMALIZED_STEREO),
+	reconfigure (false),
+	changeThreshold (0),
+	lastReport (0),
+	stillFrames (0), savedBytes (0)
 {
 	this->init ();
 	startSignal = new semaphore (0);
@@ -49,6 +58,62 @@ void CameraDriver::init ()
 }
 
 
+bool CameraDriver::setParameter (uint8_t parameter, int32_t value)
+{
+	switch (parameter) {
+	case CONTROL_FRAME_RATE:
+		if (value < 1 || value > 30)
+			return false;
+		pendingFrameRate = value;
+		break;
+	case CONTROL_IMAGE_OUTPUT:
+		if (value < 0 || value > zmp::zrc::SOF_INPUT_R_HALF)
+			return false;
+		pendingImageOutput = value;
+		break;
+	// takes effect at once
+	case CONTROL_CHANGE_THRESHOLD:
+		if (value < 0 || value > 255)
+			return false;
+		changeThreshold = value;
+		return true;
+	default:
+		return false;
+	}
+	reconfigure = true;
+	return true;
+}
+
+
+bool CameraDriver::getParameter (uint8_t parameter, int32_t &value)
+{
+	switch (parameter) {
+	case CONTROL_FRAME_RATE:
+		value = pendingFrameRate; break;
+	case CONTROL_IMAGE_OUTPUT:
+		value = pendingImageOutput; break;
+	case CONTROL_CHANGE_THRESHOLD:
+		value = changeThreshold; break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+
+void CameraDriver::applyParameters ()
+{
+	reconfigure = false;
+	intervalPerFrame = (long int)(1e6/(float)pendingFrameRate);
+	zmp::zrc::STEREO_ALG_OUTPUT_IMAGE_ID output =
+		(zmp::zrc::STEREO_ALG_OUTPUT_IMAGE_ID)pendingImageOutput;
+	if (ipm.GetCurrentImageOutput() != output) {
+		if (ipm.SelectImageOutput (output)==false)
+			debug ("CameraDriver: unable to select image output %d", (int)output);
+	}
+}
+
+
 void CameraDriver::start ()
 {
 	doStop = false;
@@ -72,11 +137,19 @@ void CameraDriver::work()
 
 	while (doQuit==false) {
 		while (doStop==false) {
+			if (reconfigure==true)
+				applyParameters ();
 			if (ipm.CollectImage ()) {
-				// XXX: need better way to determine resolution
-				shared_ptr<ImageMessage> image (new ImageMessage(320, 240, ipm));
-				Message *msg = (Message*)image.get();
-				srvQueue->push (image);
+				if (srvQueue->isEnabled()==false) {
+					usleep (intervalPerFrame);
+					continue;
+				}
+				int width = 320, height = 240;
+				ipm.GetCurrentImageOutput (&width, &height);
+				shared_ptr<ImageMessage> image (new ImageMessage(width, height, ipm));
+				if (unchanged (*image)==false)
+					srvQueue->push (image);
+				reportStatistics ();
 				//debug ("CameraDriver: Pushed image");
 			}
 			else {
@@ -92,6 +165,53 @@ void CameraDriver::work()
 }
 
 
+/*
+ * Both planes, when the output has two, are compared as one image
+ * of twice the height
+ */
+bool CameraDriver::unchanged (ImageMessage &image)
+{
+	if (changeThreshold != detector.getThreshold())
+		detector.setThreshold (changeThreshold);
+	if (detector.isEnabled()==false || image.getWidth()==0)
+		return false;
+
+	timeval tv = image.getTimestamp ();
+	double t = tv.tv_sec + tv.tv_usec*1e-6;
+	int rows = (image.getSize() - 2*sizeof(uint16_t)) / image.getWidth();
+	if (detector.keyframeDue (t) || detector.differs (image.getData(), image.getWidth(), rows)) {
+		detector.keep (image.getData(), image.getWidth(), rows, t);
+		return false;
+	}
+	stillFrames++;
+	savedBytes += image.getSize ();
+	return true;
+}
+
+
+void CameraDriver::reportStatistics ()
+{
+	struct timespec t;
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	double now = t.tv_sec + t.tv_nsec * 1e-9;
+	if (lastReport==0)
+		lastReport = now;
+	if (now - lastReport < StereoReportInterval)
+		return;
+
+	// nothing else is counted yet
+	if (changeThreshold > 0) {
+		Report rep (CameraDriverMessageCategory, REPORT_STATISTICS);
+		rep.add ("frames_static", stillFrames);
+		rep.add ("bytes_saved", savedBytes);
+		srvQueue->push (rep.toMessage ());
+	}
+	stillFrames = 0;
+	savedBytes = 0;
+	lastReport = now;
+}
+
+
 /*
  * Robocar's camera can only capture grayscale image, so it's
  * safe to say that byte per pixel=1
@@ -102,7 +222,7 @@ ImageMessage::ImageMessage (int w, int h, zmp::zrc::IpmManager &ipm) :
 {
 	int imgbytes = ipm.ImageLength();
 	int msgsize = imgbytes + 2*sizeof(uint16_t);
-	content = shared_ptr<uint8_t> (new uint8_t [imgbytes]);
+	content = shared_ptr<uint8_t> (new uint8_t [msgsize]);
 	uint16_t *pictsize = (uint16_t*)content.get();
 	pictsize[0] = (uint16_t)w;
 	pictsize[1] = (uint16_t)h;
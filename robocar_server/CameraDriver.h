@@ -13,6 +13,7 @@
 #include "MessageQueue.h"
 #include "zmp/IpmManager.h"
 #include "MessageRegisters.h"
+#include "ChangeDetector.h"
 #include <boost/thread.hpp>
 #include <boost/interprocess/sync/interprocess_semaphore.hpp>
 #include <exception>
@@ -25,6 +26,8 @@ using boost::thread;
 typedef boost::interprocess::interprocess_semaphore semaphore;
 
 const int CameraFrameRate = 7;
+// Seconds between statistics reports
+#define StereoReportInterval 5
 
 
 namespace Robocar {
@@ -38,6 +41,7 @@ public:
 	//_messageBuffer *serialize ();
 	//static ImageMessage* deserialize (Message* msg);
 	inline uint8_t* getData () { return data; }
+	inline int getWidth () { return width; }
 
 private:
 	int width, height;
@@ -65,6 +69,12 @@ public:
 
 	void stop ();
 
+	// Runtime reconfiguration, applied at next frame
+	bool setParameter (uint8_t parameter, int32_t value);
+	bool getParameter (uint8_t parameter, int32_t &value);
+
+	thread *getThread () { return drvThread; }
+
 private:
 	MessageQueue *srvQueue;
 	boost::thread *drvThread;
@@ -72,6 +82,20 @@ private:
 	boost::interprocess::interprocess_semaphore *startSignal;
 	zmp::zrc::IpmManager ipm;
 	useconds_t intervalPerFrame;
+
+	volatile int pendingFrameRate, pendingImageOutput;
+	volatile bool reconfigure;
+	void applyParameters ();
+
+	// CONTROL_CHANGE_THRESHOLD, given to detector at next frame
+	volatile int changeThreshold;
+	ChangeDetector detector;
+	// statistics since last report
+	double lastReport;
+	uint32_t stillFrames;
+	double savedBytes;
+	bool unchanged (ImageMessage &image);
+	void reportStatistics ();
 };
 
 } /* namespace Robocar */
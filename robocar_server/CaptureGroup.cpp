@@ -0,0 +1,115 @@
+/*
+ * CaptureGroup.cpp
+ */
+
+#include "CaptureGroup.h"
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <algorithm>
+
+
+namespace Robocar {
+
+
+static double monotonicMs ()
+{
+	struct timespec t;
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1e3 + t.tv_nsec*1e-6;
+}
+
+
+CaptureGroup::CaptureGroup (const std::vector<V4L2Capture*> &_cameras, uint64_t _tolerance) :
+	cameras (_cameras),
+	latest (_cameras.size()),
+	pending (_cameras.size(), false),
+	tolerance (_tolerance)
+{}
+
+
+void CaptureGroup::reset ()
+{
+	for (size_t i=0; i<cameras.size(); i++) {
+		// leased buffers go back to their camera
+		latest[i].data.reset ();
+		pending[i] = false;
+	}
+}
+
+
+/*
+ * Drops frames too old to be matched with the newest one,
+ * and tells if the rest make a set
+ */
+bool CaptureGroup::complete ()
+{
+	uint64_t newest = 0;
+	for (size_t i=0; i<cameras.size(); i++)
+		if (pending[i])
+			newest = std::max (newest, latest[i].timestamp);
+
+	bool all = true;
+	for (size_t i=0; i<cameras.size(); i++) {
+		if (pending[i] && latest[i].timestamp + tolerance < newest) {
+			latest[i].data.reset ();
+			pending[i] = false;
+		}
+		all = all && pending[i];
+	}
+	return all;
+}
+
+
+bool CaptureGroup::grab (std::vector<V4L2Frame> &frames, int timeoutMs)
+{
+	std::vector<struct pollfd> fds (cameras.size());
+	double deadline = monotonicMs () + timeoutMs;
+
+	while (true) {
+		int wait = (int)(deadline - monotonicMs ());
+		if (wait < 0)
+			wait = 0;
+		for (size_t i=0; i<cameras.size(); i++) {
+			fds[i].fd = cameras[i]->getFd ();
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+
+		int r = poll (&fds[0], fds.size(), wait);
+		if (r == -1) {
+			if (errno==EINTR)
+				return false;
+			throw V4L2Exception (std::string ("poll error: ") + strerror (errno));
+		}
+
+		for (size_t i=0; i<cameras.size(); i++) {
+			if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+				throw V4L2Exception (cameras[i]->getDevice() + ": device error");
+			if ((fds[i].revents & POLLIN)==0)
+				continue;
+			// only the newest frame is of use
+			V4L2Frame frame;
+			while (cameras[i]->read (frame)) {
+				latest[i] = frame;
+				pending[i] = true;
+			}
+		}
+
+		if (complete ()) {
+			frames = latest;
+			reset ();
+			return true;
+		}
+
+		// cameras out of step time out as well
+		if (r == 0 || monotonicMs () >= deadline) {
+			for (size_t i=0; i<cameras.size(); i++)
+				if (pending[i]==false)
+					throw V4L2Timeout (cameras[i]->getDevice());
+		}
+	}
+}
+
+} /* namespace Robocar */
@@ -0,0 +1,53 @@
+/*
+ * CaptureGroup.h
+ */
+
+#ifndef ROBOCAR_SERVER_CAPTUREGROUP_H_
+#define ROBOCAR_SERVER_CAPTUREGROUP_H_
+
+
+#include "V4L2Capture.h"
+#include <vector>
+
+
+namespace Robocar {
+
+
+/*
+ * Takes frames of several cameras from one thread, and gives
+ * them out in sets taken at nearly the same time. Each camera keeps
+ * only its newest frame; a set is complete when the stamps of all
+ * of them are within tolerance. Frames that fall behind the newest
+ * by more than that are dropped, so a set is never older than
+ * the frame period of the slowest camera.
+ */
+class CaptureGroup
+{
+public:
+	// tolerance in nanosecond
+	CaptureGroup (const std::vector<V4L2Capture*> &_cameras, uint64_t _tolerance);
+
+	/*
+	 * Returns false when interrupted; frames has one frame of each
+	 * camera, in their order. Throws V4L2Timeout naming a camera that
+	 * gave no usable frame in time.
+	 */
+	bool grab (std::vector<V4L2Frame> &frames, int timeoutMs);
+
+	void setTolerance (uint64_t t) { tolerance = t; }
+
+	// Drops pending frames, as after cameras are reopened
+	void reset ();
+
+private:
+	std::vector<V4L2Capture*> cameras;
+	std::vector<V4L2Frame> latest;
+	std::vector<bool> pending;
+	uint64_t tolerance;
+
+	bool complete ();
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_SERVER_CAPTUREGROUP_H_ */
@@ -0,0 +1,120 @@
+/*
+ * ClientSession.cpp
+ */
+
+#include "ClientSession.h"
+#include "debug.h"
+
+
+namespace Robocar {
+
+
+ClientSession::ClientSession (tcp::socket *_socket, RequestHandler _handler) :
+	socket (_socket),
+	handler (_handler),
+	subscription (SubscribeAll),
+	alive (true),
+	senderThread (NULL), receiverThread (NULL)
+{}
+
+
+void ClientSession::start ()
+{
+	senderThread = new boost::thread (&senderEntryPoint, this);
+	receiverThread = new boost::thread (&receiverEntryPoint, this);
+}
+
+
+void ClientSession::senderEntryPoint (ClientSession *session)
+{
+	session->sendWork ();
+}
+
+
+void ClientSession::receiverEntryPoint (ClientSession *session)
+{
+	session->receiveWork ();
+}
+
+
+bool ClientSession::deliver (shared_ptr<Message> msg)
+{
+	if (alive==false || wants(msg->getType())==false)
+		return false;
+	if (outbox.size() >= MaximumPendingMessages)
+		return false;
+	outbox.push (msg);
+	return true;
+}
+
+
+void ClientSession::reply (shared_ptr<Message> msg)
+{
+	if (alive==true)
+		outbox.push (msg);
+}
+
+
+void ClientSession::sendWork ()
+{
+	while (alive==true) {
+		shared_ptr<Message> msg = outbox.pop ();
+		// empty message is pushed by close()
+		if (!msg)
+			break;
+		try {
+			msg->send (*socket);
+		} catch (boost::system::system_error &serr) {
+			debug ("Unable to send");
+			break;
+		}
+	}
+	close ();
+}
+
+
+void ClientSession::receiveWork ()
+{
+	while (alive==true) {
+		try {
+			shared_ptr<Message> request = Message::receive (*socket);
+			if (!request)
+				break;
+			handler (this, request);
+		} catch (boost::system::system_error &serr) {
+			break;
+		}
+	}
+	close ();
+}
+
+
+void ClientSession::close ()
+{
+	if (alive==false)
+		return;
+	alive = false;
+
+	boost::system::error_code err;
+	socket->shutdown (tcp::socket::shutdown_both, err);
+	// wake up sender
+	outbox.push (shared_ptr<Message>());
+}
+
+
+ClientSession::~ClientSession ()
+{
+	close ();
+	if (senderThread != NULL) {
+		senderThread->join ();
+		delete senderThread;
+	}
+	if (receiverThread != NULL) {
+		receiverThread->join ();
+		delete receiverThread;
+	}
+	socket->close ();
+	delete socket;
+}
+
+} /* namespace Robocar */
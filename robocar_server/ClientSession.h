@@ -0,0 +1,81 @@
+/*
+ * ClientSession.h
+ */
+
+#ifndef ROBOCAR_SERVER_CLIENTSESSION_H_
+#define ROBOCAR_SERVER_CLIENTSESSION_H_
+
+
+#include "Message.h"
+#include "MessageQueue.h"
+#include "Subscription.h"
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+
+
+using boost::asio::ip::tcp;
+
+
+// Messages waiting for a slow client beyond this are dropped
+#define MaximumPendingMessages 16
+
+
+namespace Robocar {
+
+
+/*
+ * One connected client. Each session has its own outgoing queue
+ * served by a sender thread, and a receiver thread that hands
+ * client requests (subscription, etc.) to the server.
+ */
+class ClientSession
+{
+public:
+	typedef boost::function<void (ClientSession*, shared_ptr<Message>)> RequestHandler;
+
+	ClientSession (tcp::socket *_socket, RequestHandler _handler);
+	~ClientSession ();
+
+	void start ();
+
+	// Shuts down the connection; both threads will exit
+	void close ();
+
+	// Queue a message if the client is subscribed to it
+	bool deliver (shared_ptr<Message> msg);
+
+	// Queue a message regardless of subscription
+	void reply (shared_ptr<Message> msg);
+
+	bool isAlive () { return alive; }
+
+	bool wants (uint8_t category)
+	{ return isSubscribed (subscription, category); }
+
+	bool wantsAny (SubscriptionMask categories)
+	{ return (subscription & categories) != 0; }
+
+	void setSubscription (SubscriptionMask mask)
+	{ subscription = mask; }
+
+	size_t pending () { return outbox.size(); }
+
+	static void senderEntryPoint (ClientSession *session);
+	static void receiverEntryPoint (ClientSession *session);
+
+private:
+	void sendWork ();
+	void receiveWork ();
+
+	tcp::socket *socket;
+	MessageQueue outbox;
+	RequestHandler handler;
+	volatile SubscriptionMask subscription;
+	volatile bool alive;
+	boost::thread *senderThread, *receiverThread;
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_SERVER_CLIENTSESSION_H_ */
@@ -31,6 +31,8 @@ namespace Robocar {
 DriveControl::DriveControl() :
 	driveControlLock (NULL), serverThread (NULL),
 	gearPosition (GEAR_BRAKE),
+	steering (0),
+	blockedGear (-1),
 	doStop (false)
 {
 	// Robocar Init
@@ -109,7 +111,10 @@ void DriveControl::changeState(DriveMessage &newstate)
 {
 	//printf ("Gear: %d; Steering: %f; Acceleration: %d\n", newstate.gear, newstate.steering, newstate.acceleration);
 	driveControlLock->wait();
+	if (newstate.gear==blockedGear)
+		newstate.gear = GEAR_BRAKE;
 	gearPosition = newstate.gear;
+	steering = newstate.steering;
 	drivecontrol.SetSteerAngle (newstate.steering);
 	int acceleration;
 
@@ -137,6 +142,50 @@ void DriveControl::getState(DriveMessage &state)
 }
 
 
+float DriveControl::getSpeed ()
+{
+	int speed = 0;
+	driveControlLock->wait ();
+	bool known = drivecontrol.GetPresentSpeed (&speed);
+	driveControlLock->post ();
+	return (known ? speed : 0);
+}
+
+
+int DriveControl::getDirection ()
+{
+	switch (gearPosition) {
+	case GEAR_DRIVE:
+		return 1;
+	case GEAR_RETREAT:
+		return -1;
+	default:
+		return 0;
+	}
+}
+
+
+void DriveControl::brake (int _blockedGear)
+{
+	blockedGear = _blockedGear;
+	DriveMessage state;
+	driveControlLock->wait ();
+	state.steering = steering;
+	driveControlLock->post ();
+	state.acceleration = 0;
+	state.brake = 0;
+	state.gear = GEAR_BRAKE;
+	state.mode = 0;
+	changeState (state);
+}
+
+
+void DriveControl::release ()
+{
+	blockedGear = -1;
+}
+
+
 void DriveControl::startServer()
 {
 	DriveControl *driveControl = DriveControl::getInstance();
@@ -71,11 +71,36 @@ public:
 
 	void getState (DriveMessage &state);
 
+	/*
+	 * Present speed of drive motor as the controller gives it,
+	 * in degree per second of motor rotation; negative when
+	 * retreating, and 0 when it can't be read
+	 */
+	float getSpeed ();
+
+	/*
+	 * Which way the selected gear moves the car: 1 forward,
+	 * -1 backward, 0 neither
+	 */
+	int getDirection ();
+
+	/*
+	 * Stop the car and refuse the given gear until release(),
+	 * so that a remote client can't drive into what was seen;
+	 * other gears still work, to move away.
+	 */
+	void brake (int blockedGear);
+	void release ();
+
 private:
 	zmp::zrc::RcControl drivecontrol;
 	boost::interprocess::interprocess_semaphore *driveControlLock;
 	boost::thread *serverThread;
-	int gearPosition;
+	// also read by getDirection() without the lock
+	volatile int gearPosition;
+	float steering;
+	// gear refused after brake(), -1 if none
+	volatile int blockedGear;
 	volatile bool doStop;
 };
 
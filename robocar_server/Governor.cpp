@@ -0,0 +1,182 @@
+/*
+ * Governor.cpp
+ */
+
+#include "Governor.h"
+#include "Report.h"
+#include "debug.h"
+#include <pthread.h>
+#include <stdio.h>
+
+
+namespace Robocar {
+
+
+static double clockSeconds (clockid_t clock)
+{
+	struct timespec ts;
+	if (clock_gettime (clock, &ts) != 0)
+		return 0;
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+Governor::Governor (double _cpuBudget, size_t _queueBudget,
+	Configurator _configure, Query _query,
+	DepthProbe _queueDepth, Reporter _report) :
+		cpuBudget (_cpuBudget),
+		queueBudget (_queueBudget),
+		configure (_configure),
+		query (_query),
+		queueDepth (_queueDepth),
+		reporter (_report),
+		level (0),
+		quietSamples (0)
+{
+	lastWall = clockSeconds (CLOCK_MONOTONIC);
+}
+
+
+void Governor::watch (uint8_t category, boost::thread *worker)
+{
+	WatchedThread wt;
+	if (worker==NULL ||
+		pthread_getcpuclockid (worker->native_handle(), &wt.clock) != 0)
+		return;
+	wt.category = category;
+	wt.lastCpu = clockSeconds (wt.clock);
+	wt.load = 0;
+	boost::mutex::scoped_lock guard (threadsLock);
+	threads.push_back (wt);
+}
+
+
+void Governor::addStep (uint8_t category, uint8_t parameter, int32_t value,
+	uint8_t parameter2, int32_t value2)
+{
+	Step step;
+	step.category = category;
+	step.parameter[0] = parameter;
+	step.value[0] = value;
+	step.parameter[1] = parameter2;
+	step.value[1] = value2;
+	step.applied = false;
+	ladder.push_back (step);
+}
+
+
+void Governor::sample ()
+{
+	double now = clockSeconds (CLOCK_MONOTONIC);
+	double wall = now - lastWall;
+	lastWall = now;
+	if (wall <= 0)
+		return;
+
+	double cpu = 0;
+	{
+		boost::mutex::scoped_lock guard (threadsLock);
+		for (size_t i=0; i<threads.size(); i++) {
+			double t = clockSeconds (threads[i].clock);
+			threads[i].load = (t - threads[i].lastCpu) / wall * 100;
+			threads[i].lastCpu = t;
+			cpu += threads[i].load;
+		}
+	}
+	size_t depth = queueDepth ();
+
+	if (cpu > cpuBudget || depth > queueBudget) {
+		quietSamples = 0;
+		// Steps of absent drivers are passed over
+		while (level < (int)ladder.size()) {
+			Step &step = ladder[level++];
+			if (degrade (step)) {
+				report (REPORT_DEGRADED, step, cpu, depth);
+				break;
+			}
+		}
+		return;
+	}
+
+	if (cpu > cpuBudget*GovernorRestoreRatio || depth > queueBudget/2) {
+		quietSamples = 0;
+		return;
+	}
+
+	if (++quietSamples < GovernorRestoreSamples)
+		return;
+	quietSamples = 0;
+	while (level > 0) {
+		Step &step = ladder[--level];
+		if (step.applied) {
+			restore (step);
+			report (REPORT_RESTORED, step, cpu, depth);
+			break;
+		}
+	}
+}
+
+
+bool Governor::degrade (Step &step)
+{
+	step.applied = false;
+	for (int p=0; p<2; p++) {
+		if (step.parameter[p]==0)
+			continue;
+		if (query (step.category, step.parameter[p], step.saved[p])==false)
+			return false;
+	}
+
+	for (int p=0; p<2; p++) {
+		if (step.parameter[p]==0)
+			continue;
+		if (configure (step.category, step.parameter[p], step.value[p]))
+			step.applied = true;
+	}
+	return step.applied;
+}
+
+
+/*
+ * Settings changed by a client in the meantime are left alone
+ */
+void Governor::restore (Step &step)
+{
+	for (int p=0; p<2; p++) {
+		int32_t current;
+		if (step.parameter[p]==0)
+			continue;
+		if (query (step.category, step.parameter[p], current) && current==step.value[p])
+			configure (step.category, step.parameter[p], step.saved[p]);
+	}
+	step.applied = false;
+}
+
+
+void Governor::report (uint8_t kind, Step &step, double cpu, size_t depth)
+{
+	debug ("Governor: %s category %d, cpu %.1f%%, queue %d",
+		(kind==REPORT_DEGRADED ? "degrading" : "restoring"),
+		(int)step.category, cpu, (int)depth);
+
+	Report rep (step.category, kind);
+	rep.add ("level", level);
+	rep.add ("cpu", cpu);
+	rep.add ("queue", depth);
+	for (int p=0; p<2; p++) {
+		if (step.parameter[p]==0)
+			continue;
+		char key[ReportKeyLength];
+		snprintf (key, sizeof(key), "param.%d", (int)step.parameter[p]);
+		rep.add (key, (kind==REPORT_DEGRADED ? step.value[p] : step.saved[p]));
+	}
+	boost::mutex::scoped_lock guard (threadsLock);
+	for (size_t i=0; i<threads.size(); i++) {
+		char key[ReportKeyLength];
+		snprintf (key, sizeof(key), "cpu.%d", (int)threads[i].category);
+		rep.add (key, threads[i].load);
+	}
+	reporter (rep.toMessage());
+}
+
+} /* namespace Robocar */
@@ -0,0 +1,97 @@
+/*
+ * Governor.h
+ */
+
+#ifndef ROBOCAR_SERVER_GOVERNOR_H_
+#define ROBOCAR_SERVER_GOVERNOR_H_
+
+
+#include "Message.h"
+#include <vector>
+#include <time.h>
+#include <stdint.h>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+
+
+// Interval between two samples, in microsecond
+#define GovernorInterval 1000000
+// Load must fall under this fraction of budget before a step is undone
+#define GovernorRestoreRatio 0.6
+// ... for this many consecutive samples
+#define GovernorRestoreSamples 5
+
+
+namespace Robocar {
+
+
+/*
+ * Keeps CPU usage of driver threads under a budget. When the budget
+ * or the sender queue limit is exceeded, streams are degraded one
+ * step at a time following the order the steps were added; once
+ * load drops the steps are undone in reverse order.
+ */
+class Governor
+{
+public:
+	typedef boost::function<bool (uint8_t, uint8_t, int32_t)> Configurator;
+	typedef boost::function<bool (uint8_t, uint8_t, int32_t&)> Query;
+	typedef boost::function<size_t ()> DepthProbe;
+	typedef boost::function<void (shared_ptr<Message>)> Reporter;
+
+	// cpuBudget is in percent of one core
+	Governor (double _cpuBudget, size_t _queueBudget,
+		Configurator _configure, Query _query,
+		DepthProbe _queueDepth, Reporter _report);
+
+	// Account CPU time of this thread, on behalf of category;
+	// may be called from any thread
+	void watch (uint8_t category, boost::thread *worker);
+
+	// Degradation step; second parameter is optional, for
+	// settings that must change together (width & height)
+	void addStep (uint8_t category, uint8_t parameter, int32_t value,
+		uint8_t parameter2=0, int32_t value2=0);
+
+	// Called every GovernorInterval
+	void sample ();
+
+private:
+	struct WatchedThread {
+		uint8_t category;
+		clockid_t clock;
+		double lastCpu;
+		double load;
+	};
+
+	struct Step {
+		uint8_t category;
+		uint8_t parameter[2];
+		int32_t value[2];
+		int32_t saved[2];
+		bool applied;
+	};
+
+	bool degrade (Step &step);
+	void restore (Step &step);
+	void report (uint8_t kind, Step &step, double cpu, size_t depth);
+
+	double cpuBudget;
+	size_t queueBudget;
+	Configurator configure;
+	Query query;
+	DepthProbe queueDepth;
+	Reporter reporter;
+
+	std::vector<WatchedThread> threads;
+	boost::mutex threadsLock;
+	std::vector<Step> ladder;
+	// number of steps taken
+	int level;
+	int quietSamples;
+	double lastWall;
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_SERVER_GOVERNOR_H_ */
@@ -8,6 +8,7 @@
 #include "IMUDriver.h"
 #include "zmp/Baseboard.h"
 #include "zmp/BaseboardCom.h"
+#include "ControlMessage.h"
 #include "string.h"
 
 
@@ -22,6 +23,7 @@ IMUDriver::IMUDriver(MessageQueue *_srvq) :
 {
 	startSignal = new semaphore (0);
 	ProbingDelay = (long int)(1e6/(float)DefaultProbingRate);
+	pendingProbingDelay = ProbingDelay;
 	drvThread = new boost::thread (&threadEntryPoint, this);
 }
 
@@ -51,6 +53,8 @@ void IMUDriver::work ()
 	while (doQuit==false) {
 		while (doStop == false) {
 
+			ProbingDelay = pendingProbingDelay;
+
 			zmp::zrc::POWER_VALUE pwr;
 			zmp::zrc::SENSOR_VALUE snr;
 			memset (&pwr, 0, sizeof(pwr));
@@ -92,6 +96,15 @@ void IMUDriver::work ()
 }
 
 
+bool IMUDriver::setParameter (uint8_t parameter, int32_t value)
+{
+	if (parameter != CONTROL_FRAME_RATE || value < 1 || value > 100)
+		return false;
+	pendingProbingDelay = (long int)(1e6/(float)value);
+	return true;
+}
+
+
 void IMUDriver::start ()
 {
 	doStop = false;
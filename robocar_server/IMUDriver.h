@@ -40,6 +40,11 @@ public:
 
 	void stop () ;
 
+	// Runtime reconfiguration, applied at next probe
+	bool setParameter (uint8_t parameter, int32_t value);
+
+	boost::thread *getThread () { return drvThread; }
+
 	inline size_t messageSize ()
 	{ return ImuArraySize*sizeof(float); }
 
@@ -50,6 +55,7 @@ private:
 	semaphore *startSignal;
 	volatile bool doStop, doQuit;
 	useconds_t ProbingDelay;
+	volatile useconds_t pendingProbingDelay;
 	boost::thread *drvThread;
 };
 
@@ -0,0 +1,289 @@
+/*
+ * ImageShaper.cpp
+ */
+
+#include "ImageShaper.h"
+#include "USBCameraDriver.h"
+#include "MessageRegisters.h"
+#include "ColorConvert.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+
+namespace Robocar {
+
+
+static double stampOf (Message &msg)
+{
+	timeval tv = msg.getTimestamp ();
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+
+static uint32_t streamKey (uint8_t category, uint8_t device, uint8_t stream)
+{
+	return (category << 16) | (device << 8) | stream;
+}
+
+
+/*
+ * Header of USB camera image; it is the preamble when content
+ * is the camera buffer itself
+ */
+static bool usbHeader (Message &frame, _imageMessageBuffer &header)
+{
+	const uint32_t headerSize = sizeof(_imageMessageBuffer) - 1;
+	if (frame.getPreambleSize() >= headerSize)
+		memcpy (&header, frame.getPreamble(), headerSize);
+	else if (frame.getSize() >= headerSize)
+		memcpy (&header, frame.getContent(), headerSize);
+	else
+		return false;
+	return true;
+}
+
+
+ImageShaper::ImageShaper ()
+{}
+
+
+void ImageShaper::setRequest (const _imageRequestBuffer &req)
+{
+	std::vector<_imageRequestBuffer> &streams = requests[req.target];
+	if (streams.empty())
+		for (int s=0; s<MaximumImageStreams; s++)
+			streams.push_back (ImageRequest::full (req.target, s));
+	streams[req.stream] = req;
+
+	for (std::map<uint32_t, double>::iterator it=lastSent.begin(); it!=lastSent.end(); ) {
+		if ((it->first >> 16)==req.target && (it->first & 0xff)==req.stream)
+			lastSent.erase (it++);
+		else
+			it++;
+	}
+}
+
+
+// Without request for this camera, the whole frame is due
+void ImageShaper::plan (Message &frame, std::vector<_imageRequestBuffer> &streams)
+{
+	uint8_t target = frame.getType ();
+	std::map<uint8_t, std::vector<_imageRequestBuffer> >::iterator wanted = requests.find (target);
+	if (wanted==requests.end()) {
+		streams.push_back (ImageRequest::full (target, 0));
+		return;
+	}
+
+	uint8_t device = 0;
+	_imageMessageBuffer header;
+	if (target==USBCameraDriverMessageCategory) {
+		if (usbHeader (frame, header)==false)
+			return;
+		device = header.device;
+	}
+
+	double t = stampOf (frame);
+	uint32_t camera = streamKey (target, device, 0);
+	if (lastFrame[camera] > 0 && t > lastFrame[camera])
+		interval[camera] = t - lastFrame[camera];
+	lastFrame[camera] = t;
+
+	for (size_t s=0; s<wanted->second.size(); s++) {
+		const _imageRequestBuffer &req = wanted->second[s];
+		if (req.enabled != 0 && due (req, device, t))
+			streams.push_back (req);
+	}
+}
+
+
+shared_ptr<Message> ImageShaper::shape (shared_ptr<Message> frame, const _imageRequestBuffer &req,
+	ImageCache &cache)
+{
+	return (frame->getType()==USBCameraDriverMessageCategory ?
+		shapeUSB (frame, req, cache) : shapeStereo (frame, req, cache));
+}
+
+
+// Half a frame of slack, so that rates dividing the camera rate are met exactly
+bool ImageShaper::due (const _imageRequestBuffer &req, uint8_t device, double t)
+{
+	if (req.max_rate <= 0)
+		return true;
+	double &last = lastSent[streamKey (req.target, device, req.stream)];
+	double slack = interval[streamKey (req.target, device, 0)] / 2;
+	if (last > 0 && t - last < 1.0/req.max_rate - slack)
+		return false;
+	last = t;
+	return true;
+}
+
+
+/*
+ * Region and size asked by req, within an image of width x height.
+ * Returns false when that is the whole image at its size.
+ */
+bool ImageShaper::geometry (const _imageRequestBuffer &req, int width, int height,
+	ImageRect &roi, int &outWidth, int &outHeight)
+{
+	roi.x = roi.y = 0;
+	roi.width = width;
+	roi.height = height;
+	if (req.crop_width > 0 && req.crop_height > 0 && req.crop_x < width && req.crop_y < height) {
+		roi.x = req.crop_x;
+		roi.y = req.crop_y;
+		roi.width = std::min<int> (req.crop_width, width - roi.x);
+		roi.height = std::min<int> (req.crop_height, height - roi.y);
+	}
+
+	outWidth = req.width;
+	outHeight = req.height;
+	if (outWidth==0 && outHeight==0) {
+		outWidth = roi.width;
+		outHeight = roi.height;
+	}
+	else if (outWidth==0)
+		outWidth = std::max (1, (int)lround ((double)outHeight * roi.width / roi.height));
+	else if (outHeight==0)
+		outHeight = std::max (1, (int)lround ((double)outWidth * roi.height / roi.width));
+	outWidth = std::min (outWidth, MaximumShapedSide);
+	outHeight = std::min (outHeight, MaximumShapedSide);
+
+	return !(roi.width==width && roi.height==height && outWidth==width && outHeight==height);
+}
+
+
+static ShapedImage *findShaped (ImageCache &cache, const ImageRect &roi, int width, int height)
+{
+	for (size_t i=0; i<cache.size(); i++) {
+		const ShapedImage &c = cache[i];
+		if (c.roi.x==roi.x && c.roi.y==roi.y && c.roi.width==roi.width && c.roi.height==roi.height &&
+			c.width==width && c.height==height)
+			return &cache[i];
+	}
+	return NULL;
+}
+
+
+shared_ptr<Message> ImageShaper::shapeUSB (shared_ptr<Message> frame, const _imageRequestBuffer &req,
+	ImageCache &cache)
+{
+	const uint32_t headerSize = sizeof(_imageMessageBuffer) - 1;
+	_imageMessageBuffer header;
+	if (usbHeader (*frame, header)==false)
+		return shared_ptr<Message> ();
+	bool inPreamble = (frame->getPreambleSize() >= headerSize);
+	shared_ptr<uint8_t> pixels = (inPreamble ? frame->getPtr () :
+		shared_ptr<uint8_t> (frame->getPtr(), (uint8_t*)frame->getContent() + headerSize));
+	uint32_t pixelSize = frame->getSize() - headerSize;
+	int width = header.width, height = header.height, pixelBytes = imagePixelBytes (header.format);
+	if (pixelSize < (uint32_t)(width*height*pixelBytes) || width==0 || height==0)
+		return shared_ptr<Message> ();
+
+	bool yuv = (header.format==IMAGE_YUYV || header.format==IMAGE_UYVY);
+	ImageRect roi;
+	int outWidth, outHeight;
+	// chroma is shared by pixel pairs, so YUV images are cut on even columns
+	bool resample = (imageCompressed (header.format)==false) &&
+		geometry (req, (yuv ? width & ~1 : width), height, roi, outWidth, outHeight);
+
+	ShapedImage *shaped = NULL;
+	if (resample) {
+		shaped = findShaped (cache, roi, outWidth, outHeight);
+		if (shaped==NULL) {
+			ShapedImage image;
+			image.roi = roi;
+			image.width = outWidth;
+			image.height = outHeight;
+			image.format = (yuv ? (uint8_t)IMAGE_RGB24 : header.format);
+			int channels = imagePixelBytes (image.format);
+			image.size = outWidth*outHeight*channels;
+			image.data = shared_ptr<uint8_t> (new uint8_t [image.size]);
+
+			if (yuv) {
+				// only the region is converted
+				int x0 = roi.x & ~1, x1 = std::min ((roi.x + roi.width + 1) & ~1, width & ~1);
+				int span = x1 - x0;
+				std::vector<uint8_t> rgb (3*span*roi.height);
+				for (int y=0; y<roi.height; y++) {
+					const uint8_t *row = pixels.get() + ((roi.y + y)*width + x0)*2;
+					if (header.format==IMAGE_YUYV)
+						yuyvToRgb (row, &rgb[3*span*y], span);
+					else
+						uyvyToRgb (row, &rgb[3*span*y], span);
+				}
+				ImageRect r = {roi.x - x0, 0, roi.width, roi.height};
+				resampleImage (&rgb[0], span, roi.height, 3, r, image.data.get(), outWidth, outHeight);
+			}
+			else
+				resampleImage (pixels.get(), width, height, channels, roi, image.data.get(),
+					outWidth, outHeight);
+			cache.push_back (image);
+			shaped = &cache.back ();
+		}
+	}
+	else if (req.stream==0)
+		return frame;
+
+	// same pixels as frame, or shared with other clients, under a header of its own
+	header.stream = req.stream;
+	if (shaped != NULL) {
+		header.width = shaped->width;
+		header.height = shaped->height;
+		header.format = shaped->format;
+		pixels = shaped->data;
+		pixelSize = shaped->size;
+	}
+	shared_ptr<Message> image = Message::create (USBCameraDriverMessageCategory, pixelSize, pixels);
+	image->setPreamble (&header, headerSize);
+	image->setTimestamp (frame->getTimestamp ());
+	return image;
+}
+
+
+/*
+ * Images of the built-in camera are two gray planes, left and right,
+ * after their width and height
+ */
+shared_ptr<Message> ImageShaper::shapeStereo (shared_ptr<Message> frame, const _imageRequestBuffer &req,
+	ImageCache &cache)
+{
+	const uint32_t headerSize = 2*sizeof(uint16_t);
+	if (req.stream != 0 || frame->getSize() < headerSize)
+		return shared_ptr<Message> ();
+	uint16_t *sizes = (uint16_t*)frame->getContent();
+	int width = sizes[0], height = sizes[1], plane = width*height;
+	if (plane==0 || frame->getSize() < headerSize + 2*plane)
+		return shared_ptr<Message> ();
+
+	ImageRect roi;
+	int outWidth, outHeight;
+	if (geometry (req, width, height, roi, outWidth, outHeight)==false)
+		return frame;
+
+	ShapedImage *shaped = findShaped (cache, roi, outWidth, outHeight);
+	if (shaped==NULL) {
+		ShapedImage image;
+		image.roi = roi;
+		image.width = outWidth;
+		image.height = outHeight;
+		image.format = IMAGE_GRAY8;
+		image.size = headerSize + 2*outWidth*outHeight;
+		image.data = shared_ptr<uint8_t> (new uint8_t [image.size]);
+		uint16_t *outSizes = (uint16_t*)image.data.get();
+		outSizes[0] = outWidth;
+		outSizes[1] = outHeight;
+		uint8_t *in = (uint8_t*)&sizes[2], *out = (uint8_t*)&outSizes[2];
+		for (int p=0; p<2; p++)
+			resampleImage (in + p*plane, width, height, 1, roi, out + p*outWidth*outHeight,
+				outWidth, outHeight);
+		cache.push_back (image);
+		shaped = &cache.back ();
+	}
+
+	shared_ptr<Message> image = Message::create (CameraDriverMessageCategory, shaped->size, shaped->data);
+	image->setTimestamp (frame->getTimestamp ());
+	return image;
+}
+
+} /* namespace Robocar */
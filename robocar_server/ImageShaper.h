@@ -0,0 +1,84 @@
+/*
+ * ImageShaper.h
+ */
+
+#ifndef ROBOCAR_SERVER_IMAGESHAPER_H_
+#define ROBOCAR_SERVER_IMAGESHAPER_H_
+
+
+#include "Message.h"
+#include "ImageRequest.h"
+#include "ImageResample.h"
+#include <vector>
+#include <map>
+
+
+// Largest side of a scaled image
+#define MaximumShapedSide 4096
+
+
+namespace Robocar {
+
+
+/*
+ * Pixels made from one frame, kept while that frame is dispatched,
+ * so that clients asking the same region and size share them
+ */
+struct ShapedImage
+{
+	ImageRect roi;
+	int width, height;
+	uint8_t format;
+	shared_ptr<uint8_t> data;
+	uint32_t size;
+};
+typedef std::vector<ShapedImage> ImageCache;
+
+
+/*
+ * Cuts camera images down to what one client requested, for each
+ * of its streams. USB camera images in YUYV or UYVY become RGB when
+ * they must be scaled or cropped; JPEG, from camera or server,
+ * is only rate limited.
+ * The stereo images of the built-in camera are shaped alike, and
+ * only take stream 0, since their header has no room for more.
+ */
+class ImageShaper
+{
+public:
+	ImageShaper ();
+
+	void setRequest (const _imageRequestBuffer &req);
+
+	// Adds to streams those of the client that are due for frame
+	void plan (Message &frame, std::vector<_imageRequestBuffer> &streams);
+
+	/*
+	 * What a stream from plan() gets of frame; that is the frame
+	 * itself when nothing needs to be done. Only cache is touched,
+	 * so pixels can be worked on without holding the shaper.
+	 */
+	static shared_ptr<Message> shape (shared_ptr<Message> frame, const _imageRequestBuffer &req,
+		ImageCache &cache);
+
+private:
+	// by camera category
+	std::map<uint8_t, std::vector<_imageRequestBuffer> > requests;
+	// timestamp of last frame passed, in second, by category,
+	// device and stream
+	std::map<uint32_t, double> lastSent;
+	// seconds between frames of each camera, as seen last time
+	std::map<uint32_t, double> lastFrame, interval;
+
+	bool due (const _imageRequestBuffer &req, uint8_t device, double t);
+	static bool geometry (const _imageRequestBuffer &req, int width, int height,
+		ImageRect &roi, int &outWidth, int &outHeight);
+	static shared_ptr<Message> shapeUSB (shared_ptr<Message> frame, const _imageRequestBuffer &req,
+		ImageCache &cache);
+	static shared_ptr<Message> shapeStereo (shared_ptr<Message> frame, const _imageRequestBuffer &req,
+		ImageCache &cache);
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_SERVER_IMAGESHAPER_H_ */
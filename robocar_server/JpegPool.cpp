@@ -0,0 +1,151 @@
+/*
+ * JpegPool.cpp
+ */
+
+#include "JpegPool.h"
+#include "MessageRegisters.h"
+#include "debug.h"
+#include <cstring>
+#include <time.h>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+
+using boost::interprocess::interprocess_mutex;
+using boost::interprocess::scoped_lock;
+
+
+namespace Robocar {
+
+
+static double now ()
+{
+	struct timespec t;
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+JpegPool::JpegPool (MessageQueue *_queue, int _workers) :
+	queue (_queue),
+	doQuit (false),
+	nextSequence (0), nextOut (0)
+{
+	memset (&stats, 0, sizeof(stats));
+	for (int i=0; i<_workers; i++)
+		workers.push_back (new boost::thread (&JpegPool::work, this));
+}
+
+
+JpegPool::~JpegPool ()
+{
+	{
+		scoped_lock<interprocess_mutex> guard (lock);
+		doQuit = true;
+		jobs.clear ();
+		wake.notify_all ();
+	}
+	for (size_t i=0; i<workers.size(); i++) {
+		workers[i]->join ();
+		delete workers[i];
+	}
+}
+
+
+bool JpegPool::submit (shared_ptr<uint8_t> image, JPEG_INPUT input, const _imageMessageBuffer &header,
+	const timeval &stamp, int quality, JPEG_SUBSAMPLING subsampling)
+{
+	scoped_lock<interprocess_mutex> guard (lock);
+	if (jobs.size() >= JpegMaximumPending) {
+		stats.dropped++;
+		return false;
+	}
+	Job job;
+	job.sequence = nextSequence++;
+	job.image = image;
+	job.input = input;
+	job.header = header;
+	job.stamp = stamp;
+	job.quality = quality;
+	job.subsampling = subsampling;
+	jobs.push_back (job);
+	wake.notify_one ();
+	return true;
+}
+
+
+void JpegPool::work ()
+{
+	const uint32_t headerSize = sizeof(_imageMessageBuffer) - 1;
+	JpegCompress compressor;
+
+	while (true) {
+		Job job;
+		{
+			scoped_lock<interprocess_mutex> guard (lock);
+			while (jobs.empty() && doQuit==false)
+				wake.wait (guard);
+			if (doQuit==true)
+				return;
+			job = jobs.front ();
+			jobs.pop_front ();
+		}
+
+		shared_ptr<Message> image;
+		uint32_t size = 0;
+		double start = now ();
+		try {
+			compressor.setQuality (job.quality);
+			compressor.setSubsampling (job.subsampling);
+			shared_ptr<uint8_t> jpeg = compressor.compress (job.image.get(), job.header.width,
+				job.header.height, job.input, size);
+			job.header.format = IMAGE_JPEG;
+			image = Message::create (USBCameraDriverMessageCategory, size, jpeg);
+			image->setPreamble (&job.header, headerSize);
+			image->setTimestamp (job.stamp);
+		} catch (JpegException &e) {
+			debug ("JPEG: %s", e.what());
+		}
+		double spent = now() - start;
+		// back to the camera as soon as possible
+		job.image.reset ();
+
+		{
+			scoped_lock<interprocess_mutex> guard (lock);
+			if (image) {
+				stats.images++;
+				stats.seconds += spent;
+				stats.rawBytes += job.header.width * job.header.height * (job.input==JPEG_GRAY ? 1 :
+					job.input==JPEG_RGB ? 3 : 2);
+				stats.jpegBytes += size;
+			}
+			finish (job.sequence, image);
+		}
+	}
+}
+
+
+/*
+ * Images that failed stand as empty ones, so that those after
+ * them aren't held. Called with lock held.
+ */
+void JpegPool::finish (uint64_t sequence, shared_ptr<Message> image)
+{
+	finished[sequence] = image;
+	while (finished.empty()==false && finished.begin()->first==nextOut) {
+		if (finished.begin()->second)
+			queue->push (finished.begin()->second);
+		finished.erase (finished.begin());
+		nextOut++;
+	}
+}
+
+
+JpegStatistics JpegPool::takeStatistics ()
+{
+	scoped_lock<interprocess_mutex> guard (lock);
+	JpegStatistics taken = stats;
+	memset (&stats, 0, sizeof(stats));
+	return taken;
+}
+
+} /* namespace Robocar */
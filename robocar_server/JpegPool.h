@@ -0,0 +1,94 @@
+/*
+ * JpegPool.h
+ */
+
+#ifndef ROBOCAR_SERVER_JPEGPOOL_H_
+#define ROBOCAR_SERVER_JPEGPOOL_H_
+
+
+#include "Message.h"
+#include "MessageQueue.h"
+#include "JpegHandler.h"
+#include "USBCameraDriver.h"
+#include <deque>
+#include <map>
+#include <vector>
+#include <sys/time.h>
+#include <boost/thread.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+
+
+// Threads compressing camera images
+#define JpegWorkers 2
+// Images waiting for a worker, beyond which new ones are dropped
+#define JpegMaximumPending 4
+
+
+namespace Robocar {
+
+
+// Work of the pool since last asked
+struct JpegStatistics {
+	uint32_t images, dropped;
+	// time spent compressing, by all workers
+	double seconds;
+	double rawBytes, jpegBytes;
+};
+
+
+/*
+ * Compresses USB camera images on worker threads, so that capture
+ * goes on meanwhile. Each worker keeps its own compressor. Images
+ * leave in the order they came, as USB camera messages with their
+ * header as preamble, and with the given timestamp.
+ */
+class JpegPool
+{
+public:
+	JpegPool (MessageQueue *_queue, int workers=JpegWorkers);
+	// Waits for the image being compressed; pending ones are dropped
+	~JpegPool ();
+
+	/*
+	 * Queues an image of header.width x header.height, or returns false
+	 * when too many are pending. image is held until compressed,
+	 * which keeps a leased camera buffer from the camera until then.
+	 */
+	bool submit (shared_ptr<uint8_t> image, JPEG_INPUT input, const _imageMessageBuffer &header,
+		const timeval &stamp, int quality, JPEG_SUBSAMPLING subsampling);
+
+	JpegStatistics takeStatistics ();
+
+	const std::vector<boost::thread*> &getWorkers () const { return workers; }
+
+private:
+	struct Job {
+		uint64_t sequence;
+		shared_ptr<uint8_t> image;
+		JPEG_INPUT input;
+		_imageMessageBuffer header;
+		timeval stamp;
+		int quality;
+		JPEG_SUBSAMPLING subsampling;
+	};
+
+	MessageQueue *queue;
+	std::vector<boost::thread*> workers;
+	boost::interprocess::interprocess_mutex lock;
+	boost::interprocess::interprocess_condition wake;
+	std::deque<Job> jobs;
+	volatile bool doQuit;
+
+	// images done out of order, held until those before are done
+	std::map<uint64_t, shared_ptr<Message> > finished;
+	uint64_t nextSequence, nextOut;
+	JpegStatistics stats;
+
+	void work ();
+	void finish (uint64_t sequence, shared_ptr<Message> image);
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_SERVER_JPEGPOOL_H_ */
@@ -0,0 +1,206 @@
+/*
+ * SafetyStop.cpp
+ */
+
+#include "SafetyStop.h"
+#include "Report.h"
+#include "debug.h"
+#include <cmath>
+#include <cstdio>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+
+namespace Robocar {
+
+
+static double clockSeconds (clockid_t id)
+{
+	struct timespec t;
+	clock_gettime (id, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+SafetyFootprint::SafetyFootprint () :
+	halfWidth (0.15), front (0.25), rear (0.25),
+	margin (0.2), deceleration (2.0),
+	speedUnit (SafetyDefaultSpeedUnit)
+{}
+
+
+bool SafetyFootprint::parse (const std::string &spec)
+{
+	float v[6] = {halfWidth, front, rear, margin, deceleration, speedUnit};
+	if (spec.empty()==false &&
+		sscanf (spec.c_str(), "%f:%f:%f:%f:%f:%f", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) < 1)
+		return false;
+	if (v[0] <= 0 || v[1] < 0 || v[2] < 0 || v[3] < 0 || v[4] <= 0 || v[5] <= 0)
+		return false;
+	halfWidth = v[0];
+	front = v[1];
+	rear = v[2];
+	margin = v[3];
+	deceleration = v[4];
+	speedUnit = v[5];
+	return true;
+}
+
+
+SafetyStop::SafetyStop (MessageQueue *_srvQueue, const std::vector<LidarPose> &_poses,
+	const SafetyFootprint &_footprint) :
+	srvQueue (_srvQueue),
+	poses (_poses),
+	footprint (_footprint),
+	sampler (NULL),
+	doStop (false),
+	driveSpeed (0),
+	driveDirection (0),
+	projections (_poses.size()),
+	engaged (false),
+	lastHit (0),
+	checkTime (0), checkMaxTime (0), lastReport (0),
+	checks (0), stops (0)
+{}
+
+
+SafetyStop::~SafetyStop ()
+{
+	doStop = true;
+	if (sampler != NULL) {
+		sampler->join ();
+		delete sampler;
+	}
+}
+
+
+void SafetyStop::setDrive (boost::function<float ()> _speed,
+	boost::function<int ()> _direction,
+	boost::function<void (bool)> _stop,
+	boost::function<void ()> _release)
+{
+	{
+		boost::mutex::scoped_lock guard (lock);
+		speed = _speed;
+		direction = _direction;
+		stop = _stop;
+		release = _release;
+	}
+	if (sampler==NULL && (speed || direction))
+		sampler = new boost::thread (&SafetyStop::sample, this);
+}
+
+
+void SafetyStop::sample ()
+{
+	while (doStop==false) {
+		float v = (speed ? speed() : 0);
+		int d = (direction ? direction() : 0);
+		{
+			boost::mutex::scoped_lock guard (lock);
+			driveSpeed = v;
+			driveDirection = d;
+		}
+		usleep (SafetySampleInterval);
+	}
+}
+
+
+void SafetyStop::check (uint8_t device, const float *ranges, int count,
+	const hokuyo::LaserConfig &config, uint64_t stamp)
+{
+	if (device >= poses.size() || count <= 0)
+		return;
+	double t0 = clockSeconds (CLOCK_MONOTONIC);
+	boost::mutex::scoped_lock guard (lock);
+
+	// Room to stop: the scan in flight and the speed reading's age,
+	// braking, and margin
+	float v = driveSpeed * footprint.speedUnit;
+	bool ahead = (driveDirection > 0 || v > 0 || (driveDirection==0 && v==0)),
+		behind = (driveDirection < 0 || v < 0 || (driveDirection==0 && v==0));
+	v = fabs (v);
+	float reach = footprint.margin + v*(config.scan_time + SafetySampleInterval*1e-6) +
+		v*v / (2*footprint.deceleration);
+
+	points.resize (2*count);
+	int k = projections[device].project (ranges, count, config.min_angle, config.ang_increment,
+		config.min_range, config.max_range, &points[0]);
+	const LidarPose &pose = poses[device];
+	float c = cos (pose.yaw), s = sin (pose.yaw);
+	int front = 0, rear = 0;
+	float nearestFront = INFINITY, nearestRear = INFINITY;
+	for (int i=0; i<k; i++) {
+		float x = pose.x + c*points[2*i] - s*points[2*i+1],
+			y = pose.y + s*points[2*i] + c*points[2*i+1];
+		if (fabs (y) > footprint.halfWidth)
+			continue;
+		if (ahead && x >= footprint.front && x <= footprint.front + reach) {
+			front++;
+			nearestFront = std::min (nearestFront, x - footprint.front);
+		}
+		if (behind && x <= -footprint.rear && x >= -footprint.rear - reach) {
+			rear++;
+			nearestRear = std::min (nearestRear, -footprint.rear - x);
+		}
+	}
+
+	double now = clockSeconds (CLOCK_MONOTONIC);
+	if (front >= SafetyMinimumPoints || rear >= SafetyMinimumPoints) {
+		// the side with more of the obstacle is refused
+		bool forward = (front >= rear);
+		float nearest = (forward ? nearestFront : nearestRear);
+		lastHit = now;
+		if (engaged==false) {
+			engaged = true;
+			stops++;
+			if (stop)
+				stop (forward);
+			// from the time the scan was taken to the stop command
+			double latency = clockSeconds (CLOCK_REALTIME) - stamp*1e-9;
+			debug ("Safety stop: obstacle at %.2f m, %.2f m/s, %.1f ms after scan",
+				nearest, v, latency*1e3);
+			Report rep (0, REPORT_SAFETY_STOP);
+			rep.add ("device", device);
+			rep.add ("distance_m", nearest);
+			rep.add ("speed_mps", v);
+			rep.add ("latency_ms", latency*1e3);
+			// rare state change; queued even with nobody listening
+			srvQueue->push (rep.toMessage (), true);
+		}
+	}
+	else if (engaged==true && now - lastHit >= SafetyReleaseTime) {
+		engaged = false;
+		if (release)
+			release ();
+		srvQueue->push (Report (0, REPORT_SAFETY_RELEASE).toMessage (), true);
+	}
+
+	double elapsed = clockSeconds (CLOCK_MONOTONIC) - t0;
+	checkTime += elapsed;
+	checkMaxTime = std::max (checkMaxTime, elapsed);
+	checks++;
+	reportStatistics (now);
+}
+
+
+void SafetyStop::reportStatistics (double now)
+{
+	if (lastReport==0)
+		lastReport = now;
+	if (now - lastReport < SafetyReportInterval)
+		return;
+
+	Report rep (0, REPORT_STATISTICS);
+	rep.add ("safety_checks", checks);
+	rep.add ("safety_stops", stops);
+	rep.add ("check_mean_us", checkTime / checks * 1e6);
+	rep.add ("check_max_us", checkMaxTime * 1e6);
+	srvQueue->push (rep.toMessage ());
+	checkTime = checkMaxTime = 0;
+	checks = stops = 0;
+	lastReport = now;
+}
+
+} /* namespace Robocar */
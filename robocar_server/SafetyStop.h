@@ -0,0 +1,124 @@
+/*
+ * SafetyStop.h
+ */
+
+#ifndef ROBOCAR_SERVER_SAFETYSTOP_H_
+#define ROBOCAR_SERVER_SAFETYSTOP_H_
+
+
+#include "MessageQueue.h"
+#include "LaserProjection.h"
+#include "ScanMerger.h"
+#include "hokuyo.h"
+#include <vector>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+
+// Readings inside footprint that make an obstacle, against speckles
+#define SafetyMinimumPoints 3
+// Footprint must stay clear this long before driving is allowed again, in second
+#define SafetyReleaseTime 0.5
+// Interval between two reports of check cost, in second
+#define SafetyReportInterval 5
+// Interval between two readings of drive speed and gear, in microsecond
+#define SafetySampleInterval 20000
+/*
+ * Metre per second of car for one degree per second of drive motor.
+ * The controller only tells motor rotation, and gearing and wheels
+ * differ between cars; this assumes 0.36 m travelled per motor
+ * revolution. Measure it and give it in footprint spec.
+ */
+#define SafetyDefaultSpeedUnit 0.001
+
+
+namespace Robocar {
+
+
+/*
+ * Car body and braking, in metre and metre per second squared
+ */
+struct SafetyFootprint
+{
+	float halfWidth, front, rear;
+	// kept clear beyond braking distance
+	float margin;
+	float deceleration;
+	// see SafetyDefaultSpeedUnit
+	float speedUnit;
+
+	SafetyFootprint ();
+
+	// "halfwidth:front:rear:margin:deceleration:speedunit";
+	// missing fields keep default
+	bool parse (const std::string &spec);
+};
+
+
+/*
+ * Stops the car from the lidar driver threads, without waiting
+ * for any client; the server keeps those running for it. Every scan is checked against the car body
+ * stretched by the distance it needs to stop at present speed,
+ * on the side the gear or the motion points to, and on both sides
+ * when neither does. Stop and release are reported.
+ * Speed and gear are read by a thread of its own, since reading
+ * the controller takes a serial round-trip.
+ */
+class SafetyStop
+{
+public:
+	SafetyStop (MessageQueue *_srvQueue, const std::vector<LidarPose> &_poses,
+		const SafetyFootprint &_footprint);
+	~SafetyStop ();
+
+	/*
+	 * speed: drive motor speed, negative when retreating; it is
+	 *   taken to metre per second with footprint speedUnit
+	 * direction: which way the selected gear moves the car, 1 forward,
+	 *   -1 backward, 0 neither
+	 * stop: stop the car, and refuse to move forward (true)
+	 *   or backward (false) any more
+	 * release: footprint is clear again
+	 * Without them the check runs and reports, but nothing is stopped.
+	 */
+	void setDrive (boost::function<float ()> _speed,
+		boost::function<int ()> _direction,
+		boost::function<void (bool)> _stop,
+		boost::function<void ()> _release);
+
+	// A ScanHook
+	void check (uint8_t device, const float *ranges, int count,
+		const hokuyo::LaserConfig &config, uint64_t stamp);
+
+private:
+	MessageQueue *srvQueue;
+	std::vector<LidarPose> poses;
+	SafetyFootprint footprint;
+	boost::function<float ()> speed;
+	boost::function<int ()> direction;
+	boost::function<void (bool)> stop;
+	boost::function<void ()> release;
+
+	boost::thread *sampler;
+	volatile bool doStop;
+	void sample ();
+
+	// checks come from every lidar thread
+	boost::mutex lock;
+	// last reading of sampler
+	float driveSpeed;
+	int driveDirection;
+	std::vector<LaserProjection> projections;
+	std::vector<float> points;
+	bool engaged;
+	double lastHit;
+
+	double checkTime, checkMaxTime, lastReport;
+	int checks, stops;
+	void reportStatistics (double now);
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_SERVER_SAFETYSTOP_H_ */
@@ -0,0 +1,199 @@
+/*
+ * ScanMerger.cpp
+ */
+
+#include "ScanMerger.h"
+#include "HokuyoDriver.h"
+#include "MessageRegisters.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+
+// Gaps longer than this are not taken as scan interval (restarts, stalls)
+#define MaximumScanInterval 1.0
+// Used until every lidar has sent two scans
+#define DefaultScanInterval 0.1
+
+
+namespace Robocar {
+
+
+static double stampOf (Message &msg)
+{
+	timeval tv = msg.getTimestamp ();
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+
+bool LidarPose::parse (const std::string &spec, LidarPose &pose)
+{
+	float x = 0, y = 0, yaw = 0;
+	if (spec.empty()==false && sscanf (spec.c_str(), "%f:%f:%f", &x, &y, &yaw) < 1)
+		return false;
+	pose.x = x;
+	pose.y = y;
+	pose.yaw = yaw * M_PI / 180;
+	return true;
+}
+
+
+ScanMerger::ScanMerger (const std::vector<LidarPose> &_poses) :
+	poses (_poses),
+	pending (_poses.size()),
+	pendingCount (0),
+	pendingStart (0),
+	lastStamp (_poses.size(), 0),
+	interval (_poses.size(), 0),
+	projections (_poses.size())
+{}
+
+
+void ScanMerger::reset ()
+{
+	for (size_t i=0; i<pending.size(); i++)
+		pending[i].reset ();
+	pendingCount = 0;
+}
+
+
+// Lidars that are sending scans; those that failed or stalled are not waited for
+int ScanMerger::alive (double now)
+{
+	int n = 0;
+	for (size_t i=0; i<lastStamp.size(); i++)
+		if (lastStamp[i] > 0 && now - lastStamp[i] < MaximumScanInterval)
+			n++;
+	return n;
+}
+
+
+double ScanMerger::period ()
+{
+	double p = 0;
+	for (size_t i=0; i<interval.size(); i++)
+		p = std::max (p, interval[i]);
+	return (p > 0 ? p : DefaultScanInterval);
+}
+
+
+shared_ptr<Message> ScanMerger::add (shared_ptr<Message> scan)
+{
+	const uint32_t headerSize = sizeof(_hokuyoMessageBuffer) - 1;
+	if (scan->getSize() < headerSize)
+		return shared_ptr<Message> ();
+	_hokuyoMessageBuffer *in = (_hokuyoMessageBuffer*)scan->getContent();
+	size_t d = in->device;
+	if (d >= poses.size())
+		return shared_ptr<Message> ();
+
+	double t = stampOf (*scan);
+	if (lastStamp[d] > 0 && t > lastStamp[d] && t - lastStamp[d] < MaximumScanInterval)
+		interval[d] = t - lastStamp[d];
+	lastStamp[d] = t;
+
+	// This scan starts a new group when its lidar is already in
+	// the current one, or when it's nearer to the next group
+	shared_ptr<Message> merged;
+	if (pendingCount > 0) {
+		double age = t - pendingStart, p = period ();
+		if (age > 1.5*p || age < -p/2)
+			reset ();
+		else if (pending[d] || age > p/2)
+			merged = merge ();
+	}
+
+	if (pendingCount==0)
+		pendingStart = t;
+	pending[d] = scan;
+	pendingCount += 1;
+	// at most one merged scan each time; a complete group
+	// left here goes out with the next scan
+	if (!merged && pendingCount >= alive (t))
+		merged = merge ();
+	return merged;
+}
+
+
+/*
+ * Readings of every lidar are moved to car frame, and each bin
+ * of the merged scan keeps the nearest of them
+ */
+shared_ptr<Message> ScanMerger::merge ()
+{
+	const uint32_t headerSize = sizeof(_hokuyoMessageBuffer) - 1;
+	float increment = 0, maxRange = 0, scanTime = 0;
+	timeval oldest;
+	double oldestStamp = 0;
+	for (size_t d=0; d<pending.size(); d++) {
+		if (!pending[d])
+			continue;
+		_hokuyoMessageBuffer *in = (_hokuyoMessageBuffer*)pending[d]->getContent();
+		if (in->angular_increment > 0 && (increment==0 || in->angular_increment < increment))
+			increment = in->angular_increment;
+		maxRange = std::max (maxRange, in->max_range + (float)hypot (poses[d].x, poses[d].y));
+		scanTime = std::max (scanTime, in->scan_time);
+		double t = stampOf (*pending[d]);
+		if (oldestStamp==0 || t < oldestStamp) {
+			oldestStamp = t;
+			oldest = pending[d]->getTimestamp ();
+		}
+	}
+	if (increment==0) {
+		reset ();
+		return shared_ptr<Message> ();
+	}
+
+	int count = (int)ceil (2*M_PI / increment);
+	increment = 2*M_PI / count;
+	uint32_t size = headerSize + count*sizeof(float);
+	shared_ptr<uint8_t> buffer (new uint8_t [size]);
+	_hokuyoMessageBuffer *out = (_hokuyoMessageBuffer*)buffer.get();
+	float *ranges = (float*)&out->_ranges;
+	std::fill (ranges, ranges+count, std::numeric_limits<float>::quiet_NaN());
+
+	for (size_t d=0; d<pending.size(); d++) {
+		if (!pending[d])
+			continue;
+		_hokuyoMessageBuffer *in = (_hokuyoMessageBuffer*)pending[d]->getContent();
+		int n = in->num_ranges;
+		if (n==0 || pending[d]->getSize() < headerSize + n*sizeof(float))
+			continue;
+
+		points.resize (2*n);
+		int k = projections[d].project ((const float*)&in->_ranges, n,
+			in->min_angle, in->angular_increment, in->min_range, in->max_range, &points[0]);
+
+		const LidarPose &pose = poses[d];
+		float c = cos (pose.yaw), s = sin (pose.yaw);
+		for (int i=0; i<k; i++) {
+			float x = pose.x + c*points[2*i] - s*points[2*i+1],
+				y = pose.y + s*points[2*i] + c*points[2*i+1];
+			float r = sqrt (x*x + y*y);
+			int bin = (int)lround ((atan2 (y, x) + M_PI) / increment) % count;
+			// NaN loses
+			if (!(ranges[bin] <= r))
+				ranges[bin] = r;
+		}
+	}
+
+	out->min_angle = -M_PI;
+	out->angular_increment = increment;
+	out->max_angle = out->min_angle + (count-1)*increment;
+	out->scan_time = scanTime;
+	// readings are from car centre, which may be nearer than any lidar
+	out->min_range = 0;
+	out->max_range = maxRange;
+	out->device = MergedLidarDevice;
+	memset (out->_pad, 0, sizeof(out->_pad));
+	out->num_ranges = count;
+
+	reset ();
+	shared_ptr<Message> merged (new Message (LidarMergedMessageCategory, size, buffer));
+	merged->setTimestamp (oldest);
+	return merged;
+}
+
+} /* namespace Robocar */
@@ -0,0 +1,77 @@
+/*
+ * ScanMerger.h
+ */
+
+#ifndef ROBOCAR_SERVER_SCANMERGER_H_
+#define ROBOCAR_SERVER_SCANMERGER_H_
+
+
+#include "Message.h"
+#include "LaserProjection.h"
+#include <vector>
+#include <string>
+
+
+// Device number of merged scans
+#define MergedLidarDevice 0xff
+
+
+namespace Robocar {
+
+
+/*
+ * Where a lidar sits on the car, in metre and radian;
+ * x is forward, y to the left
+ */
+struct LidarPose
+{
+	float x, y, yaw;
+
+	LidarPose () : x (0), y (0), yaw (0) {}
+
+	// "x:y:yaw", yaw in degree; missing fields are zero
+	static bool parse (const std::string &spec, LidarPose &pose);
+};
+
+
+/*
+ * Builds full circle scans around the car from the scans of
+ * all lidars. Scans are grouped by timestamp; a group is sent
+ * once it has a scan from every working lidar, or, when one is missing,
+ * at the next scan of any lidar, so that at most one scan period
+ * is added. Groups left behind by a stalled lidar are dropped.
+ * Merged scans have no intensities.
+ */
+class ScanMerger
+{
+public:
+	ScanMerger (const std::vector<LidarPose> &_poses);
+
+	// Returns merged scan when a group is complete, and
+	// an empty pointer otherwise.
+	// scan is a message of HokuyoDriverMessageCategory
+	shared_ptr<Message> add (shared_ptr<Message> scan);
+
+	// Forget pending scans, when nobody wants merged scans
+	void reset ();
+
+private:
+	std::vector<LidarPose> poses;
+	std::vector<shared_ptr<Message> > pending;
+	int pendingCount;
+	// timestamp of the oldest pending scan
+	double pendingStart;
+	// seconds between two scans of each lidar, as seen last time
+	std::vector<double> lastStamp, interval;
+
+	std::vector<LaserProjection> projections;
+	std::vector<float> points;
+
+	double period ();
+	int alive (double now);
+	shared_ptr<Message> merge ();
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_SERVER_SCANMERGER_H_ */
@@ -0,0 +1,186 @@
+/*
+ * ScanShaper.cpp
+ */
+
+#include "ScanShaper.h"
+#include "HokuyoDriver.h"
+#include "MessageRegisters.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+
+namespace Robocar {
+
+
+static int gcd (int a, int b)
+{
+	while (b != 0) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+
+// Out of range codes (NaN, infinity, tiny values) lose against real readings
+static bool validRange (float r, float minRange)
+{
+	return std::isfinite (r) && r >= minRange;
+}
+
+
+ScanShaper::ScanShaper () :
+	request (LidarRequest::full ())
+{}
+
+
+void ScanShaper::setRequest (const _lidarRequestBuffer &req)
+{
+	request = req;
+	lastSent.clear ();
+}
+
+
+bool ScanShaper::due (Message &scan)
+{
+	if (request.max_rate <= 0 || scan.getSize() < sizeof(_hokuyoMessageBuffer) - 1)
+		return true;
+	_hokuyoMessageBuffer *in = (_hokuyoMessageBuffer*)scan.getContent();
+	timeval tv = scan.getTimestamp ();
+	double t = tv.tv_sec + tv.tv_usec*1e-6;
+	// half a scan of slack, so that rates dividing
+	// the device rate are met exactly
+	double &last = lastSent[in->device];
+	if (last > 0 && t - last < 1.0/request.max_rate - in->scan_time/2)
+		return false;
+	last = t;
+	return true;
+}
+
+
+shared_ptr<Message> ScanShaper::shape (shared_ptr<Message> scan, const _lidarRequestBuffer &request,
+	float nativeIncrement)
+{
+	const uint32_t headerSize = sizeof(_hokuyoMessageBuffer) - 1;
+	if (scan->getSize() < headerSize)
+		return scan;
+	_hokuyoMessageBuffer *in = (_hokuyoMessageBuffer*)scan->getContent();
+	int n = in->num_ranges;
+	if (scan->getSize() < headerSize + n*sizeof(float))
+		return scan;
+	bool hasIntensity = (scan->getSize() >= headerSize + 2*n*sizeof(float));
+
+	float inc = in->angular_increment;
+	int group = 1;
+	if (inc > 0 && request.decimation > 1)
+		group = std::max (1, (int)lround (request.decimation*nativeIncrement / inc));
+
+	int first = 0, last = n-1;
+	if (LidarRequest::hasWindow (request) && inc > 0) {
+		first = std::max (first, (int)ceil ((request.min_angle - in->min_angle)/inc - 1e-3));
+		last = std::min (last, (int)floor ((request.max_angle - in->min_angle)/inc + 1e-3));
+		if (last < first)
+			return shared_ptr<Message> ();
+	}
+
+	if (group==1 && first==0 && last==n-1)
+		return scan;
+
+	int count = (last - first + group) / group;
+	uint32_t size = headerSize + (hasIntensity ? 2 : 1) * count*sizeof(float);
+	shared_ptr<uint8_t> buffer (new uint8_t [size]);
+	_hokuyoMessageBuffer *out = (_hokuyoMessageBuffer*)buffer.get();
+	memcpy (out, in, headerSize);
+	out->min_angle = in->min_angle + first*inc;
+	out->angular_increment = inc*group;
+	out->max_angle = out->min_angle + (count-1)*out->angular_increment;
+	out->num_ranges = count;
+
+	const float *ranges = (const float*)&in->_ranges,
+		*intensities = ranges + n;
+	float *outRanges = (float*)&out->_ranges,
+		*outIntensities = outRanges + count;
+
+	for (int k=0; k<count; k++) {
+		int begin = first + k*group,
+			end = std::min (begin + group, last + 1);
+		int pick = begin;
+		for (int j=begin+1; j<end; j++) {
+			if (validRange (ranges[j], in->min_range) &&
+				(validRange (ranges[pick], in->min_range)==false || ranges[j] < ranges[pick]))
+				pick = j;
+		}
+		outRanges[k] = ranges[pick];
+		if (hasIntensity)
+			outIntensities[k] = intensities[pick];
+	}
+
+	shared_ptr<Message> shaped (new Message (HokuyoDriverMessageCategory, size, buffer));
+	shaped->setTimestamp (scan->getTimestamp ());
+	return shaped;
+}
+
+
+ScanFold ScanShaper::fold (const std::vector<_lidarRequestBuffer> &requests,
+	const hokuyo::LaserConfig &config)
+{
+	ScanFold f;
+	f.cluster = 0;
+	f.skip = MaximumDeviceSkip;
+	f.min_angle = f.max_angle = 0;
+
+	bool fullView = false;
+	float maxRate = 0;
+	for (size_t i=0; i<requests.size(); i++) {
+		const _lidarRequestBuffer &req = requests[i];
+		f.cluster = gcd (std::max ((int)req.decimation, 1), f.cluster);
+
+		if (LidarRequest::hasWindow (req)==false)
+			fullView = true;
+		else if (f.min_angle >= f.max_angle) {
+			f.min_angle = req.min_angle;
+			f.max_angle = req.max_angle;
+		}
+		else {
+			f.min_angle = std::min (f.min_angle, req.min_angle);
+			f.max_angle = std::max (f.max_angle, req.max_angle);
+		}
+
+		if (req.max_rate <= 0)
+			f.skip = 0;
+		else
+			maxRate = std::max (maxRate, req.max_rate);
+	}
+
+	if (requests.empty()) {
+		f.cluster = 1;
+		f.skip = 0;
+		return f;
+	}
+
+	// a divisor of the common factor small enough for the device
+	while (f.cluster > MaximumDeviceCluster) {
+		int d = 2;
+		while (f.cluster % d != 0)
+			d++;
+		f.cluster /= d;
+	}
+
+	if (fullView==true)
+		f.min_angle = f.max_angle = 0;
+	else {
+		// half a step of margin against rounding of device indices
+		f.min_angle = std::max (config.min_angle, f.min_angle - config.ang_increment/2);
+		f.max_angle = std::min (config.max_angle, f.max_angle + config.ang_increment/2);
+	}
+
+	if (f.skip > 0) {
+		double nativeRate = 1.0 / config.scan_time;
+		f.skip = std::min (MaximumDeviceSkip, std::max (0, (int)floor (nativeRate / maxRate + 1e-6) - 1));
+	}
+	return f;
+}
+
+} /* namespace Robocar */
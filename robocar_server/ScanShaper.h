@@ -0,0 +1,73 @@
+/*
+ * ScanShaper.h
+ */
+
+#ifndef ROBOCAR_SERVER_SCANSHAPER_H_
+#define ROBOCAR_SERVER_SCANSHAPER_H_
+
+
+#include "Message.h"
+#include "LidarRequest.h"
+#include "hokuyo.h"
+#include <vector>
+#include <map>
+
+
+// Largest cluster in SCIP (two digits)
+#define MaximumDeviceCluster 99
+// Largest skip in SCIP (one digit)
+#define MaximumDeviceSkip 9
+
+
+namespace Robocar {
+
+
+/*
+ * Device settings that satisfy every client at once
+ */
+struct ScanFold
+{
+	int cluster;
+	int skip;
+	// equal angles mean the whole field of view
+	float min_angle, max_angle;
+};
+
+
+/*
+ * Cuts lidar scans down to what one client requested. Scans may
+ * already be reduced by the device; whatever is left is done here,
+ * with the same rule as the device: the nearest reading of each
+ * group is kept.
+ */
+class ScanShaper
+{
+public:
+	ScanShaper ();
+
+	void setRequest (const _lidarRequestBuffer &req);
+	const _lidarRequestBuffer &getRequest () { return request; }
+
+	// Whether the client wants this scan at all, by its rate cap.
+	// Rate cap applies to each lidar separately.
+	bool due (Message &scan);
+
+	// Cuts a due scan to request. Returns scan itself when nothing
+	// needs to be done, and an empty pointer when nothing is left.
+	// nativeIncrement is angular resolution of the device without cluster.
+	static shared_ptr<Message> shape (shared_ptr<Message> scan, const _lidarRequestBuffer &request,
+		float nativeIncrement);
+
+	// Largest reduction of the device that all requests agree on
+	static ScanFold fold (const std::vector<_lidarRequestBuffer> &requests,
+		const hokuyo::LaserConfig &config);
+
+private:
+	_lidarRequestBuffer request;
+	// timestamp of last scan passed from each lidar, in second
+	std::map<uint8_t, double> lastSent;
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_SERVER_SCANSHAPER_H_ */
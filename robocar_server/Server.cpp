@@ -7,14 +7,36 @@
 #include "TextSensorDriver.h"
 #include "debug.h"
 #include "MessageRegisters.h"
+#include "Subscription.h"
+#include "ControlMessage.h"
+#include "ClientSession.h"
+#include "DriverStatus.h"
+#include "Report.h"
+#include "Governor.h"
+#include "LidarRequest.h"
+#include "ScanShaper.h"
+#include "ImageRequest.h"
+#include "ImageShaper.h"
+#include "LidarCompact.h"
+#include "LaserProjection.h"
+#include "ScanMerger.h"
+#include "SafetyStop.h"
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <cstdlib>
 #include <list>
+#include <map>
+#include <vector>
 #include <signal.h>
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/interprocess/sync/interprocess_semaphore.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #ifdef HW_ROBOCAR
 #include "DriveControl.h"
@@ -23,34 +45,113 @@
 
 
 using std::list;
+using std::map;
 using std::cerr;
 using std::exception;
 using std::string;
 using boost::asio::ip::tcp;
 using boost::asio::io_service;
 using boost::thread;
+using boost::interprocess::interprocess_mutex;
+using boost::interprocess::scoped_lock;
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
 typedef boost::interprocess::interprocess_semaphore semaphore;
 
 
 #define ROBOCAR_DEFAULT_PORT 1607
 
+// How long an unwanted driver keeps running before it is stopped
+#define DefaultLingerTime 5.0
+// Interval of housekeeping (reaping sessions, stopping idle drivers)
+#define HousekeepingInterval 200000
+// Sender queue depth that counts as overload for governor
+#define GovernorQueueBudget (MaximumPendingMessages/2)
+// Lidar scans in other encodings, made by the server from plain scans
+#define LidarAltCategories \
+	((1u << LidarCompactMessageCategory) | (1u << LidarPointsMessageCategory) | \
+	(1u << LidarMergedMessageCategory))
+// Lidar used when none is given
+#define DefaultLidarDevice "/dev/ttyACM0"
+
 
 namespace Robocar {
 
 
+/*
+ * What one client gets of a message, settled under session lock
+ * so that the work can be done without it
+ */
+struct ScanDelivery
+{
+	ClientSession *session;
+	bool plain, compact, points;
+	// false when the client sent no lidar request
+	bool shaped;
+	_lidarRequestBuffer request;
+};
+
+struct ImageDelivery
+{
+	ClientSession *session;
+	std::vector<_imageRequestBuffer> streams;
+};
+
+/*
+ * A driver as seen by the server: the category it produces,
+ * and how to start/stop it.
+ */
+struct DriverSlot
+{
+	uint8_t category;
+	// same stream in other encodings, as subscription bits
+	SubscriptionMask altCategories;
+	boost::function<void ()> start, stop;
+	// runtime reconfiguration; may be empty
+	boost::function<bool (uint8_t, int32_t)> configure;
+	boost::function<bool (uint8_t, int32_t&)> query;
+	// driver thread, for CPU accounting
+	thread *worker;
+	bool running;
+	// kept running without subscribers
+	bool pinned;
+	int subscribers;
+	// time when the last subscriber left
+	ptime idleSince;
+};
+
+
 class Server
 {
 public:
-	Server (bool _dryRun=false, bool _noVision=false) :
-		doStop (false),
-		lidardriver (NULL),
-		usbcamdriver (NULL),
+	Server (bool _dryRun=false, bool _noVision=false, bool _keepWarm=false,
+		double _lingerTime=DefaultLingerTime, double _cpuBudget=0,
+		bool _lowLatency=false, const string &_lidarFilter="",
+		const std::vector<string> &_lidarSpecs=std::vector<string>(),
+		bool _safety=false, const string &_safetySpec="",
+		const std::vector<string> &_cameraDevices=std::vector<string>(), bool _cameraSync=false) :
+		merger (NULL),
+		safety (NULL),
 #ifdef HW_ROBOCAR
 		camdriver (NULL),
 		imu (NULL),
 #endif
+		dispatcher (NULL),
+		housekeeper (NULL),
+		doStop (false),
 		dryRun (_dryRun),
-		noVision (_noVision)
+		noVision (_noVision),
+		keepWarm (_keepWarm),
+		lingerTime (_lingerTime),
+		cpuBudget (_cpuBudget),
+		governor (NULL),
+		lowLatency (_lowLatency),
+		lidarFilter (_lidarFilter),
+		lidarSpecs (_lidarSpecs),
+		safetyEnabled (_safety),
+		safetySpec (_safetySpec),
+		cameraDevices (_cameraDevices),
+		cameraSync (_cameraSync)
 	{
 		try {
 			// Initialize server internals
@@ -69,31 +170,45 @@ public:
 	{
 		// Initialize drivers
 		textdriver = new TextSensorDriver (serverQueue);
-		try {
-			lidardriver = new HokuyoSensorDriver (serverQueue, "/dev/ttyACM0");
-			debug ("LIDAR initialized");
-		} catch (exception &e) {
-			debug ("Unable to initialize LIDAR");
-		}
-		try {
-			if (noVision==false) {
-				usbcamdriver = new USBCameraDriver (serverQueue, "/dev/video0");
-				debug ("USB Camera initialized");
-			}
-		} catch (exception &e) {
-			debug ("Unable to initialize USB Camera");
-		}
+		registerDriver (TextSensorDriverMessageCategory,
+			boost::bind (&TextSensorDriver::start, textdriver),
+			boost::bind (&TextSensorDriver::stop, textdriver),
+			boost::function<bool (uint8_t, int32_t)> (),
+			boost::function<bool (uint8_t, int32_t&)> (),
+			textdriver->getThread ());
+		lidarInit ();
+		if (noVision==false)
+			usbCameraInit ();
 
 #ifdef HW_ROBOCAR
 		if (dryRun==false) {
 			DriveControl::startServer ();
+			if (safety != NULL) {
+				DriveControl *drive = DriveControl::getInstance ();
+				safety->setDrive (boost::bind (&DriveControl::getSpeed, drive),
+					boost::bind (&DriveControl::getDirection, drive),
+					boost::bind (&Server::safetyBrake, drive, _1),
+					boost::bind (&DriveControl::release, drive));
+			}
 
 			if (noVision==false) {
 				camdriver = new CameraDriver (serverQueue);
+				registerDriver (CameraDriverMessageCategory,
+					boost::bind (&CameraDriver::start, camdriver),
+					boost::bind (&CameraDriver::stop, camdriver),
+					boost::bind (&CameraDriver::setParameter, camdriver, _1, _2),
+					boost::bind (&CameraDriver::getParameter, camdriver, _1, _2),
+					camdriver->getThread ());
 				debug ("Built-in camera initialized");
 			}
 
 			imu = new IMUDriver (serverQueue);
+			registerDriver (IMUMessageCategory,
+				boost::bind (&IMUDriver::start, imu),
+				boost::bind (&IMUDriver::stop, imu),
+				boost::bind (&IMUDriver::setParameter, imu, _1, _2),
+				boost::function<bool (uint8_t, int32_t&)> (),
+				imu->getThread ());
 			debug ("IMU initialized");
 		}
 #endif
@@ -102,14 +217,148 @@ public:
 	}
 
 
+	/*
+	 * One driver for each lidar spec, "device[:x:y:yaw]". Lidars
+	 * are numbered in the order given; one that fails to open
+	 * keeps its number, so that the others don't change theirs.
+	 */
+	void lidarInit ()
+	{
+		if (lidarSpecs.empty())
+			lidarSpecs.push_back (DefaultLidarDevice);
+		if (lidarSpecs.size() > MaximumLidars)
+			lidarSpecs.resize (MaximumLidars);
+
+		std::vector<LidarPose> poses (lidarSpecs.size());
+		for (size_t i=0; i<lidarSpecs.size(); i++) {
+			size_t colon = lidarSpecs[i].find (':');
+			lidarDevices.push_back (lidarSpecs[i].substr (0, colon));
+			if (colon != string::npos &&
+				LidarPose::parse (lidarSpecs[i].substr (colon+1), poses[i])==false)
+				debug ("Invalid lidar pose: %s", lidarSpecs[i].c_str());
+		}
+
+		for (size_t i=0; i<lidarDevices.size(); i++) {
+			try {
+				HokuyoSensorDriver *lidar = new HokuyoSensorDriver (serverQueue,
+					lidarDevices[i].c_str(), lowLatency, i);
+				if (lidarFilter.empty()==false && lidar->setFilter (lidarFilter)==false)
+					debug ("Invalid lidar filter: %s", lidarFilter.c_str());
+				registerDriver (HokuyoDriverMessageCategory,
+					boost::bind (&HokuyoSensorDriver::start, lidar),
+					boost::bind (&HokuyoSensorDriver::stop, lidar),
+					boost::bind (&HokuyoSensorDriver::setParameter, lidar, _1, _2),
+					boost::function<bool (uint8_t, int32_t&)> (),
+					lidar->getThread ());
+				drivers.back().altCategories = LidarAltCategories;
+				lidars.push_back (lidar);
+				debug ("LIDAR %d initialized on %s", i, lidarDevices[i].c_str());
+			} catch (exception &e) {
+				lidars.push_back (NULL);
+				debug ("Unable to initialize LIDAR on %s", lidarDevices[i].c_str());
+			}
+		}
+		merger = new ScanMerger (poses);
+
+		/*
+		 * The check must see every reading of every scan, whether
+		 * anyone is listening or not: lidars run all the time, over
+		 * their whole field of view, and clients get their cut from
+		 * ScanShaper alone
+		 */
+		if (safetyEnabled) {
+			SafetyFootprint footprint;
+			if (footprint.parse (safetySpec)==false)
+				debug ("Invalid safety footprint: %s", safetySpec.c_str());
+			safety = new SafetyStop (serverQueue, poses, footprint);
+			for (size_t i=0; i<lidars.size(); i++)
+				if (lidars[i]) {
+					lidars[i]->setScanHook (boost::bind (&SafetyStop::check, safety, _1, _2, _3, _4, _5));
+					lidars[i]->setScanShape (1, 0, 0, 0);
+				}
+			for (size_t i=0; i<drivers.size(); i++)
+				if (drivers[i].category==HokuyoDriverMessageCategory)
+					drivers[i].pinned = true;
+			debug ("Safety stop enabled");
+		}
+	}
+
+
+	/*
+	 * Each camera has a driver and a thread of its own, unless they
+	 * are to be captured together. Cameras keep their number from
+	 * command line in either case.
+	 */
+	void usbCameraInit ()
+	{
+		if (cameraDevices.empty())
+			cameraDevices.push_back (defaultCameraDevice);
+
+		std::vector<std::vector<string> > sets;
+		if (cameraSync)
+			sets.push_back (cameraDevices);
+		else
+			for (size_t i=0; i<cameraDevices.size(); i++)
+				sets.push_back (std::vector<string> (1, cameraDevices[i]));
+
+		for (int i=0, device=0; i<(int)sets.size(); device+=sets[i].size(), i++) {
+			try {
+				USBCameraDriver *usbcam = new USBCameraDriver (serverQueue, sets[i], device);
+				registerDriver (USBCameraDriverMessageCategory,
+					boost::bind (&USBCameraDriver::start, usbcam),
+					boost::bind (&USBCameraDriver::stop, usbcam),
+					boost::bind (&USBCameraDriver::setParameter, usbcam, _1, _2),
+					boost::bind (&USBCameraDriver::getParameter, usbcam, _1, _2),
+					usbcam->getThread ());
+				usbcams.push_back (usbcam);
+				debug ("USB Camera %d initialized on %s%s", device, sets[i][0].c_str(),
+					(sets[i].size() > 1 ? " and others, synchronized" : ""));
+			} catch (exception &e) {
+				debug ("Unable to initialize USB Camera on %s: %s", sets[i][0].c_str(), e.what());
+			}
+		}
+	}
+
+
+#ifdef HW_ROBOCAR
+	static void safetyBrake (DriveControl *drive, bool forward)
+	{
+		drive->brake (forward ? GEAR_DRIVE : GEAR_RETREAT);
+	}
+#endif
+
+
+	void registerDriver (uint8_t category,
+		boost::function<void ()> start,
+		boost::function<void ()> stop,
+		boost::function<bool (uint8_t, int32_t)> configure,
+		boost::function<bool (uint8_t, int32_t&)> query=boost::function<bool (uint8_t, int32_t&)>(),
+		thread *worker=NULL)
+	{
+		DriverSlot slot;
+		slot.category = category;
+		slot.altCategories = 0;
+		slot.start = start;
+		slot.stop = stop;
+		slot.configure = configure;
+		slot.query = query;
+		slot.worker = worker;
+		slot.running = false;
+		slot.pinned = false;
+		slot.subscribers = 0;
+		drivers.push_back (slot);
+	}
+
+
 	void driverStart ()
 	{
 		// Starting drivers
 		textdriver->start();
-		if (lidardriver)
-			lidardriver->start ();
-		if (usbcamdriver)
-			usbcamdriver->start ();
+		for (size_t i=0; i<lidars.size(); i++)
+			if (lidars[i])
+				lidars[i]->start ();
+		for (size_t i=0; i<usbcams.size(); i++)
+			usbcams[i]->start ();
 
 #ifdef HW_ROBOCAR
 		if (dryRun==false) {
@@ -128,10 +377,11 @@ public:
 	void driverStop ()
 	{
 		textdriver->stop();
-		if (lidardriver)
-			lidardriver->stop ();
-		if (usbcamdriver)
-			usbcamdriver->stop ();
+		for (size_t i=0; i<lidars.size(); i++)
+			if (lidars[i])
+				lidars[i]->stop ();
+		for (size_t i=0; i<usbcams.size(); i++)
+			usbcams[i]->stop ();
 #ifdef HW_ROBOCAR
 		if (dryRun==false) {
 			if (camdriver != NULL) {
@@ -148,12 +398,12 @@ public:
 	{
 		try {
 			delete textdriver;
-			if (usbcamdriver != NULL) {
-				delete usbcamdriver;
-			}
-			if (lidardriver != NULL) {
-				delete lidardriver;
-			}
+			for (size_t i=0; i<usbcams.size(); i++)
+				delete usbcams[i];
+			for (size_t i=0; i<lidars.size(); i++)
+				delete lidars[i];
+			delete merger;
+			delete safety;
 		} catch (std::exception &e) {}
 
 #ifdef HW_ROBOCAR
@@ -169,39 +419,465 @@ public:
 
 	void start ()
 	{
-		acceptor->listen(1);
-		tcp::socket *socket;
-		int clientCount = 0;
+		acceptor->listen();
+
+		// In keep-warm mode the drivers run for the whole lifetime
+		// of the server; only the queue is opened and closed
+		// following the clients
+		if (keepWarm==true) {
+			serverQueue->disable ();
+			driverStart ();
+			for (size_t i=0; i<drivers.size(); i++)
+				drivers[i].running = true;
+		}
+		else {
+			for (size_t i=0; i<drivers.size(); i++)
+				if (drivers[i].pinned) {
+					drivers[i].start ();
+					drivers[i].running = true;
+				}
+		}
+
+		dispatcher = new thread (&dispatchEntryPoint, this);
+		if (cpuBudget > 0)
+			governorInit ();
+		housekeeper = new thread (&housekeepingEntryPoint, this);
 
 		while (doStop == false) {
 
-			socket = new tcp::socket (*iosrv);
+			tcp::socket *socket = new tcp::socket (*iosrv);
 
 			debug ("Accepting...");
-			acceptor->accept (*socket);
+			try {
+				acceptor->accept (*socket);
+			} catch (boost::system::system_error &serr) {
+				delete (socket);
+				continue;
+			}
 			debug ("Get client !");
-			clientCount += 1;
 
-			driverStart ();
+			ClientSession *session = new ClientSession (socket,
+				boost::bind (&Server::handleRequest, this, _1, _2));
+
+			scoped_lock<interprocess_mutex> lock (sessionLock);
+			sessions.push_back (session);
+			if (keepWarm==true)
+				serverQueue->enable ();
+			session->start ();
+			// new clients learn the current health of every driver
+			for (map<std::pair<uint8_t, uint8_t>, shared_ptr<Message> >::iterator it=driverHealth.begin();
+				it!=driverHealth.end(); it++)
+				session->reply (it->second);
+			updateDemand ();
+		}
+	}
+
+
+	static void dispatchEntryPoint (Server *srv)
+	{ srv->dispatch (); }
+
+
+	static void housekeepingEntryPoint (Server *srv)
+	{ srv->housekeeping (); }
+
+
+	/*
+	 * Forward each message to the clients that subscribed to it.
+	 * Who gets what is settled under sessionLock; scans and images
+	 * are then cut, encoded and delivered without it, so that
+	 * requests and new clients don't wait for that work.
+	 * dispatchLock keeps sessions and their encoders meanwhile.
+	 */
+	void dispatch ()
+	{
+		while (doStop == false) {
+			shared_ptr<Message> msg = serverQueue->pop ();
+			// empty message only wakes us up to stop
+			if (!msg)
+				continue;
+			scoped_lock<interprocess_mutex> working (dispatchLock);
+			scoped_lock<interprocess_mutex> lock (sessionLock);
+
+			// Driver health goes to everyone, regardless of subscription
+			if (msg->getType()==DriverStatusMessageCategory) {
+				_driverStatusBuffer *status = DriverStatus::parse (*msg);
+				if (status==NULL)
+					continue;
+				driverHealth[std::make_pair (status->category, status->device)] = msg;
+				for (list<ClientSession*>::iterator it=sessions.begin(); it!=sessions.end(); it++)
+					(*it)->reply (msg);
+				continue;
+			}
+
+			// Each client gets its own cut of lidar scans,
+			// in the encoding it asked for
+			if (msg->getType()==HokuyoDriverMessageCategory) {
+				if (msg->getSize() < sizeof(_hokuyoMessageBuffer)-1)
+					continue;
+				uint8_t device = ((_hokuyoMessageBuffer*)msg->getContent())->device;
+				if (device >= lidars.size() || lidars[device]==NULL)
+					continue;
+				float nativeIncrement = lidars[device]->getConfig().ang_increment;
+
+				std::vector<ClientSession*> mergedTargets;
+				std::vector<ScanDelivery> targets;
+				for (list<ClientSession*>::iterator it=sessions.begin(); it!=sessions.end(); it++) {
+					if ((*it)->wants (LidarMergedMessageCategory))
+						mergedTargets.push_back (*it);
+					ScanDelivery d;
+					d.session = *it;
+					d.plain = (*it)->wants (HokuyoDriverMessageCategory);
+					d.compact = (*it)->wants (LidarCompactMessageCategory);
+					d.points = (*it)->wants (LidarPointsMessageCategory);
+					if (d.plain==false && d.compact==false && d.points==false)
+						continue;
+					map<ClientSession*, ScanShaper>::iterator shaper = scanShapers.find (*it);
+					d.shaped = (shaper != scanShapers.end());
+					if (d.shaped) {
+						if (shaper->second.due (*msg)==false)
+							continue;
+						d.request = shaper->second.getRequest ();
+					}
+					targets.push_back (d);
+				}
+				lock.unlock ();
+
+				dispatchMerged (msg, mergedTargets);
+				for (size_t i=0; i<targets.size(); i++) {
+					const ScanDelivery &d = targets[i];
+					shared_ptr<Message> shaped = (d.shaped ?
+						ScanShaper::shape (msg, d.request, nativeIncrement) : msg);
+					if (!shaped)
+						continue;
+
+					if (d.plain)
+						d.session->deliver (shaped);
+					if (d.compact) {
+						LidarCompactEncoder &encoder = compactEncoders[d.session][device];
+						// config must be resent if this one is dropped
+						if (d.session->deliver (encoder.encode (*shaped))==false)
+							encoder.reset ();
+					}
+					if (d.points)
+						d.session->deliver (projections[d.session][device].toMessage (*shaped));
+				}
+				continue;
+			}
+
+			// Camera images are cut to each client's streams; clients
+			// asking the same shape share the pixels
+			if (msg->getType()==USBCameraDriverMessageCategory || msg->getType()==CameraDriverMessageCategory) {
+				std::vector<ImageDelivery> targets;
+				for (list<ClientSession*>::iterator it=sessions.begin(); it!=sessions.end(); it++) {
+					if ((*it)->wants (msg->getType())==false)
+						continue;
+					ImageDelivery d;
+					d.session = *it;
+					map<ClientSession*, ImageShaper>::iterator shaper = imageShapers.find (*it);
+					if (shaper != imageShapers.end())
+						shaper->second.plan (*msg, d.streams);
+					else
+						d.streams.push_back (ImageRequest::full (msg->getType(), 0));
+					targets.push_back (d);
+				}
+				lock.unlock ();
+
+				ImageCache cache;
+				for (size_t i=0; i<targets.size(); i++) {
+					for (size_t s=0; s<targets[i].streams.size(); s++) {
+						shared_ptr<Message> image = ImageShaper::shape (msg, targets[i].streams[s], cache);
+						if (image)
+							targets[i].session->deliver (image);
+					}
+				}
+				continue;
+			}
+
+			for (list<ClientSession*>::iterator it=sessions.begin(); it!=sessions.end(); it++) {
+				(*it)->deliver (msg);
+			}
+		}
+	}
 
-			while (true) {
-				if (socket->is_open()==false || doStop==true) break;
-				shared_ptr<Message> msg = serverQueue->pop ();
-				try {
-					msg->send (*socket);
-					int tp = (int)msg->getType();
-					//cout << "Sent message " << tp << endl;
-				} catch (boost::system::system_error &serr) {
-					debug ("Unable to send");
-					break;
+
+	/*
+	 * Merged scans are the same for all clients, and only
+	 * made while someone wants them.
+	 * Must be called with dispatchLock held.
+	 */
+	void dispatchMerged (shared_ptr<Message> scan, const std::vector<ClientSession*> &targets)
+	{
+		if (targets.empty()) {
+			merger->reset ();
+			return;
+		}
+
+		shared_ptr<Message> merged = merger->add (scan);
+		if (!merged)
+			return;
+		for (size_t i=0; i<targets.size(); i++)
+			targets[i]->deliver (merged);
+	}
+
+
+	void housekeeping ()
+	{
+		long sinceSample = 0;
+		while (doStop == false) {
+			usleep (HousekeepingInterval);
+			reapSessions ();
+			stopIdleDrivers ();
+			sinceSample += HousekeepingInterval;
+			if (governor != NULL && sinceSample >= GovernorInterval) {
+				governor->sample ();
+				sinceSample = 0;
+			}
+		}
+	}
+
+
+	// Called by sessions' receiver thread
+	void handleRequest (ClientSession *session, shared_ptr<Message> request)
+	{
+		switch (request->getType()) {
+
+		case SubscriptionMessageCategory: {
+			scoped_lock<interprocess_mutex> lock (sessionLock);
+			session->setSubscription (Subscription::parse (*request));
+			updateDemand ();
+			break;
+		}
+
+		case ControlMessageCategory: {
+			_controlMessageBuffer *ctrl = ControlMessage::parse (*request);
+			if (ctrl==NULL)
+				break;
+			uint8_t status = configureDriver (ctrl->target, ctrl->parameter, ctrl->value) ?
+				CONTROL_ACCEPTED : CONTROL_REJECTED;
+			session->reply (ControlMessage::create (ctrl->target, ctrl->parameter, ctrl->value, status));
+			break;
+		}
+
+		case LidarRequestMessageCategory: {
+			_lidarRequestBuffer *req = LidarRequest::parse (*request);
+			if (req==NULL)
+				break;
+			scoped_lock<interprocess_mutex> lock (sessionLock);
+			scanShapers[session].setRequest (*req);
+			updateDemand ();
+			break;
+		}
+
+		case ImageRequestMessageCategory: {
+			_imageRequestBuffer *req = ImageRequest::parse (*request);
+			if (req==NULL)
+				break;
+			scoped_lock<interprocess_mutex> lock (sessionLock);
+			imageShapers[session].setRequest (*req);
+			break;
+		}
+
+		default:
+			debug ("Unknown request %d", (int)request->getType());
+		}
+	}
+
+
+	bool configureDriver (uint8_t category, uint8_t parameter, int32_t value)
+	{
+		// every lidar takes the same setting
+		bool done = false;
+		for (size_t i=0; i<drivers.size(); i++) {
+			if ((drivers[i].category==category || isSubscribed (drivers[i].altCategories, category)) &&
+				drivers[i].configure)
+				done = drivers[i].configure (parameter, value) || done;
+		}
+		return done;
+	}
+
+
+	bool queryDriver (uint8_t category, uint8_t parameter, int32_t &value)
+	{
+		for (size_t i=0; i<drivers.size(); i++) {
+			if (drivers[i].category==category && drivers[i].query)
+				return drivers[i].query (parameter, value);
+		}
+		return false;
+	}
+
+
+	// Deepest sender queue among clients
+	size_t queueDepth ()
+	{
+		size_t depth = 0;
+		scoped_lock<interprocess_mutex> lock (sessionLock);
+		for (list<ClientSession*>::iterator it=sessions.begin(); it!=sessions.end(); it++) {
+			if ((*it)->pending() > depth)
+				depth = (*it)->pending();
+		}
+		return depth;
+	}
+
+
+	void broadcast (shared_ptr<Message> msg)
+	{
+		scoped_lock<interprocess_mutex> lock (sessionLock);
+		for (list<ClientSession*>::iterator it=sessions.begin(); it!=sessions.end(); it++)
+			(*it)->reply (msg);
+	}
+
+
+	/*
+	 * Lidar and IMU are never degraded. Cheapest losses first:
+	 * USB camera JPEG quality, its rate, then its resolution, then the stereo
+	 * camera rate, and finally its rectification is skipped by
+	 * sending raw half-size left image.
+	 */
+	void governorInit ()
+	{
+		governor = new Governor (cpuBudget, GovernorQueueBudget,
+			boost::bind (&Server::configureDriver, this, _1, _2, _3),
+			boost::bind (&Server::queryDriver, this, _1, _2, _3),
+			boost::bind (&Server::queueDepth, this),
+			boost::bind (&Server::broadcast, this, _1));
+
+		for (size_t i=0; i<drivers.size(); i++)
+			governor->watch (drivers[i].category, drivers[i].worker);
+		governor->watch (0, dispatcher);
+		// JPEG workers come with the first compressed image
+		for (size_t i=0; i<usbcams.size(); i++)
+			usbcams[i]->setWorkerHook (boost::bind (&Governor::watch, governor,
+				USBCameraDriverMessageCategory, _1));
+
+		governor->addStep (USBCameraDriverMessageCategory, CONTROL_JPEG_QUALITY, 50);
+		governor->addStep (USBCameraDriverMessageCategory, CONTROL_FRAME_RATE, 5);
+		governor->addStep (USBCameraDriverMessageCategory,
+			CONTROL_IMAGE_WIDTH, 320, CONTROL_IMAGE_HEIGHT, 240);
+#ifdef HW_ROBOCAR
+		governor->addStep (CameraDriverMessageCategory, CONTROL_FRAME_RATE, 3);
+		governor->addStep (CameraDriverMessageCategory, CONTROL_IMAGE_OUTPUT, zmp::zrc::SOF_INPUT_L_HALF);
+#endif
+		debug ("Governor budget: %.0f%% CPU", cpuBudget);
+	}
+
+
+	void reapSessions ()
+	{
+		list<ClientSession*> dead;
+
+		// not while dispatcher works on them
+		scoped_lock<interprocess_mutex> working (dispatchLock);
+		scoped_lock<interprocess_mutex> lock (sessionLock);
+		for (list<ClientSession*>::iterator it=sessions.begin(); it!=sessions.end(); ) {
+			if ((*it)->isAlive()==false) {
+				dead.push_back (*it);
+				scanShapers.erase (*it);
+				imageShapers.erase (*it);
+				compactEncoders.erase (*it);
+				projections.erase (*it);
+				it = sessions.erase (it);
+			}
+			else it++;
+		}
+		if (dead.empty())
+			return;
+
+		debug ("Client closing!");
+		if (keepWarm==true && sessions.empty())
+			serverQueue->disable ();
+		updateDemand ();
+		lock.unlock ();
+
+		for (list<ClientSession*>::iterator it=dead.begin(); it!=dead.end(); it++)
+			delete (*it);
+	}
+
+
+	/*
+	 * Count subscribers of each driver; start wanted drivers
+	 * immediately, mark unwanted ones as idle.
+	 * Must be called with sessionLock held.
+	 */
+	void updateDemand ()
+	{
+		for (size_t i=0; i<drivers.size(); i++) {
+			DriverSlot &slot = drivers[i];
+			slot.subscribers = 0;
+			for (list<ClientSession*>::iterator it=sessions.begin(); it!=sessions.end(); it++) {
+				if ((*it)->isAlive()==false)
+					continue;
+				if ((*it)->wants(slot.category) || (*it)->wantsAny(slot.altCategories))
+					slot.subscribers += 1;
+			}
+
+			if (slot.subscribers > 0) {
+				slot.idleSince = ptime ();
+				if (slot.running==false) {
+					debug ("Starting driver for category %d", (int)slot.category);
+					slot.start ();
+					slot.running = true;
 				}
 			}
-			debug ("Client closing!");
+			else if (slot.running==true && slot.pinned==false && slot.idleSince.is_not_a_date_time())
+				slot.idleSince = microsec_clock::local_time ();
+		}
+		updateScanFold ();
+	}
 
-			driverStop();
-			socket->close();
-			delete (socket);
 
+	/*
+	 * Ask the lidar for no more than what its clients want
+	 * together. Clients without request want everything.
+	 * Safety stop keeps the whole scan, see lidarInit().
+	 * Must be called with sessionLock held.
+	 */
+	void updateScanFold ()
+	{
+		if (lidars.empty() || safety != NULL)
+			return;
+
+		std::vector<_lidarRequestBuffer> requests;
+		for (list<ClientSession*>::iterator it=sessions.begin(); it!=sessions.end(); it++) {
+			if ((*it)->isAlive()==false)
+				continue;
+			if ((*it)->wants(HokuyoDriverMessageCategory)==false &&
+				(*it)->wantsAny(LidarAltCategories)==false)
+				continue;
+			map<ClientSession*, ScanShaper>::iterator shaper = scanShapers.find (*it);
+			requests.push_back (shaper==scanShapers.end() ?
+				LidarRequest::full() : shaper->second.getRequest());
+		}
+		// Keep current shape until someone wants scans again
+		if (requests.empty())
+			return;
+
+		for (size_t i=0; i<lidars.size(); i++) {
+			if (lidars[i]==NULL)
+				continue;
+			ScanFold f = ScanShaper::fold (requests, lidars[i]->getConfig());
+			lidars[i]->setScanShape (f.cluster, f.skip, f.min_angle, f.max_angle);
+		}
+	}
+
+
+	// Drivers that nobody wants after linger time are stopped, unless pinned
+	void stopIdleDrivers ()
+	{
+		if (keepWarm==true)
+			return;
+
+		scoped_lock<interprocess_mutex> lock (sessionLock);
+		ptime now = microsec_clock::local_time ();
+		for (size_t i=0; i<drivers.size(); i++) {
+			DriverSlot &slot = drivers[i];
+			if (slot.running==false || slot.pinned || slot.subscribers > 0 || slot.idleSince.is_not_a_date_time())
+				continue;
+			if ((now - slot.idleSince).total_milliseconds() >= lingerTime*1000) {
+				debug ("Stopping driver for category %d", (int)slot.category);
+				slot.stop ();
+				slot.running = false;
+				slot.idleSince = ptime ();
+			}
 		}
 	}
 
@@ -213,6 +889,28 @@ public:
 
 	~Server ()
 	{
+		// server threads must be gone before what they use
+		doStop = true;
+		serverQueue->push (shared_ptr<Message> (), true);
+		if (dispatcher != NULL) {
+			dispatcher->join ();
+			delete dispatcher;
+		}
+		if (housekeeper != NULL) {
+			housekeeper->join ();
+			delete housekeeper;
+		}
+		for (size_t i=0; i<usbcams.size(); i++)
+			usbcams[i]->setWorkerHook (USBCameraDriver::WorkerHook ());
+		delete governor;
+
+		// disconnect clients
+		{
+			scoped_lock<interprocess_mutex> lock (sessionLock);
+			for (list<ClientSession*>::iterator it=sessions.begin(); it!=sessions.end(); it++)
+				(*it)->close ();
+		}
+
 		// stop drivers and erase their threads
 		driverStop ();
 		driverDelete();
@@ -232,13 +930,34 @@ private:
 	tcp::acceptor *acceptor;
 	io_service *iosrv;
 	TextSensorDriver *textdriver;
-	USBCameraDriver *usbcamdriver;
-	HokuyoSensorDriver *lidardriver;
+	std::vector<USBCameraDriver*> usbcams;
+	// by device number; NULL if it could not be opened
+	std::vector<HokuyoSensorDriver*> lidars;
+	ScanMerger *merger;
+	// runs in lidar threads; NULL if not enabled
+	SafetyStop *safety;
 #ifdef HW_ROBOCAR
 	CameraDriver *camdriver;
 	IMUDriver *imu;
 #endif
 
+	std::vector<DriverSlot> drivers;
+	list<ClientSession*> sessions;
+	interprocess_mutex sessionLock;
+	// held by dispatcher for each message; taken before sessionLock
+	interprocess_mutex dispatchLock;
+	thread *dispatcher, *housekeeper;
+	// last status reported by each driver, by category and device
+	map<std::pair<uint8_t, uint8_t>, shared_ptr<Message> > driverHealth;
+	// clients that sent lidar request
+	map<ClientSession*, ScanShaper> scanShapers;
+	// clients that sent image request
+	map<ClientSession*, ImageShaper> imageShapers;
+	// clients that want compact lidar scans, for each lidar
+	map<ClientSession*, map<uint8_t, LidarCompactEncoder> > compactEncoders;
+	// clients that want lidar points; tables follow their shape
+	map<ClientSession*, map<uint8_t, LaserProjection> > projections;
+
 	volatile bool doStop;
 	// if this variable is true, all routines correspond
 	// to Robocar hardware will be skipped
@@ -246,6 +965,26 @@ private:
 	// if this variable is true, all vision drivers
 	// (cameras) will be disabled
 	bool noVision;
+	// if this variable is true, drivers are not stopped
+	// when client disconnects
+	bool keepWarm;
+	// seconds before a driver without subscribers is stopped
+	double lingerTime;
+	// percent of one core the drivers may use; 0 disables governor
+	double cpuBudget;
+	Governor *governor;
+	// low-latency serial settings for lidar
+	bool lowLatency;
+	// see ScanFilter::configure()
+	string lidarFilter;
+	// "device[:x:y:yaw]" of each lidar, and the devices alone
+	std::vector<string> lidarSpecs, lidarDevices;
+	// stop the car from lidar scans, see SafetyFootprint::parse()
+	bool safetyEnabled;
+	string safetySpec;
+	// video devices, numbered in this order; captured together if cameraSync
+	std::vector<string> cameraDevices;
+	bool cameraSync;
 };
 
 }
@@ -266,26 +1005,66 @@ void signalHandler (int s)
 
 int main (int argc, char **argv)
 {
-	bool dryRun = false, noVision = false;
-	if (argc > 1) {
-		string cmdarg1 (argv[1]);
-		if (cmdarg1=="-nr") {
+	bool dryRun = false, noVision = false, keepWarm = false;
+	double lingerTime = DefaultLingerTime;
+	double cpuBudget = 0;
+	bool lowLatency = false;
+	string lidarFilter;
+	std::vector<string> lidarSpecs;
+	string safetySpec;
+	bool safety = false;
+	std::vector<string> cameraDevices;
+	bool cameraSync = false;
+	for (int i=1; i<argc; i++) {
+		string cmdarg (argv[i]);
+		if (cmdarg=="-nr") {
 			dryRun = true;
 		}
-		else if (cmdarg1=="-nc") {
+		else if (cmdarg=="-nc") {
 			noVision = true;
 		}
-		else if (cmdarg1=="-ncr" || cmdarg1=="nrc") {
+		else if (cmdarg=="-ncr" || cmdarg=="nrc") {
 			dryRun = true;
 			noVision = true;
 		}
+		else if (cmdarg=="-kw") {
+			keepWarm = true;
+		}
+		else if (cmdarg=="-linger" && i+1<argc) {
+			lingerTime = atof (argv[++i]);
+		}
+		else if (cmdarg=="-lowlat") {
+			lowLatency = true;
+		}
+		else if (cmdarg=="-budget" && i+1<argc) {
+			cpuBudget = atof (argv[++i]);
+		}
+		else if (cmdarg=="-filter" && i+1<argc) {
+			lidarFilter = argv[++i];
+		}
+		else if (cmdarg=="-lidar" && i+1<argc) {
+			lidarSpecs.push_back (argv[++i]);
+		}
+		// footprint is optional
+		else if (cmdarg=="-safety") {
+			safety = true;
+			if (i+1<argc && argv[i+1][0] != '-')
+				safetySpec = argv[++i];
+		}
+		else if (cmdarg=="-usbcam" && i+1<argc) {
+			cameraDevices.push_back (argv[++i]);
+		}
+		else if (cmdarg=="-camsync") {
+			cameraSync = true;
+		}
 	}
 
-	Robocar::Server srv (dryRun, noVision);
-	_server = &srv;
+	// deleted by signal handler
+	_server = new Robocar::Server (dryRun, noVision, keepWarm, lingerTime, cpuBudget, lowLatency,
+		lidarFilter, lidarSpecs, safety, safetySpec, cameraDevices, cameraSync);
 
 	signal (SIGTERM, signalHandler);
 	signal (SIGINT, signalHandler);
 
-	srv.start();
+	_server->start();
 }
@@ -38,6 +38,8 @@ public:
 	void start ();
 	void stop ();
 
+	thread *getThread () { return drvThread; }
+
 private:
 	MessageQueue *srvQueue;
 	thread *drvThread;
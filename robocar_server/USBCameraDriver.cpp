@@ -6,34 +6,225 @@
  */
 
 #include "USBCameraDriver.h"
+#include "V4L2Capture.h"
+#include "CaptureGroup.h"
+#include "JpegPool.h"
 #include <unistd.h>
 #include <string.h>
 #include "debug.h"
 #include "MessageRegisters.h"
+#include "ControlMessage.h"
+#include "ColorConvert.h"
+#include "Report.h"
 #include <zlib.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <time.h>
 
 
 
 
 namespace Robocar {
 
-USBCameraDriver::USBCameraDriver(MessageQueue *_msgq, const char *_devfilename) :
-	devfilename (_devfilename),
-	camera (NULL),
-	doStop (false), doQuit(false),
+USBCameraDriver::USBCameraDriver(MessageQueue *_msgq, const std::vector<std::string> &_devices,
+	uint8_t _firstDevice) :
 	srvQueue (_msgq),
-	lastImageSize (0)
+	doStop (false), doQuit(false),
+	group (NULL),
+	firstDevice (_firstDevice),
+	opened (false),
+	width (defaultImageWidth), height (defaultImageHeight),
+	frameRate (defaultFrameRate),
+	format (IMAGE_RGB24),
+	reconfigure (false),
+	pacing (true),
+	nextDue (0),
+	changeThreshold (0),
+	jpegPool (NULL),
+	jpegQuality (JpegDefaultQuality),
+	jpegSubsampling (JPEG_420),
+	lastReport (0),
+	sentFrames (0), droppedFrames (0), lastSequence (0),
+	latency (0), maxLatency (0),
+	stillFrames (0), savedBytes (0)
 {
-	this->init ();
+	pendingWidth = width;
+	pendingHeight = height;
+	pendingFrameRate = frameRate;
+	pendingFormat = format;
+	for (size_t i=0; i<_devices.size(); i++)
+		cameras.push_back (new V4L2Capture (_devices[i]));
+	if (cameras.size() > 1)
+		group = new CaptureGroup (cameras, 0);
+	detectors.resize (cameras.size());
+	try {
+		this->init ();
+	} catch (std::exception &e) {
+		releaseCameras ();
+		for (size_t i=0; i<cameras.size(); i++)
+			delete cameras[i];
+		delete group;
+		throw;
+	}
 	startSignal = new semaphore (0);
 	drvThread = new thread (&threadEntryPoint, this);
-	setFrameRate();
+}
+
+
+// UYVY and MJPEG are asked for as such; the others are made from YUYV
+static V4L2Capture::PixelFormat captureFormat (int format)
+{
+	switch (format) {
+	case IMAGE_UYVY:
+		return V4L2Capture::FORMAT_UYVY;
+	case IMAGE_MJPEG:
+		return V4L2Capture::FORMAT_MJPEG;
+	default:
+		return V4L2Capture::FORMAT_YUYV;
+	}
 }
 
 
 void USBCameraDriver::init ()
 {
-	camera = usb_cam_camera_start(devfilename, 640, 480, defaultFrameRate);
+	for (size_t i=0; i<cameras.size(); i++)
+		cameras[i]->start (width, height, frameRate, captureFormat (format));
+	if (group != NULL) {
+		// half a frame apart at most
+		group->reset ();
+		group->setTolerance (500000000ULL / frameRate);
+	}
+	opened = true;
+	nextDue = 0;
+	for (size_t i=0; i<detectors.size(); i++)
+		detectors[i].reset ();
+}
+
+
+void USBCameraDriver::releaseCameras ()
+{
+	if (group != NULL)
+		group->reset ();
+	for (size_t i=0; i<cameras.size(); i++)
+		cameras[i]->stop ();
+	opened = false;
+}
+
+
+bool USBCameraDriver::setParameter (uint8_t parameter, int32_t value)
+{
+	switch (parameter) {
+	case CONTROL_FRAME_RATE:
+		if (value < 1 || value > 60)
+			return false;
+		pendingFrameRate = value;
+		break;
+	case CONTROL_IMAGE_WIDTH:
+		if (value < 32 || value > 4096)
+			return false;
+		pendingWidth = value;
+		break;
+	case CONTROL_IMAGE_HEIGHT:
+		if (value < 32 || value > 4096)
+			return false;
+		pendingHeight = value;
+		break;
+	case CONTROL_IMAGE_FORMAT:
+		if (value < IMAGE_RGB24 || value > IMAGE_JPEG)
+			return false;
+		pendingFormat = value;
+		break;
+	// takes effect at once, without reopening
+	case CONTROL_FRAME_PACING:
+		if (value < 0 || value > 1)
+			return false;
+		pacing = value;
+		return true;
+	case CONTROL_CHANGE_THRESHOLD:
+		if (value < 0 || value > 255)
+			return false;
+		changeThreshold = value;
+		return true;
+	// both take effect at once
+	case CONTROL_JPEG_QUALITY:
+		if (value < 1 || value > 100)
+			return false;
+		jpegQuality = value;
+		return true;
+	case CONTROL_JPEG_SUBSAMPLING:
+		if (value < JPEG_444 || value > JPEG_420)
+			return false;
+		jpegSubsampling = value;
+		return true;
+	default:
+		return false;
+	}
+	reconfigure = true;
+	return true;
+}
+
+
+bool USBCameraDriver::getParameter (uint8_t parameter, int32_t &value)
+{
+	switch (parameter) {
+	case CONTROL_FRAME_RATE:
+		value = pendingFrameRate; break;
+	case CONTROL_IMAGE_WIDTH:
+		value = pendingWidth; break;
+	case CONTROL_IMAGE_HEIGHT:
+		value = pendingHeight; break;
+	case CONTROL_IMAGE_FORMAT:
+		value = pendingFormat; break;
+	case CONTROL_FRAME_PACING:
+		value = pacing; break;
+	case CONTROL_CHANGE_THRESHOLD:
+		value = changeThreshold; break;
+	case CONTROL_JPEG_QUALITY:
+		value = jpegQuality; break;
+	case CONTROL_JPEG_SUBSAMPLING:
+		value = jpegSubsampling; break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+
+/*
+ * Device must be reopened to change its format, so this
+ * is done at frame boundary in driver thread
+ */
+void USBCameraDriver::applyParameters ()
+{
+	reconfigure = false;
+	if (pendingWidth==width && pendingHeight==height && pendingFrameRate==frameRate &&
+		captureFormat (pendingFormat)==captureFormat (format)) {
+		// converted from the same capture
+		format = pendingFormat;
+		return;
+	}
+
+	int oldWidth = width, oldHeight = height, oldFrameRate = frameRate, oldFormat = format;
+	width = pendingWidth;
+	height = pendingHeight;
+	frameRate = pendingFrameRate;
+	format = pendingFormat;
+
+	releaseCameras ();
+	try {
+		init ();
+	} catch (std::exception &e) {
+		debug ("USB Camera: unable to apply %dx%d@%d format %d", width, height, frameRate, format);
+		pendingWidth = width = oldWidth;
+		pendingHeight = height = oldHeight;
+		pendingFrameRate = frameRate = oldFrameRate;
+		pendingFormat = format = oldFormat;
+		releaseCameras ();
+		init ();
+	}
+	// driver may adjust the size
+	width = cameras[0]->getWidth ();
+	height = cameras[0]->getHeight ();
 }
 
 
@@ -44,34 +235,299 @@ void USBCameraDriver::threadEntryPoint(USBCameraDriver *drv)
 }
 
 
-// XXX: This means that the image will be sent uncompressed
-// Investigate zlib
-shared_ptr<uint8_t> USBCameraDriver::imageHandler ()
+bool USBCameraDriver::grab (std::vector<V4L2Frame> &frames)
+{
+	if (group != NULL)
+		return group->grab (frames, grabTimeout);
+	frames.resize (1);
+	return cameras[0]->grab (frames[0], grabTimeout);
+}
+
+
+_imageMessageBuffer USBCameraDriver::imageHeader (int camera)
+{
+	_imageMessageBuffer header;
+	header.width = cameras[camera]->getWidth();
+	header.height = cameras[camera]->getHeight();
+	header.format = format;
+	header.device = firstDevice + camera;
+	header.stream = 0;
+	return header;
+}
+
+
+/*
+ * A frame leased from the camera goes out as it is, with image
+ * header as preamble, when no conversion is needed. Otherwise the
+ * image is written to a new buffer.
+ */
+shared_ptr<Message> USBCameraDriver::imageMessage (int camera, const V4L2Frame &frame)
+{
+	const uint32_t headerSize = sizeof(_imageMessageBuffer) - 1;
+	int pixels = cameras[camera]->getWidth() * cameras[camera]->getHeight();
+	// raw frames cut short can't be shown
+	if (format != IMAGE_MJPEG && frame.size < (uint32_t)(2*pixels))
+		return shared_ptr<Message> ();
+	int dataSize = (format==IMAGE_MJPEG ? frame.size : pixels*imagePixelBytes (format));
+	_imageMessageBuffer header = imageHeader (camera);
+
+	bool converted = (format==IMAGE_RGB24 || format==IMAGE_GRAY8);
+	if (converted==false) {
+		shared_ptr<Message> msg = Message::create (USBCameraDriverMessageCategory, dataSize, frame.data);
+		msg->setPreamble (&header, headerSize);
+		return msg;
+	}
+
+	shared_ptr<uint8_t> camImg (new uint8_t [headerSize + dataSize]);
+	memcpy (camImg.get(), &header, headerSize);
+	uint8_t *data = camImg.get() + headerSize;
+	if (format==IMAGE_RGB24)
+		yuyvToRgb (frame.data.get(), data, pixels);
+	else
+		yuyvToGray (frame.data.get(), data, pixels);
+	return Message::create (USBCameraDriverMessageCategory, headerSize + dataSize, camImg);
+}
+
+
+void USBCameraDriver::setWorkerHook (WorkerHook hook)
+{
+	boost::mutex::scoped_lock guard (poolLock);
+	workerHook = hook;
+	if (jpegPool != NULL && workerHook)
+		for (size_t i=0; i<jpegPool->getWorkers().size(); i++)
+			workerHook (jpegPool->getWorkers()[i]);
+}
+
+
+/*
+ * The frame stays leased while it waits for a worker; when all
+ * are busy it is dropped at once, and capture goes on
+ */
+void USBCameraDriver::compressImage (int camera, const V4L2Frame &frame, const timeval &stamp)
 {
-	shared_ptr<uint8_t> camImg (new uint8_t [camera->image_size]);
-	memcpy (camImg.get(), camera->image, camera->image_size);
-	lastImageSize = camera->image_size;
-	return camImg;
+	if (frame.size < (uint32_t)(2 * cameras[camera]->getWidth() * cameras[camera]->getHeight()))
+		return;
+	if (jpegPool==NULL) {
+		boost::mutex::scoped_lock guard (poolLock);
+		jpegPool = new JpegPool (srvQueue);
+		if (workerHook)
+			for (size_t i=0; i<jpegPool->getWorkers().size(); i++)
+				workerHook (jpegPool->getWorkers()[i]);
+	}
+	jpegPool->submit (frame.data, JPEG_YUYV, imageHeader (camera), stamp,
+		jpegQuality, (JPEG_SUBSAMPLING)jpegSubsampling);
 }
 
 
 void USBCameraDriver::work ()
 {
 	while (doQuit==false) {
+		reportStatus (DRIVER_RUNNING);
+
 		while (doStop==false) {
-			usb_cam_camera_grab_image (camera);
-			shared_ptr<uint8_t> camImg = imageHandler ();
-			shared_ptr<Message> camMsg =
-				Message::create (USBCameraDriverMessageCategory, lastImageSize, camImg);
-			srvQueue->push (camMsg);
-			usleep (intervalPerFrame);
+			// leased buffers go back to the camera once sent to every client
+			std::vector<V4L2Frame> frames;
+			try {
+				if (opened==false) {
+					init ();
+					debug ("USB Camera reopened");
+					reportStatus (DRIVER_RUNNING);
+				}
+				if (reconfigure==true)
+					applyParameters ();
+				if (grab (frames)==false)
+					continue;
+				backoff.reset ();
+			} catch (V4L2Exception &e) {
+				recover (e.what());
+				continue;
+			}
+
+			if (srvQueue->isEnabled()==false)
+				continue;
+			// a set shares the stamp of its oldest frame
+			uint64_t stamp = frames[0].timestamp;
+			for (size_t i=1; i<frames.size(); i++)
+				stamp = std::min (stamp, frames[i].timestamp);
+			bool sent = due (stamp),
+				still = (sent && unchanged (frames, stamp));
+			countFrame (frames[0], sent, still, stamp);
+			reportStatistics ();
+			if (sent==false || still)
+				continue;
+			timeval tv;
+			tv.tv_sec = stamp / 1000000000ULL;
+			tv.tv_usec = (stamp % 1000000000ULL) / 1000;
+
+			for (size_t i=0; i<frames.size(); i++) {
+				// some cameras hand out empty buffers for frames they dropped
+				if (frames[i].size==0)
+					continue;
+				if (format==IMAGE_JPEG) {
+					compressImage (i, frames[i], tv);
+					continue;
+				}
+				shared_ptr<Message> msg = imageMessage (i, frames[i]);
+				if (!msg)
+					continue;
+				msg->setTimestamp (tv);
+				srvQueue->push (msg);
+			}
 		}
+		reportStatus (DRIVER_STOPPED);
 		if (doQuit==true) break;
 		startSignal->wait();
 	}
 }
 
 
+/*
+ * Frames come as fast as the device gives them. With pacing, those
+ * that come before their turn are dropped; the turn advances by one
+ * frame period for each frame sent, so the rate is kept on average
+ * from any device rate above it. A quarter period of early arrival
+ * is allowed for jitter.
+ */
+bool USBCameraDriver::due (uint64_t stamp)
+{
+	if (pacing==false)
+		return true;
+	uint64_t period = 1000000000ULL / frameRate;
+	if (nextDue != 0 && stamp + period/4 < nextDue)
+		return false;
+	// after a pause, start over from this frame
+	if (nextDue + period < stamp)
+		nextDue = stamp;
+	nextDue += period;
+	return true;
+}
+
+
+/*
+ * A set is sent when any of its frames changed, and then all of
+ * them become the reference. Frames are compared as captured, before
+ * conversion; MJPEG frames can't be, and are always sent.
+ */
+bool USBCameraDriver::unchanged (const std::vector<V4L2Frame> &frames, uint64_t stamp)
+{
+	if (changeThreshold != detectors[0].getThreshold()) {
+		for (size_t i=0; i<detectors.size(); i++)
+			detectors[i].setThreshold (changeThreshold);
+	}
+	if (detectors[0].isEnabled()==false || format==IMAGE_MJPEG)
+		return false;
+
+	double t = stamp * 1e-9;
+	bool changed = detectors[0].keyframeDue (t);
+	for (size_t i=0; i<frames.size() && changed==false; i++) {
+		int rowBytes = 2*cameras[i]->getWidth(), rows = cameras[i]->getHeight();
+		changed = (frames[i].size < (uint32_t)(rowBytes*rows)) ||
+			detectors[i].differs (frames[i].data.get(), rowBytes, rows);
+	}
+
+	if (changed==false) {
+		const uint32_t headerSize = sizeof(_imageMessageBuffer) - 1;
+		for (size_t i=0; i<frames.size(); i++)
+			savedBytes += headerSize +
+				cameras[i]->getWidth() * cameras[i]->getHeight() * imagePixelBytes (format);
+		stillFrames++;
+		return true;
+	}
+	for (size_t i=0; i<frames.size(); i++) {
+		int rowBytes = 2*cameras[i]->getWidth(), rows = cameras[i]->getHeight();
+		if (frames[i].size >= (uint32_t)(rowBytes*rows))
+			detectors[i].keep (frames[i].data.get(), rowBytes, rows, t);
+	}
+	return false;
+}
+
+
+/*
+ * Frames lost by the device, or left stale in its queue, show as
+ * a gap in sequence numbers. Latency is from frame stamp to the time
+ * it is queued for clients. Unchanged frames are counted apart.
+ */
+void USBCameraDriver::countFrame (const V4L2Frame &frame, bool sent, bool still, uint64_t stamp)
+{
+	if (frame.sequence > lastSequence + 1 && lastSequence != 0)
+		droppedFrames += frame.sequence - lastSequence - 1;
+	lastSequence = frame.sequence;
+	if (sent==false) {
+		droppedFrames++;
+		return;
+	}
+	if (still)
+		return;
+
+	struct timespec t;
+	clock_gettime (CLOCK_REALTIME, &t);
+	uint64_t now = (uint64_t)t.tv_sec*1000000000ULL + t.tv_nsec;
+	double delay = ((int64_t)(now - stamp)) * 1e-9;
+	latency += delay;
+	maxLatency = std::max (maxLatency, delay);
+	sentFrames++;
+}
+
+
+void USBCameraDriver::reportStatistics ()
+{
+	struct timespec t;
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	double now = t.tv_sec + t.tv_nsec * 1e-9;
+	if (lastReport==0)
+		lastReport = now;
+	if (now - lastReport < CameraReportInterval)
+		return;
+
+	Report rep (USBCameraDriverMessageCategory, REPORT_STATISTICS);
+	rep.add ("device", firstDevice);
+	rep.add ("fps", sentFrames / (now - lastReport));
+	rep.add ("frames_dropped", droppedFrames);
+	if (sentFrames > 0) {
+		rep.add ("latency_mean_ms", latency / sentFrames * 1e3);
+		rep.add ("latency_max_ms", maxLatency * 1e3);
+	}
+	if (changeThreshold > 0) {
+		rep.add ("frames_static", stillFrames);
+		rep.add ("bytes_saved", savedBytes);
+	}
+	if (jpegPool != NULL) {
+		JpegStatistics jpeg = jpegPool->takeStatistics ();
+		rep.add ("jpeg_dropped", jpeg.dropped);
+		if (jpeg.images > 0) {
+			rep.add ("jpeg_ms", jpeg.seconds / jpeg.images * 1e3);
+			rep.add ("jpeg_ratio", jpeg.rawBytes / jpeg.jpegBytes);
+		}
+	}
+	srvQueue->push (rep.toMessage ());
+
+	latency = maxLatency = savedBytes = 0;
+	sentFrames = droppedFrames = stillFrames = 0;
+	lastReport = now;
+}
+
+
+/*
+ * Release the camera and wait before the next reopen attempt,
+ * which is done at the top of work loop
+ */
+void USBCameraDriver::recover (const std::string &error)
+{
+	debug ("USB Camera failure: %s", error.c_str());
+	releaseCameras ();
+	backoff.failed ();
+	reportStatus (DRIVER_RECOVERING, error);
+	backoff.wait (doStop);
+}
+
+
+void USBCameraDriver::reportStatus (uint8_t health, const std::string &error)
+{
+	srvQueue->push (DriverStatus::create (USBCameraDriverMessageCategory, firstDevice, health,
+		backoff.getFailures(), backoff.current()/1000, error.c_str()), true);
+}
+
+
 void USBCameraDriver::start()
 {
 	doStop = false;
@@ -87,8 +543,12 @@ void USBCameraDriver::stop ()
 
 USBCameraDriver::~USBCameraDriver()
 {
-	usb_cam_camera_shutdown ();
-	delete (camera);
+	// holds frames leased from the cameras
+	delete jpegPool;
+	releaseCameras ();
+	delete group;
+	for (size_t i=0; i<cameras.size(); i++)
+		delete cameras[i];
 }
 
 } /* namespace Robocar */
@@ -0,0 +1,464 @@
+/*********************************************************************
+ *
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2014, Robert Bosch LLC.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Robert Bosch nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************/
+/*
+ * V4L2Capture.cpp
+ *
+ * Derived from usb_cam, with the device state moved into the object.
+ */
+
+#include "V4L2Capture.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sstream>
+#include <algorithm>
+#include <boost/thread/mutex.hpp>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+
+#define CLEAR(x) memset (&(x), 0, sizeof (x))
+
+
+namespace Robocar {
+
+
+/*
+ * Mappings of one capture session. Leased frames hold a reference,
+ * so their memory stays mapped until the last of them is gone, even
+ * after the device has been closed or reopened.
+ */
+struct V4L2Capture::Mappings
+{
+	struct Map {
+		void *start;
+		size_t length;
+	};
+	std::vector<Map> maps;
+	// -1 once capture has stopped; frames given back then are dropped
+	int fd;
+	uint32_t leased;
+	boost::mutex lock;
+
+	Mappings () : fd (-1), leased (0) {}
+	~Mappings ()
+	{
+		for (size_t i=0; i<maps.size(); i++)
+			munmap (maps[i].start, maps[i].length);
+	}
+};
+
+
+// Deleter of a leased frame; queues its buffer again
+struct V4L2Capture::FrameReturn
+{
+	shared_ptr<Mappings> frames;
+	uint32_t index;
+
+	void operator() (uint8_t *)
+	{
+		boost::mutex::scoped_lock guard (frames->lock);
+		frames->leased--;
+		if (frames->fd == -1)
+			return;
+
+		struct v4l2_buffer buf;
+		CLEAR (buf);
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = index;
+		// on failure the buffer is only lost to this session
+		ioctl (frames->fd, VIDIOC_QBUF, &buf);
+	}
+};
+
+
+static uint64_t systemNanosecond ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * Capture time of a dequeued buffer, on system clock. Drivers stamp
+ * buffers on monotonic clock, which is moved over by the present
+ * offset between the two; buffers without such stamp get the time
+ * they were dequeued.
+ */
+static uint64_t captureTime (const struct v4l2_buffer &buf)
+{
+	uint64_t now = systemNanosecond ();
+	uint64_t stamp = (uint64_t)buf.timestamp.tv_sec*1000000000ULL + buf.timestamp.tv_usec*1000ULL;
+	if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC || stamp==0)
+		return now;
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	uint64_t monotonic = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+	if (stamp > monotonic)
+		return now;
+	return now - (monotonic - stamp);
+}
+
+
+V4L2Capture::V4L2Capture (const std::string &_device) :
+	device (_device),
+	fd (-1),
+	io (IO_MMAP),
+	pixelFormat (V4L2_PIX_FMT_YUYV),
+	width (0), height (0),
+	frameBufferSize (0)
+{}
+
+
+V4L2Capture::~V4L2Capture ()
+{
+	stop ();
+}
+
+
+int V4L2Capture::xioctl (int request, void *arg)
+{
+	int r;
+	do
+		r = ioctl (fd, request, arg);
+	while (-1 == r && EINTR == errno);
+	return r;
+}
+
+
+void V4L2Capture::fail (const char *what)
+{
+	std::stringstream msg;
+	msg << device << ": " << what << " error " << errno << ", " << strerror (errno);
+	throw V4L2Exception (msg.str());
+}
+
+
+void V4L2Capture::start (int _width, int _height, int frameRate, PixelFormat format, IOMethod _io)
+{
+	stop ();
+	io = _io;
+	width = _width;
+	height = _height;
+	switch (format) {
+	case FORMAT_YUYV:
+		pixelFormat = V4L2_PIX_FMT_YUYV; break;
+	case FORMAT_UYVY:
+		pixelFormat = V4L2_PIX_FMT_UYVY; break;
+	case FORMAT_MJPEG:
+		pixelFormat = V4L2_PIX_FMT_MJPEG; break;
+	default:
+		throw V4L2Exception (device + ": unsupported pixel format");
+	}
+
+	struct stat st;
+	if (-1 == stat (device.c_str(), &st))
+		fail ("stat");
+	if (!S_ISCHR (st.st_mode))
+		throw V4L2Exception (device + " is no device");
+	fd = open (device.c_str(), O_RDWR | O_NONBLOCK, 0);
+	if (-1 == fd)
+		fail ("open");
+
+	try {
+		configure (frameRate);
+		if (io==IO_MMAP) {
+			mapBuffers ();
+			for (uint32_t i=0; i<mappings->maps.size(); i++) {
+				struct v4l2_buffer buf;
+				CLEAR (buf);
+				buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+				buf.memory = V4L2_MEMORY_MMAP;
+				buf.index = i;
+				if (-1 == xioctl (VIDIOC_QBUF, &buf))
+					fail ("VIDIOC_QBUF");
+			}
+			enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			if (-1 == xioctl (VIDIOC_STREAMON, &type))
+				fail ("VIDIOC_STREAMON");
+		}
+	} catch (V4L2Exception &e) {
+		// leave nothing behind, so the caller may retry
+		stop ();
+		throw;
+	}
+}
+
+
+void V4L2Capture::configure (int frameRate)
+{
+	struct v4l2_capability cap;
+	if (-1 == xioctl (VIDIOC_QUERYCAP, &cap)) {
+		if (EINVAL == errno)
+			throw V4L2Exception (device + " is no V4L2 device");
+		fail ("VIDIOC_QUERYCAP");
+	}
+	if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE))
+		throw V4L2Exception (device + " is no video capture device");
+	if (io==IO_READ && !(cap.capabilities & V4L2_CAP_READWRITE))
+		throw V4L2Exception (device + " does not support read i/o");
+	if (io==IO_MMAP && !(cap.capabilities & V4L2_CAP_STREAMING))
+		throw V4L2Exception (device + " does not support streaming i/o");
+
+	// reset cropping to default; errors ignored
+	struct v4l2_cropcap cropcap;
+	CLEAR (cropcap);
+	cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (0 == xioctl (VIDIOC_CROPCAP, &cropcap)) {
+		struct v4l2_crop crop;
+		crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		crop.c = cropcap.defrect;
+		xioctl (VIDIOC_S_CROP, &crop);
+	}
+
+	struct v4l2_format fmt;
+	CLEAR (fmt);
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.fmt.pix.width = width;
+	fmt.fmt.pix.height = height;
+	fmt.fmt.pix.pixelformat = pixelFormat;
+	fmt.fmt.pix.field = V4L2_FIELD_INTERLACED;
+	if (-1 == xioctl (VIDIOC_S_FMT, &fmt))
+		fail ("VIDIOC_S_FMT");
+	// the driver falls back to a format of its own choice
+	if (fmt.fmt.pix.pixelformat != pixelFormat)
+		throw V4L2Exception (device + ": pixel format not supported by device");
+
+	// VIDIOC_S_FMT may change width and height; buggy driver paranoia
+	uint32_t min = fmt.fmt.pix.width * 2;
+	if (fmt.fmt.pix.bytesperline < min)
+		fmt.fmt.pix.bytesperline = min;
+	min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
+	if (fmt.fmt.pix.sizeimage < min)
+		fmt.fmt.pix.sizeimage = min;
+	frameBufferSize = fmt.fmt.pix.sizeimage;
+	width = fmt.fmt.pix.width;
+	height = fmt.fmt.pix.height;
+
+	struct v4l2_streamparm streamParams;
+	CLEAR (streamParams);
+	streamParams.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (xioctl (VIDIOC_G_PARM, &streamParams) < 0)
+		fail ("VIDIOC_G_PARM");
+	streamParams.parm.capture.timeperframe.numerator = 1;
+	streamParams.parm.capture.timeperframe.denominator = frameRate;
+	if (xioctl (VIDIOC_S_PARM, &streamParams) < 0)
+		fprintf (stderr, "%s: couldn't set frame rate\n", device.c_str());
+}
+
+
+void V4L2Capture::mapBuffers ()
+{
+	struct v4l2_requestbuffers req;
+	CLEAR (req);
+	req.count = CaptureBuffers;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (-1 == xioctl (VIDIOC_REQBUFS, &req)) {
+		if (EINVAL == errno)
+			throw V4L2Exception (device + " does not support memory mapping");
+		fail ("VIDIOC_REQBUFS");
+	}
+	if (req.count < 2)
+		throw V4L2Exception (device + ": insufficient buffer memory");
+
+	mappings.reset (new Mappings);
+	mappings->fd = fd;
+	for (uint32_t i=0; i<req.count; i++) {
+		struct v4l2_buffer buf;
+		CLEAR (buf);
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (-1 == xioctl (VIDIOC_QUERYBUF, &buf))
+			fail ("VIDIOC_QUERYBUF");
+
+		Mappings::Map map;
+		map.length = buf.length;
+		map.start = mmap (NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+		if (MAP_FAILED == map.start)
+			fail ("mmap");
+		mappings->maps.push_back (map);
+	}
+}
+
+
+void V4L2Capture::stop ()
+{
+	if (fd == -1)
+		return;
+
+	if (io==IO_MMAP) {
+		enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		xioctl (VIDIOC_STREAMOFF, &type);
+		// unmapped when the last leased frame is given back
+		if (mappings) {
+			boost::mutex::scoped_lock guard (mappings->lock);
+			mappings->fd = -1;
+		}
+		mappings.reset ();
+	}
+	close (fd);
+	fd = -1;
+}
+
+
+/*
+ * Hands a dequeued buffer out in frame, unless that would leave
+ * the device too few to capture into
+ */
+bool V4L2Capture::leaseFrame (uint32_t index, uint32_t bytesused, V4L2Frame &frame)
+{
+	{
+		boost::mutex::scoped_lock guard (mappings->lock);
+		if (mappings->leased + MinimumQueuedBuffers >= mappings->maps.size())
+			return false;
+		mappings->leased++;
+	}
+
+	FrameReturn giveback = {mappings, index};
+	// a previous lease in frame is given back out of the lock
+	frame.data = shared_ptr<uint8_t> ((uint8_t*)mappings->maps[index].start, giveback);
+	frame.size = std::min (bytesused, (uint32_t)mappings->maps[index].length);
+	return true;
+}
+
+
+bool V4L2Capture::read (V4L2Frame &frame)
+{
+	if (fd == -1)
+		throw V4L2Exception (device + " is not started");
+
+	if (io==IO_READ) {
+		shared_ptr<uint8_t> buffer (new uint8_t [frameBufferSize]);
+		ssize_t len = ::read (fd, buffer.get(), frameBufferSize);
+		if (len == -1) {
+			if (errno==EAGAIN || errno==EINTR)
+				return false;
+			fail ("read");
+		}
+		frame.data = buffer;
+		frame.size = len;
+		frame.timestamp = systemNanosecond ();
+		frame.sequence = 0;
+		return true;
+	}
+
+	struct v4l2_buffer buf;
+	CLEAR (buf);
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	if (-1 == xioctl (VIDIOC_DQBUF, &buf)) {
+		if (errno==EAGAIN)
+			return false;
+		fail ("VIDIOC_DQBUF");
+	}
+	if (buf.index >= mappings->maps.size())
+		throw V4L2Exception (device + ": invalid buffer index");
+	frame.timestamp = captureTime (buf);
+	frame.sequence = buf.sequence;
+
+	if (leaseFrame (buf.index, buf.bytesused, frame))
+		return true;
+
+	const Mappings::Map &map = mappings->maps[buf.index];
+	frame.size = std::min (buf.bytesused, (uint32_t)map.length);
+	frame.data = shared_ptr<uint8_t> (new uint8_t [frame.size]);
+	memcpy (frame.data.get(), map.start, frame.size);
+	if (-1 == xioctl (VIDIOC_QBUF, &buf))
+		fail ("VIDIOC_QBUF");
+	return true;
+}
+
+
+bool V4L2Capture::grab (V4L2Frame &frame, int timeoutMs)
+{
+	if (fd == -1)
+		throw V4L2Exception (device + " is not started");
+
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	int r = poll (&pfd, 1, timeoutMs);
+	if (-1 == r) {
+		if (EINTR == errno)
+			return false;
+		fail ("poll");
+	}
+	if (0 == r)
+		throw V4L2Timeout (device);
+	if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+		throw V4L2Exception (device + ": device error");
+
+	// frames queued while we were away are stale; keep the newest
+	if (read (frame)==false)
+		return false;
+	while (read (frame));
+	return true;
+}
+
+
+void V4L2Capture::setAutoFocus (bool on)
+{
+	struct v4l2_queryctrl queryctrl;
+	CLEAR (queryctrl);
+	queryctrl.id = V4L2_CID_FOCUS_AUTO;
+	if (-1 == xioctl (VIDIOC_QUERYCTRL, &queryctrl) || (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED)) {
+		fprintf (stderr, "%s: auto focus is not supported\n", device.c_str());
+		return;
+	}
+
+	struct v4l2_control control;
+	CLEAR (control);
+	control.id = V4L2_CID_FOCUS_AUTO;
+	control.value = on;
+	if (-1 == xioctl (VIDIOC_S_CTRL, &control))
+		perror ("VIDIOC_S_CTRL");
+}
+
+} /* namespace Robocar */
@@ -0,0 +1,136 @@
+/*
+ * V4L2Capture.h
+ */
+
+#ifndef ROBOCAR_SERVER_V4L2CAPTURE_H_
+#define ROBOCAR_SERVER_V4L2CAPTURE_H_
+
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+
+
+// Buffers asked from the device for mmap i/o
+#define CaptureBuffers 8
+// Leasing stops when it would leave fewer buffers than this with the device
+#define MinimumQueuedBuffers 2
+
+
+using boost::shared_ptr;
+
+
+namespace Robocar {
+
+
+// Device errors are reported by exception, so that a failing camera
+// can be reopened without taking down the process
+class V4L2Exception : public std::exception
+{
+public:
+	V4L2Exception (const std::string &msg="Failed opening device") : message(msg) {}
+	virtual ~V4L2Exception () throw() {}
+	virtual const char *what () const throw()
+	{ return message.c_str(); }
+private:
+	std::string message;
+};
+
+
+// No frame arrived within the grab timeout
+class V4L2Timeout : public V4L2Exception
+{
+public:
+	V4L2Timeout (const std::string &device="") : V4L2Exception(device + ": select timeout") {}
+};
+
+
+struct V4L2Frame
+{
+	// the capture buffer itself, given back to the device when the
+	// last copy is destroyed; or a copy when too many are out
+	shared_ptr<uint8_t> data;
+	uint32_t size;
+	// capture time given by the device, on system clock, in nanosecond
+	uint64_t timestamp;
+	uint32_t sequence;
+};
+
+
+/*
+ * One V4L2 camera. All state is kept in the object, so any number
+ * of cameras may run at once, each from its own thread. A single
+ * object is not meant to be used from several threads, except that
+ * frames it handed out may be released anywhere.
+ */
+class V4L2Capture
+{
+public:
+	enum IOMethod {
+		IO_READ,
+		IO_MMAP
+	};
+
+	enum PixelFormat {
+		FORMAT_YUYV,
+		FORMAT_UYVY,
+		FORMAT_MJPEG
+	};
+
+	V4L2Capture (const std::string &_device);
+	~V4L2Capture ();
+
+	/*
+	 * Opens the device and starts streaming. The device may change
+	 * the size; see getWidth() and getHeight().
+	 */
+	void start (int _width, int _height, int frameRate, PixelFormat format, IOMethod _io=IO_MMAP);
+
+	// Never throws; the device may already be gone
+	void stop ();
+
+	bool isStarted () { return fd != -1; }
+
+	/*
+	 * Waits until the device has a frame, and takes the newest one;
+	 * older ones are dropped, which shows as a gap in sequence.
+	 * Returns false when interrupted or when the frame was not ready
+	 * after all; throws V4L2Timeout when nothing arrives in time.
+	 */
+	bool grab (V4L2Frame &frame, int timeoutMs);
+
+	// Takes a frame if one is ready, without waiting
+	bool read (V4L2Frame &frame);
+
+	void setAutoFocus (bool on);
+
+	int getFd () { return fd; }
+	int getWidth () { return width; }
+	int getHeight () { return height; }
+	const std::string &getDevice () { return device; }
+
+private:
+	std::string device;
+	int fd;
+	IOMethod io;
+	uint32_t pixelFormat;
+	int width, height;
+	// largest frame the device may deliver
+	uint32_t frameBufferSize;
+
+	struct Mappings;
+	struct FrameReturn;
+	shared_ptr<Mappings> mappings;
+
+	void configure (int frameRate);
+	void mapBuffers ();
+	bool leaseFrame (uint32_t index, uint32_t bytesused, V4L2Frame &frame);
+	int xioctl (int request, void *arg);
+	void fail (const char *what);
+};
+
+} /* namespace Robocar */
+
+#endif /* ROBOCAR_SERVER_V4L2CAPTURE_H_ */
@@ -0,0 +1,412 @@
+/*
+ * hokuyo_bench.cpp
+ *
+ * Replays a SCIP 2.0 stream into hokuyo::Laser through a socket pair,
+ * and measures parsing throughput and the latency from the last byte
+ * of a scan to serviceScan() returning it.
+ *
+ * Usage: hokuyo_bench [-f capture] [-n scans] [-period ms] [-legacy] [-filter spec]
+ *        hokuyo_bench [-f capture] -verify
+ *
+ * A capture is the raw output of the device, starting with the reply
+ * of PP command. Without capture, UTM-30LX scans are synthesized.
+ * -verify decodes the stream with the legacy decoder, the current
+ * decoder and the current decoder writing into caller's buffer, and
+ * fails if any scan differs; without capture it covers both laser
+ * families, with and without intensity. It also checks that compact
+ * encoding gives back the same scans, and reports its size.
+ * -filter also measures the cost of ScanFilter with that spec.
+ */
+
+#include "hokuyo.h"
+#include "HokuyoDriver.h"
+#include "LidarCompact.h"
+#include "ScanFilter.h"
+#include "MessageRegisters.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <boost/thread.hpp>
+
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+static double now ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+static char scipSum (const string &s)
+{
+	unsigned char sum = 0;
+	for (size_t i=0; i<s.size(); i++)
+		sum += (unsigned char)s[i];
+	return (sum & 0x3f) + 0x30;
+}
+
+
+static void scipEncode (int value, int digits, string &out)
+{
+	for (int d=digits-1; d>=0; d--)
+		out += (char)(((value >> (6*d)) & 0x3f) + 0x30);
+}
+
+
+static string sensorConfig (bool urg)
+{
+	if (urg)
+		return
+			"PP\n00P\n"
+			"MODL:URG-04LX(Hokuyo Automatic Co.,Ltd.);J\n"
+			"DMIN:20;4\nDMAX:5600;S\nARES:1024;[\n"
+			"AMIN:44;7\nAMAX:725;o\nAFRT:384;6\nSCAN:600;S\n\n";
+	return
+		"PP\n00P\n"
+		"MODL:UTM-30LX(Hokuyo Automatic Co.,Ltd.);J\n"
+		"DMIN:23;7\nDMAX:60000;J\nARES:1440;P\n"
+		"AMIN:0;?\nAMAX:1080;Y\nAFRT:540;6\nSCAN:2400;Y\n\n";
+}
+
+
+/*
+ * One MD (or ME, with intensity) reply covering the whole field
+ * of view, with every error code sprinkled in
+ */
+static string synthesizeScan (int seq, bool urg, bool intensity)
+{
+	const int steps = urg ? 682 : 1081;
+	string reply = string (intensity ? "ME" : "MD")
+		+ (urg ? "0044072500000\n99b\n" : "0000108000000\n99b\n");
+
+	string ts;
+	scipEncode (seq*25, 4, ts);
+	reply += ts + scipSum(ts) + "\n";
+
+	string data;
+	for (int i=0; i<steps; i++) {
+		int range = 500 + (i*37 + seq*11) % (urg ? 5000 : 29000);
+		if (i % 13 == 0)
+			range = (i/13 + seq) % 20;
+		scipEncode (range, 3, data);
+		if (intensity)
+			scipEncode ((i*131 + seq) % 20000, 3, data);
+	}
+	for (size_t i=0; i<data.size(); i+=64) {
+		string block = data.substr (i, 64);
+		reply += block + scipSum(block) + "\n";
+	}
+	return reply + "\n";
+}
+
+
+/*
+ * Splits a capture into configuration and scans; a scan
+ * reply ends with an empty line
+ */
+static bool loadCapture (const char *path, string &config, vector<string> &scans)
+{
+	std::ifstream file (path, std::ios::binary);
+	if (!file)
+		return false;
+	std::stringstream ss;
+	ss << file.rdbuf();
+	string raw = ss.str();
+
+	size_t pos = raw.find ("\n\n");
+	if (pos==string::npos)
+		return false;
+	config = raw.substr (0, pos+2);
+	pos += 2;
+	while (pos < raw.size()) {
+		size_t end = raw.find ("\n\n", pos);
+		if (end==string::npos)
+			break;
+		scans.push_back (raw.substr (pos, end+2-pos));
+		pos = end+2;
+	}
+	return scans.empty()==false;
+}
+
+
+struct Replay
+{
+	int fd;
+	const string *config;
+	const vector<string> *scans;
+	int count;
+	useconds_t period;
+	vector<double> written;
+
+	bool send (const char *data, size_t size)
+	{
+		size_t done = 0;
+		while (done < size) {
+			ssize_t r = ::write (fd, data+done, size-done);
+			if (r <= 0)
+				return false;
+			done += r;
+		}
+		return true;
+	}
+
+	void operator() ()
+	{
+		send (config->data(), config->size());
+		for (int i=0; i<count; i++) {
+			const string &s = (*scans)[i % scans->size()];
+			if (send (s.data(), s.size()-1)==false)
+				return;
+			// stamp before the last byte, so the reader can't beat us
+			written[i] = now ();
+			if (send (s.data()+s.size()-1, 1)==false)
+				return;
+			if (period)
+				usleep (period);
+		}
+	}
+};
+
+
+/*
+ * Feed the stream to a laser; keep the scans when asked
+ */
+static int replay (const string &config, const vector<string> &scans, int count,
+	int periodMs, bool legacy, vector<hokuyo::LaserScan> *keep, bool verbose, bool inPlace=false,
+	Robocar::ScanFilter *filter=NULL)
+{
+	int sv[2];
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		perror ("socketpair");
+		return 0;
+	}
+
+	Replay feeder;
+	feeder.fd = sv[0];
+	feeder.config = &config;
+	feeder.scans = &scans;
+	feeder.count = count;
+	feeder.period = periodMs*1000;
+	feeder.written.resize (count, 0);
+
+	size_t bytes = 0;
+	for (int i=0; i<count; i++)
+		bytes += scans[i % scans.size()].size();
+
+	hokuyo::Laser laser;
+	laser.setLegacyDecoder (legacy);
+	boost::thread writer (boost::ref (feeder));
+	vector<double> latency, filterCost;
+	int parsed = 0, readings = 0;
+	double start = 0, finish = 0;
+
+	try {
+		laser.attach (sv[1]);
+		hokuyo::LaserScan scan;
+		vector<float> data (2*hokuyo::MAX_READINGS);
+		start = now ();
+		for (parsed=0; parsed<count; parsed++) {
+			if (inPlace) {
+				int ranges, intensities;
+				if (laser.serviceScan (scan, &data[0], ranges, intensities, 1000) != 0)
+					break;
+				scan.ranges.assign (&data[0], &data[ranges]);
+				scan.intensities.assign (&data[ranges], &data[ranges+intensities]);
+			}
+			else if (laser.serviceScan (scan, 1000) != 0)
+				break;
+			double t = now ();
+			readings += scan.ranges.size();
+			if (feeder.written[parsed] > 0)
+				latency.push_back (t - feeder.written[parsed]);
+			if (filter != NULL && scan.ranges.empty()==false) {
+				filter->apply (&scan.ranges[0], scan.ranges.size(), scan.config);
+				filterCost.push_back (now() - t);
+			}
+			if (keep)
+				keep->push_back (scan);
+		}
+		finish = now ();
+	} catch (hokuyo::Exception &e) {
+		cerr << "Stopped after " << parsed << " scans: " << e.what() << endl;
+		finish = now ();
+	}
+
+	::close (sv[0]);
+	writer.join ();
+
+	if (verbose==false)
+		return parsed;
+
+	cout << (legacy ? "Legacy decoder" : "Decoder") << endl;
+	cout << "Scans: " << parsed << ", readings: " << readings << endl;
+	if (finish > start)
+		cout << "Throughput: " << bytes*((double)parsed/count)/(finish-start)/1e6 << " MB/s, "
+			<< parsed/(finish-start) << " scans/s" << endl;
+	if (latency.empty()==false) {
+		std::sort (latency.begin(), latency.end());
+		double sum = 0;
+		for (size_t i=0; i<latency.size(); i++)
+			sum += latency[i];
+		cout << "Latency (us): mean " << sum/latency.size()*1e6
+			<< ", median " << latency[latency.size()/2]*1e6
+			<< ", max " << latency.back()*1e6 << endl;
+	}
+	if (filterCost.empty()==false) {
+		std::sort (filterCost.begin(), filterCost.end());
+		double sum = 0;
+		for (size_t i=0; i<filterCost.size(); i++)
+			sum += filterCost[i];
+		cout << "Filter (us): mean " << sum/filterCost.size()*1e6
+			<< ", median " << filterCost[filterCost.size()/2]*1e6
+			<< ", max " << filterCost.back()*1e6 << endl;
+	}
+	return parsed;
+}
+
+
+static bool sameFloats (const vector<float> &a, const vector<float> &b)
+{
+	// bitwise, so that NaN equals NaN
+	return a.size()==b.size() &&
+		(a.empty() || memcmp (&a[0], &b[0], a.size()*sizeof(float))==0);
+}
+
+
+static bool sameScan (const hokuyo::LaserScan &a, const hokuyo::LaserScan &b)
+{
+	return sameFloats (a.ranges, b.ranges) &&
+		sameFloats (a.intensities, b.intensities);
+}
+
+
+/*
+ * Decode the same stream with all decoders and compare
+ */
+static int verify (const string &config, const vector<string> &scans, const char *name)
+{
+	vector<hokuyo::LaserScan> expected, actual, inPlace;
+	int count = scans.size();
+	replay (config, scans, count, 0, true, &expected, false);
+	replay (config, scans, count, 0, false, &actual, false);
+	replay (config, scans, count, 0, false, &inPlace, false, true);
+
+	int mismatch = 0;
+	if ((int)expected.size() != count || (int)actual.size() != count || (int)inPlace.size() != count)
+		mismatch = count;
+	else {
+		for (int i=0; i<count; i++) {
+			if (sameScan (expected[i], actual[i])==false ||
+				sameScan (expected[i], inPlace[i])==false ||
+				expected[i].self_time_stamp != actual[i].self_time_stamp ||
+				expected[i].self_time_stamp != inPlace[i].self_time_stamp)
+				mismatch++;
+		}
+	}
+	cout << name << ": " << count << " scans, " << mismatch << " mismatch" << endl;
+
+	// Compact encoding round trip
+	Robocar::LidarCompactEncoder encoder;
+	Robocar::LidarCompactDecoder decoder;
+	size_t plainBytes = 0, compactBytes = 0;
+	int compactMismatch = 0;
+	for (size_t i=0; i<actual.size(); i++) {
+		uint32_t size;
+		shared_ptr<uint8_t> buffer = Robocar::HokuyoSensorDriver::serializeMessage (actual[i], size);
+		Robocar::Message plain (HokuyoDriverMessageCategory, size, buffer);
+		shared_ptr<Robocar::Message> compact = encoder.encode (plain);
+		plainBytes += plain.getWireSize ();
+		compactBytes += compact->getWireSize ();
+
+		hokuyo::LaserScan decoded;
+		if (decoder.decode (*compact, decoded)==false || sameScan (actual[i], decoded)==false)
+			compactMismatch++;
+	}
+	if (plainBytes > 0)
+		cout << name << " compact: " << compactMismatch << " mismatch, "
+			<< 100.0*compactBytes/plainBytes << "% of plain size" << endl;
+	return mismatch + compactMismatch;
+}
+
+
+int main (int argc, char **argv)
+{
+	const char *capture = NULL;
+	int count = 2000;
+	int periodMs = 0;
+	bool legacy = false, verifyOnly = false;
+	Robocar::ScanFilter filter;
+	bool filtering = false;
+	for (int i=1; i<argc; i++) {
+		string arg (argv[i]);
+		if (arg=="-f" && i+1<argc)
+			capture = argv[++i];
+		else if (arg=="-n" && i+1<argc)
+			count = atoi (argv[++i]);
+		else if (arg=="-period" && i+1<argc)
+			periodMs = atoi (argv[++i]);
+		else if (arg=="-legacy")
+			legacy = true;
+		else if (arg=="-verify")
+			verifyOnly = true;
+		else if (arg=="-filter" && i+1<argc) {
+			if (filter.configure (argv[++i])==false) {
+				cerr << "Invalid filter " << argv[i] << endl;
+				return 1;
+			}
+			filtering = true;
+		}
+	}
+
+	// laser writes commands into a socket nobody reads
+	signal (SIGPIPE, SIG_IGN);
+
+	string config;
+	vector<string> scans;
+	if (capture) {
+		if (loadCapture (capture, config, scans)==false) {
+			cerr << "Unable to read capture " << capture << endl;
+			return 1;
+		}
+		if (verifyOnly)
+			return verify (config, scans, capture) ? 1 : 0;
+	}
+	else if (verifyOnly) {
+		int mismatch = 0;
+		for (int model=0; model<2; model++) {
+			for (int intensity=0; intensity<2; intensity++) {
+				vector<string> synth;
+				for (int i=0; i<40; i++)
+					synth.push_back (synthesizeScan (i, model, intensity));
+				string name = string (model ? "URG-04LX" : "UTM-30LX") + (intensity ? " ME" : " MD");
+				mismatch += verify (sensorConfig (model), synth, name.c_str());
+			}
+		}
+		return mismatch ? 1 : 0;
+	}
+	else {
+		config = sensorConfig (false);
+		for (int i=0; i<40; i++)
+			scans.push_back (synthesizeScan (i, false, false));
+	}
+
+	replay (config, scans, count, periodMs, legacy, NULL, true, false, filtering ? &filter : NULL);
+	return 0;
+}
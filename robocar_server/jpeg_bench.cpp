@@ -0,0 +1,199 @@
+/*
+ * jpeg_bench.cpp
+ *
+ * Measures JPEG compression of camera frames: from YUYV directly
+ * and through RGB, at each subsampling, then through JpegPool with
+ * more and more workers. Quality of each is given as PSNR against
+ * the RGB that ColorConvert makes of the same frame.
+ *
+ * Usage: jpeg_bench [-size WxH] [-n frames] [-quality Q] [-workers N]
+ *                   [-input file.yuyv]
+ *
+ * Frames are synthesized unless a raw YUYV file of the given size
+ * is read with -input, which gives more telling ratios.
+ */
+
+#include "JpegHandler.h"
+#include "JpegPool.h"
+#include "ColorConvert.h"
+#include "MessageRegisters.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <time.h>
+
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using namespace Robocar;
+
+
+static double now ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+static const char *subsamplingName (JPEG_SUBSAMPLING subsampling)
+{
+	return (subsampling==JPEG_444 ? "4:4:4" : subsampling==JPEG_422 ? "4:2:2" : "4:2:0");
+}
+
+
+static double psnr (const vector<uint8_t> &a, const vector<uint8_t> &b)
+{
+	double error = 0;
+	for (size_t i=0; i<a.size(); i++)
+		error += (a[i] - b[i]) * (a[i] - b[i]);
+	if (error==0)
+		return INFINITY;
+	return 10 * log10 (255.0*255.0 * a.size() / error);
+}
+
+
+// Gradients with some texture, so that not every block is flat
+static void synthesize (vector<uint8_t> &yuyv, int width, int height)
+{
+	for (int y=0; y<height; y++)
+		for (int x=0; x<width; x+=2) {
+			uint8_t *m = &yuyv[2*(y*width + x)];
+			int texture = ((x/8 + y/8) % 2 ? 12 : 0) + rand() % 6;
+			m[0] = std::min (255, ((x + y) & 0xff) / 2 + texture + 32);
+			m[1] = 64 + (x*128/width);
+			m[2] = std::min (255, ((x + y + 1) & 0xff) / 2 + texture + 32);
+			m[3] = 64 + (y*128/height);
+		}
+}
+
+
+static void benchCodec (const vector<uint8_t> &yuyv, int width, int height, int frames, int quality)
+{
+	int pixels = width*height;
+	vector<uint8_t> reference (3*pixels), rgb (3*pixels), decoded;
+	yuyvToRgb (&yuyv[0], &reference[0], pixels);
+	JpegCompress compressor (quality);
+	JpegDecompress decompressor;
+
+	cout << width << "x" << height << ", " << frames << " frames, quality " << quality << endl;
+	for (int path=0; path<2; path++) {
+		bool direct = (path==0);
+		for (int s=JPEG_444; s<=JPEG_420; s++) {
+			compressor.setSubsampling ((JPEG_SUBSAMPLING)s);
+			vector<double> cost;
+			uint32_t size = 0;
+			shared_ptr<uint8_t> jpeg;
+			for (int f=0; f<frames; f++) {
+				double t = now ();
+				if (direct)
+					jpeg = compressor.compress (&yuyv[0], width, height, JPEG_YUYV, size);
+				else {
+					yuyvToRgb (&yuyv[0], &rgb[0], pixels);
+					jpeg = compressor.compress (&rgb[0], width, height, JPEG_RGB, size);
+				}
+				cost.push_back (now() - t);
+			}
+			std::sort (cost.begin(), cost.end());
+			double median = cost[cost.size()/2];
+			int w, h;
+			decompressor.decompress (jpeg.get(), size, decoded, w, h);
+			printf ("%-5s %s median %7.2f ms, %6.1f Mpixel/s, %7u bytes, ratio %5.1f, PSNR %5.2f dB\n",
+				(direct ? "yuyv" : "rgb"), subsamplingName ((JPEG_SUBSAMPLING)s), median*1e3,
+				pixels/median/1e6, size, 2.0*pixels/size, psnr (reference, decoded));
+		}
+	}
+}
+
+
+/*
+ * Frames are submitted as fast as the pool takes them, as capture
+ * would with a fast camera
+ */
+static void benchPool (const vector<uint8_t> &yuyv, int width, int height, int frames, int quality,
+	int maxWorkers)
+{
+	_imageMessageBuffer header;
+	header.width = width;
+	header.height = height;
+	header.format = IMAGE_YUYV;
+	header.device = 0;
+	header.stream = 0;
+	timeval stamp;
+	gettimeofday (&stamp, NULL);
+	shared_ptr<uint8_t> image (new uint8_t [yuyv.size()]);
+	std::copy (yuyv.begin(), yuyv.end(), image.get());
+
+	for (int workers=1; workers<=maxWorkers; workers++) {
+		MessageQueue queue;
+		JpegPool pool (&queue, workers);
+		double t = now ();
+		for (int f=0; f<frames; ) {
+			if (pool.submit (image, JPEG_YUYV, header, stamp, quality, JPEG_420))
+				f++;
+			else
+				usleep (100);
+		}
+		for (int f=0; f<frames; f++)
+			queue.pop ();
+		double spent = now() - t;
+		JpegStatistics stats = pool.takeStatistics ();
+		printf ("pool  %d worker%s %7.1f frames/s, %6.2f ms per frame in worker\n", workers,
+			(workers > 1 ? "s" : " "), frames/spent, stats.seconds / stats.images * 1e3);
+	}
+}
+
+
+int main (int argc, char **argv)
+{
+	int width = 640, height = 480, frames = 200, quality = JpegDefaultQuality, workers = 4;
+	string input;
+
+	for (int i=1; i<argc; i++) {
+		string arg (argv[i]);
+		if (arg=="-size" && i+1<argc) {
+			if (sscanf (argv[++i], "%dx%d", &width, &height) != 2 || width < 2 || height <= 0
+				|| width % 2) {
+				cerr << "Invalid size " << argv[i] << endl;
+				return 1;
+			}
+		}
+		else if (arg=="-n" && i+1<argc)
+			frames = std::max (1, atoi (argv[++i]));
+		else if (arg=="-quality" && i+1<argc)
+			quality = atoi (argv[++i]);
+		else if (arg=="-workers" && i+1<argc)
+			workers = std::max (1, atoi (argv[++i]));
+		else if (arg=="-input" && i+1<argc)
+			input = argv[++i];
+		else {
+			cerr << "Usage: " << argv[0] << " [-size WxH] [-n frames] [-quality Q] [-workers N]"
+				" [-input file.yuyv]" << endl;
+			return 1;
+		}
+	}
+
+	vector<uint8_t> yuyv (2*width*height);
+	if (input.empty())
+		synthesize (yuyv, width, height);
+	else {
+		FILE *fd = fopen (input.c_str(), "r");
+		if (fd==NULL || fread (&yuyv[0], 1, yuyv.size(), fd) != yuyv.size()) {
+			cerr << "Unable to read " << width << "x" << height << " YUYV from " << input << endl;
+			return 1;
+		}
+		fclose (fd);
+	}
+
+	benchCodec (yuyv, width, height, frames, quality);
+	benchPool (yuyv, width, height, frames, quality, workers);
+	return 0;
+}
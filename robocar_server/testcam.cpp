@@ -6,12 +6,13 @@
  */
 
 
-#include "usb_cam.h"
+#include "V4L2Capture.h"
+#include "JpegHandler.h"
 #include <iostream>
+#include <vector>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <jpeglib.h>
 #include <sys/types.h>
 
 
@@ -19,53 +20,25 @@ using std::cout;
 using std::endl;
 
 
-void saveJpeg (const char *filename, uint8_t *rgb, int width, int height)
+int main (int argc, char *argv[])
 {
-	FILE *jpgfile = fopen (filename, "w");
-	JSAMPARRAY image;
-	image = (JSAMPARRAY)calloc (height, sizeof(JSAMPROW));
-
-	for (size_t i=0; i<height; i++) {
-		image[i] = (JSAMPROW)calloc (width*3, sizeof(JSAMPLE));
-
-		for (size_t j=0; j<width; j++) {
-			image[i][j*3 + 0] = rgb[(i*width + j)*3 + 0] ;
-			image[i][j*3 + 1] = rgb[(i*width + j)*3 + 1];
-			image[i][j*3 + 2] = rgb[(i*width + j)*3 + 2];
-		}
-	}
-
-	struct jpeg_compress_struct compress;
-	struct jpeg_error_mgr error;
-	compress.err = jpeg_std_error (&error);
-	jpeg_create_compress (&compress);
-	jpeg_stdio_dest(&compress, jpgfile);
-
-	compress.image_width = width;
-	compress.image_height = height;
-	compress.input_components = 3;
-	compress.in_color_space = JCS_RGB;
-	jpeg_set_defaults(&compress);
-	jpeg_set_quality(&compress, 100, TRUE);
-	jpeg_start_compress(&compress, TRUE);
-	jpeg_write_scanlines(&compress, image, height);
-	jpeg_finish_compress(&compress);
-	jpeg_destroy_compress(&compress);
-
-	for (size_t i=0; i<height; i++) {
-		free (image[i]);
+	Robocar::V4L2Capture camera (argc > 1 ? argv[1] : "/dev/video0");
+	camera.start (640, 480, 15, Robocar::V4L2Capture::FORMAT_YUYV);
+	Robocar::V4L2Frame frame;
+	while (camera.grab (frame, 5000)==false);
+	int pixels = camera.getWidth() * camera.getHeight();
+	if (frame.size < 2*pixels) {
+		std::cerr << "Short frame" << endl;
+		return 1;
 	}
-	free (image);
 
+	Robocar::JpegCompress compressor (95, Robocar::JPEG_444);
+	uint32_t size;
+	shared_ptr<uint8_t> jpeg = compressor.compress (frame.data.get(),
+		camera.getWidth(), camera.getHeight(), Robocar::JPEG_YUYV, size);
+	FILE *jpgfile = fopen ("testcam.jpg", "w");
+	fwrite (jpeg.get(), 1, size, jpgfile);
 	fclose (jpgfile);
-}
-
-
-int main (int argc, char *argv[])
-{
-	usb_cam_camera_image_t *camera = usb_cam_camera_start("/dev/video0", 640, 480, 15);
-	usb_cam_camera_grab_image (camera);
-	saveJpeg("testcam.jpg", (uint8_t*)camera->image, camera->width, camera->height);
 
 	return 0;
 }
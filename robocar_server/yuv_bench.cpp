@@ -0,0 +1,180 @@
+/*
+ * yuv_bench.cpp
+ *
+ * Measures YUYV to RGB conversion with every kernel this processor
+ * can run, on synthesized frames.
+ *
+ * Usage: yuv_bench [-size WxH] [-n frames]
+ *        yuv_bench -verify
+ *
+ * -verify runs every kernel over all combinations of Y, U and V and
+ * over odd widths, in both byte orders, and fails if any output
+ * byte differs from the scalar kernel, or a byte past the end of
+ * the image is written.
+ */
+
+#include "ColorConvert.h"
+#include "simd.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using namespace Robocar;
+
+
+static double now ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+static vector<ColorKernel> usableKernels ()
+{
+	vector<ColorKernel> kernels;
+	kernels.push_back (COLOR_SCALAR);
+	ColorKernel best = colorKernel ();
+	if (best==COLOR_AVX2)
+		kernels.push_back (COLOR_SSE2);
+	if (best != COLOR_SCALAR)
+		kernels.push_back (best);
+	return kernels;
+}
+
+
+static void convert (bool uyvy, const vector<uint8_t> &src, vector<uint8_t> &dst, int pixels,
+	ColorKernel kernel)
+{
+	if (uyvy)
+		uyvyToRgb (&src[0], &dst[0], pixels, kernel);
+	else
+		yuyvToRgb (&src[0], &dst[0], pixels, kernel);
+}
+
+
+static int verify ()
+{
+	const int guard = 64;
+	vector<ColorKernel> kernels = usableKernels ();
+	int failed = 0;
+
+	for (int order=0; order<2; order++) {
+		bool uyvy = (order==1);
+		// every (u, v), with luma running over the whole range
+		const int pairs = 256*256;
+		vector<uint8_t> src (4*pairs);
+		for (int y=0; y<256; y+=5) {
+			for (int i=0; i<pairs; i++) {
+				uint8_t *m = &src[4*i];
+				m[uyvy ? 1 : 0] = y;
+				m[uyvy ? 3 : 2] = 255 - y;
+				m[uyvy ? 0 : 1] = i >> 8;
+				m[uyvy ? 2 : 3] = i & 0xff;
+			}
+			vector<uint8_t> ref (6*pairs);
+			convert (uyvy, src, ref, 2*pairs, COLOR_SCALAR);
+			for (size_t k=1; k<kernels.size(); k++) {
+				vector<uint8_t> out (6*pairs);
+				convert (uyvy, src, out, 2*pairs, kernels[k]);
+				if (out != ref) {
+					cerr << colorKernelName (kernels[k]) << (uyvy ? " UYVY" : " YUYV")
+						<< ": mismatch at luma " << y << endl;
+					failed++;
+				}
+			}
+		}
+
+		// every length up to a few vectors, for the tails
+		for (int pixels=0; pixels<=200; pixels+=2) {
+			vector<uint8_t> in (2*pixels + guard), ref (3*pixels + guard, 0xa5);
+			for (size_t i=0; i<in.size(); i++)
+				in[i] = rand ();
+			convert (uyvy, in, ref, pixels, COLOR_SCALAR);
+			for (size_t k=1; k<kernels.size(); k++) {
+				vector<uint8_t> out (3*pixels + guard, 0xa5);
+				convert (uyvy, in, out, pixels, kernels[k]);
+				if (out != ref) {
+					cerr << colorKernelName (kernels[k]) << (uyvy ? " UYVY" : " YUYV")
+						<< ": mismatch with " << pixels << " pixels" << endl;
+					failed++;
+				}
+			}
+		}
+	}
+
+	for (size_t k=1; k<kernels.size(); k++)
+		cout << colorKernelName (kernels[k]) << ": " << (failed ? "FAILED" : "0 mismatch") << endl;
+	return failed;
+}
+
+
+int main (int argc, char **argv)
+{
+	int width = 640, height = 480, frames = 500;
+	bool verifyOnly = false;
+
+	for (int i=1; i<argc; i++) {
+		string arg (argv[i]);
+		if (arg=="-size" && i+1<argc) {
+			if (sscanf (argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0
+				|| (width*height) % 2) {
+				cerr << "Invalid size " << argv[i] << endl;
+				return 1;
+			}
+		}
+		else if (arg=="-n" && i+1<argc)
+			frames = atoi (argv[++i]);
+		else if (arg=="-verify")
+			verifyOnly = true;
+		else {
+			cerr << "Usage: " << argv[0] << " [-size WxH] [-n frames] | -verify" << endl;
+			return 1;
+		}
+	}
+
+	if (verifyOnly)
+		return verify () ? 1 : 0;
+
+	int pixels = width*height;
+	vector<uint8_t> src (2*pixels), dst (3*pixels);
+	// smooth gradients, like a camera gives
+	for (int y=0; y<height; y++)
+		for (int x=0; x<width; x+=2) {
+			uint8_t *m = &src[2*(y*width + x)];
+			m[0] = (x + y) & 0xff;
+			m[1] = 64 + (x*128/width);
+			m[2] = (x + y + 1) & 0xff;
+			m[3] = 64 + (y*128/height);
+		}
+
+	vector<ColorKernel> kernels = usableKernels ();
+	double scalarTime = 0;
+	cout << width << "x" << height << ", " << frames << " frames" << endl;
+	for (size_t k=0; k<kernels.size(); k++) {
+		vector<double> cost;
+		for (int f=0; f<frames; f++) {
+			double t = now ();
+			yuyvToRgb (&src[0], &dst[0], pixels, kernels[k]);
+			cost.push_back (now() - t);
+		}
+		std::sort (cost.begin(), cost.end());
+		double median = cost[cost.size()/2];
+		if (k==0)
+			scalarTime = median;
+		printf ("%-7s median %8.1f us, %7.1f Mpixel/s, %5.2fx\n", colorKernelName (kernels[k]),
+			median*1e6, pixels/median/1e6, scalarTime/median);
+	}
+	return 0;
+}